@@ -0,0 +1,239 @@
+#include "config.h"
+#include "debug.h"
+
+#include <libubox/blobmsg_json.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+struct config_st
+{
+    char * path;
+    struct blob_buf buf;
+};
+
+static bool config_write_file(config_st const * const config)
+{
+    bool written;
+    char tmp_path[PATH_MAX];
+    char * json = NULL;
+    FILE * fp = NULL;
+
+    if (config->path == NULL)
+    {
+        /* No file to persist to. Changes last until exit. */
+        written = true;
+        goto done;
+    }
+
+    json = blobmsg_format_json_indent(config->buf.head, true, 0);
+    if (json == NULL)
+    {
+        written = false;
+        goto done;
+    }
+
+    /* Write to a temporary file then rename it so a crash part way
+     * through doesn't leave a truncated configuration behind.
+     */
+    snprintf(tmp_path, sizeof tmp_path, "%s.tmp", config->path);
+    fp = fopen(tmp_path, "w");
+    if (fp == NULL)
+    {
+        EPRINTF("Failed to open config file: %s\n", tmp_path);
+        written = false;
+        goto done;
+    }
+
+    if (fprintf(fp, "%s\n", json) < 0)
+    {
+        fclose(fp);
+        written = false;
+        goto done;
+    }
+
+    if (fclose(fp) != 0)
+    {
+        written = false;
+        goto done;
+    }
+
+    if (rename(tmp_path, config->path) != 0)
+    {
+        EPRINTF("Failed to rename config file: %s\n", tmp_path);
+        written = false;
+        goto done;
+    }
+
+    written = true;
+
+done:
+    free(json);
+
+    return written;
+}
+
+config_st * config_load(char const * const path)
+{
+    config_st * config = calloc(1, sizeof *config);
+
+    if (config == NULL)
+    {
+        goto done;
+    }
+
+    blob_buf_init(&config->buf, 0);
+
+    if (path == NULL)
+    {
+        goto done;
+    }
+
+    config->path = strdup(path);
+
+    if (!blobmsg_add_json_from_file(&config->buf, path))
+    {
+        /* A missing or invalid file just means that the defaults are
+         * used. The file will be created if the configuration is
+         * modified.
+         */
+        WPRINTF("Failed to load config file: %s\n", path);
+        blob_buf_init(&config->buf, 0);
+    }
+
+done:
+    return config;
+}
+
+void config_free(config_st * const config)
+{
+    if (config == NULL)
+    {
+        goto done;
+    }
+
+    blob_buf_free(&config->buf);
+    free(config->path);
+    free(config);
+
+done:
+    return;
+}
+
+struct blob_attr * config_get_section(
+    config_st const * const config,
+    char const * const section_name)
+{
+    struct blob_attr * section = NULL;
+    struct blob_attr * cur;
+    int rem;
+
+    if (config == NULL)
+    {
+        goto done;
+    }
+
+    rem = blob_len(config->buf.head);
+    __blob_for_each_attr(cur, blob_data(config->buf.head), rem)
+    {
+        if (strcmp(blobmsg_name(cur), section_name) == 0)
+        {
+            section = cur;
+            break;
+        }
+    }
+
+done:
+    return section;
+}
+
+char const * config_get_string(
+    config_st const * const config,
+    char const * const name)
+{
+    struct blob_attr * const attr = config_get_section(config, name);
+    char const * value;
+
+    if (attr == NULL || blobmsg_type(attr) != BLOBMSG_TYPE_STRING)
+    {
+        value = NULL;
+        goto done;
+    }
+
+    value = blobmsg_get_string(attr);
+
+done:
+    return value;
+}
+
+bool config_get_u32(
+    config_st const * const config,
+    char const * const name,
+    uint32_t * const value)
+{
+    struct blob_attr * const attr = config_get_section(config, name);
+    bool got_value;
+
+    if (attr == NULL)
+    {
+        got_value = false;
+        goto done;
+    }
+
+    switch (blobmsg_type(attr))
+    {
+        case BLOBMSG_TYPE_INT32:
+            *value = blobmsg_get_u32(attr);
+            got_value = true;
+            break;
+        case BLOBMSG_TYPE_INT64:
+            *value = blobmsg_get_u64(attr);
+            got_value = true;
+            break;
+        default:
+            got_value = false;
+            break;
+    }
+
+done:
+    return got_value;
+}
+
+bool config_set_section(
+    config_st * const config,
+    struct blob_attr * const section)
+{
+    bool updated;
+    struct blob_buf new_buf;
+    struct blob_attr * cur;
+    int rem;
+
+    if (config == NULL)
+    {
+        updated = false;
+        goto done;
+    }
+
+    memset(&new_buf, 0, sizeof new_buf);
+    blob_buf_init(&new_buf, 0);
+
+    rem = blob_len(config->buf.head);
+    __blob_for_each_attr(cur, blob_data(config->buf.head), rem)
+    {
+        if (strcmp(blobmsg_name(cur), blobmsg_name(section)) != 0)
+        {
+            blobmsg_add_blob(&new_buf, cur);
+        }
+    }
+    blobmsg_add_blob(&new_buf, section);
+
+    blob_buf_free(&config->buf);
+    config->buf = new_buf;
+
+    updated = config_write_file(config);
+
+done:
+    return updated;
+}
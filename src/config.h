@@ -0,0 +1,39 @@
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+#include <libubox/blobmsg.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct config_st config_st;
+
+config_st * config_load(char const * const path);
+
+void config_free(config_st * const config);
+
+struct blob_attr * config_get_section(
+    config_st const * const config,
+    char const * const section_name);
+
+/* The returned string is only valid until the configuration is next 
+ * modified. 
+ */
+char const * config_get_string(
+    config_st const * const config,
+    char const * const name);
+
+/* Returns false if the value isn't present or isn't an integer. */
+bool config_get_u32(
+    config_st const * const config,
+    char const * const name,
+    uint32_t * const value);
+
+/* Replace (or add) the section with the same name as the supplied
+ * attribute and write the updated configuration back to the file.
+ */
+bool config_set_section(
+    config_st * const config,
+    struct blob_attr * const section);
+
+#endif /* __CONFIG_H__ */
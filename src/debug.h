@@ -1,14 +1,26 @@
 #ifndef __DEBUG_H__
 #define __DEBUG_H__
 
-#include <stdio.h>
+#include "log.h"
 
-#define DPRINTF(format, ...) \
+/* Messages above this level are compiled out altogether. */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+
+#define LOG_PRINTF(level, format, ...) \
     do \
     { \
-        fprintf(stderr, "%s(%d): " format, __func__, __LINE__, ## __VA_ARGS__); \
-        fflush(stderr); \
+        if ((level) <= LOG_COMPILE_LEVEL && (level) <= log_runtime_level) \
+        { \
+            log_message((level), __func__, __LINE__, format, ## __VA_ARGS__); \
+        } \
     } while(0)
 
+#define EPRINTF(format, ...) LOG_PRINTF(LOG_ERR, format, ## __VA_ARGS__)
+#define WPRINTF(format, ...) LOG_PRINTF(LOG_WARNING, format, ## __VA_ARGS__)
+#define IPRINTF(format, ...) LOG_PRINTF(LOG_INFO, format, ## __VA_ARGS__)
+#define DPRINTF(format, ...) LOG_PRINTF(LOG_DEBUG, format, ## __VA_ARGS__)
+
 
 #endif /* __DEBUG_H__ */
@@ -0,0 +1,401 @@
+#include "event_journal.h"
+#include "loop_profile.h"
+#include "debug.h"
+
+#include <libubox/uloop.h>
+#include <libubox/utils.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define EVENT_JOURNAL_BUFFER_RECORDS 512
+#define EVENT_JOURNAL_DEFAULT_SEGMENT_SIZE (1024 * 1024)
+#define EVENT_JOURNAL_DEFAULT_MAX_SEGMENTS 16
+#define EVENT_JOURNAL_DEFAULT_FLUSH_MSECS 1000
+
+struct event_journal_st
+{
+    char * directory;
+    uint32_t segment_size;
+    uint32_t max_segments;
+    uint32_t flush_interval_msecs;
+
+    int fd;
+    uint32_t segment_index;
+    size_t segment_bytes;
+    /* The time that the next record's delta is from. */
+    uint64_t last_time_us;
+
+    struct uloop_timeout flush_timer;
+    size_t num_buffered;
+    event_journal_record_st buffer[EVENT_JOURNAL_BUFFER_RECORDS];
+};
+
+enum
+{
+    JOURNAL_CONFIG_DIRECTORY,
+    JOURNAL_CONFIG_SEGMENT_SIZE,
+    JOURNAL_CONFIG_MAX_SEGMENTS,
+    JOURNAL_CONFIG_FLUSH_INTERVAL,
+    __JOURNAL_CONFIG_MAX
+};
+
+static struct blobmsg_policy const journal_config_policy[__JOURNAL_CONFIG_MAX] =
+{
+    [JOURNAL_CONFIG_DIRECTORY] = { .name = "directory", .type = BLOBMSG_TYPE_STRING },
+    [JOURNAL_CONFIG_SEGMENT_SIZE] = { .name = "segment_size", .type = BLOBMSG_TYPE_INT32 },
+    [JOURNAL_CONFIG_MAX_SEGMENTS] = { .name = "max_segments", .type = BLOBMSG_TYPE_INT32 },
+    [JOURNAL_CONFIG_FLUSH_INTERVAL] = { .name = "flush_interval_ms", .type = BLOBMSG_TYPE_INT32 }
+};
+
+static uint64_t
+now_usecs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void
+segment_path(
+    event_journal_st const * const journal,
+    uint32_t const index,
+    char * const path,
+    size_t const path_size)
+{
+    snprintf(path,
+             path_size,
+             "%s/" EVENT_JOURNAL_FILE_PREFIX "%08u" EVENT_JOURNAL_FILE_SUFFIX,
+             journal->directory,
+             index);
+}
+
+static bool
+parse_segment_index(char const * const filename, uint32_t * const index)
+{
+    unsigned int value;
+    char suffix[8];
+    bool parsed;
+
+    if (sscanf(filename, EVENT_JOURNAL_FILE_PREFIX "%8u%7s", &value, suffix) != 2
+        || strcmp(suffix, EVENT_JOURNAL_FILE_SUFFIX) != 0)
+    {
+        parsed = false;
+        goto done;
+    }
+    *index = value;
+    parsed = true;
+
+done:
+    return parsed;
+}
+
+/* Find the segment after the newest one in the directory, removing any
+ * that are too old to keep once that segment has been started.
+ */
+static uint32_t
+find_next_segment_index(event_journal_st const * const journal)
+{
+    DIR * const dir = opendir(journal->directory);
+    struct dirent * entry;
+    uint32_t next_index = 0;
+    uint32_t index;
+
+    if (dir == NULL)
+    {
+        goto done;
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (parse_segment_index(entry->d_name, &index) && index >= next_index)
+        {
+            next_index = index + 1;
+        }
+    }
+
+    rewinddir(dir);
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (parse_segment_index(entry->d_name, &index)
+            && index + journal->max_segments <= next_index)
+        {
+            char path[PATH_MAX];
+
+            segment_path(journal, index, path, sizeof path);
+            unlink(path);
+        }
+    }
+
+    closedir(dir);
+
+done:
+    return next_index;
+}
+
+static bool
+open_segment(event_journal_st * const journal)
+{
+    char path[PATH_MAX];
+    event_journal_header_st const header =
+    {
+        .magic = EVENT_JOURNAL_MAGIC,
+        .version = EVENT_JOURNAL_VERSION,
+        .record_size = sizeof(event_journal_record_st),
+        .start_time_us = journal->last_time_us
+    };
+    bool opened;
+
+    /* Even if the segment can't be opened, account for it as if it had 
+     * been, so that another is tried once it would have been full. 
+     */
+    journal->segment_bytes = sizeof header;
+
+    segment_path(journal, journal->segment_index, path, sizeof path);
+    journal->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (journal->fd < 0)
+    {
+        EPRINTF("Failed to open journal segment: %s\n", path);
+        opened = false;
+        goto done;
+    }
+
+    if (write(journal->fd, &header, sizeof header) != sizeof header)
+    {
+        EPRINTF("Failed to write journal segment header: %s\n", path);
+        close(journal->fd);
+        journal->fd = -1;
+        opened = false;
+        goto done;
+    }
+
+    /* Remove the segment that has just fallen out of the window. */
+    if (journal->segment_index >= journal->max_segments)
+    {
+        segment_path(journal,
+                     journal->segment_index - journal->max_segments,
+                     path,
+                     sizeof path);
+        unlink(path);
+    }
+
+    opened = true;
+
+done:
+    return opened;
+}
+
+static void
+flush_records(event_journal_st * const journal)
+{
+    size_t const length = journal->num_buffered * sizeof journal->buffer[0];
+
+    if (length == 0)
+    {
+        goto done;
+    }
+
+    uloop_timeout_cancel(&journal->flush_timer);
+    journal->num_buffered = 0;
+    journal->segment_bytes += length;
+
+    if (journal->fd < 0)
+    {
+        goto done;
+    }
+
+    ssize_t const written = write(journal->fd, journal->buffer, length);
+
+    if (written < 0 || (size_t)written != length)
+    {
+        EPRINTF("Failed to write journal: %s\n", strerror(errno));
+    }
+
+done:
+    return;
+}
+
+static void
+flush_timer_handler(struct uloop_timeout * const timeout)
+{
+    event_journal_st * const journal =
+        container_of(timeout, event_journal_st, flush_timer);
+    uint64_t const profile_start = loop_profile_begin();
+
+    flush_records(journal);
+    loop_profile_end(loop_profile_handler_journal_flush, profile_start);
+}
+
+static void
+append_record(
+    event_journal_st * const journal,
+    event_journal_record_st const * const record)
+{
+    size_t const buffered_bytes = journal->num_buffered * sizeof *record;
+
+    if (journal->segment_bytes + buffered_bytes + sizeof *record > journal->segment_size)
+    {
+        flush_records(journal);
+        if (journal->fd >= 0)
+        {
+            close(journal->fd);
+        }
+        journal->fd = -1;
+        journal->segment_index++;
+        /* If this fails, records are dropped until the next rotation. */
+        open_segment(journal);
+    }
+
+    journal->buffer[journal->num_buffered++] = *record;
+    journal->last_time_us += record->time_delta_us;
+
+    if (journal->num_buffered == EVENT_JOURNAL_BUFFER_RECORDS)
+    {
+        flush_records(journal);
+    }
+    else if (!journal->flush_timer.pending)
+    {
+        uloop_timeout_set(&journal->flush_timer, journal->flush_interval_msecs);
+    }
+}
+
+void event_journal_record(
+    event_journal_st * const journal,
+    event_journal_record_type_t const type,
+    uint8_t const changed,
+    uint8_t const states)
+{
+    if (journal == NULL)
+    {
+        goto done;
+    }
+
+    uint64_t const now = now_usecs();
+    /* Don't go backwards if the clock is stepped back. */
+    uint64_t delta = now > journal->last_time_us ? now - journal->last_time_us : 0;
+
+    while (delta > UINT32_MAX)
+    {
+        event_journal_record_st const gap =
+        {
+            .time_delta_us = UINT32_MAX,
+            .type = event_journal_record_gap
+        };
+
+        append_record(journal, &gap);
+        delta -= UINT32_MAX;
+    }
+
+    event_journal_record_st const record =
+    {
+        .time_delta_us = delta,
+        .type = type,
+        .changed = changed,
+        .states = states
+    };
+
+    append_record(journal, &record);
+
+done:
+    return;
+}
+
+event_journal_st * event_journal_create(struct blob_attr * const config_section)
+{
+    struct blob_attr * tb[__JOURNAL_CONFIG_MAX];
+    event_journal_st * journal = calloc(1, sizeof *journal);
+
+    if (journal == NULL)
+    {
+        goto done;
+    }
+
+    journal->fd = -1;
+    journal->flush_timer.cb = flush_timer_handler;
+
+    blobmsg_parse(journal_config_policy,
+                  ARRAY_SIZE(journal_config_policy),
+                  tb,
+                  blobmsg_data(config_section),
+                  blobmsg_data_len(config_section));
+
+    if (tb[JOURNAL_CONFIG_DIRECTORY] == NULL)
+    {
+        EPRINTF("No journal directory configured\n");
+        goto error;
+    }
+    journal->directory = strdup(blobmsg_get_string(tb[JOURNAL_CONFIG_DIRECTORY]));
+    journal->segment_size =
+        tb[JOURNAL_CONFIG_SEGMENT_SIZE] != NULL
+        ? blobmsg_get_u32(tb[JOURNAL_CONFIG_SEGMENT_SIZE])
+        : EVENT_JOURNAL_DEFAULT_SEGMENT_SIZE;
+    journal->max_segments =
+        tb[JOURNAL_CONFIG_MAX_SEGMENTS] != NULL
+        ? blobmsg_get_u32(tb[JOURNAL_CONFIG_MAX_SEGMENTS])
+        : EVENT_JOURNAL_DEFAULT_MAX_SEGMENTS;
+    journal->flush_interval_msecs =
+        tb[JOURNAL_CONFIG_FLUSH_INTERVAL] != NULL
+        ? blobmsg_get_u32(tb[JOURNAL_CONFIG_FLUSH_INTERVAL])
+        : EVENT_JOURNAL_DEFAULT_FLUSH_MSECS;
+
+    if (journal->directory == NULL
+        || journal->segment_size < sizeof(event_journal_header_st) + sizeof(event_journal_record_st)
+        || journal->max_segments == 0)
+    {
+        EPRINTF("Invalid journal configuration\n");
+        goto error;
+    }
+
+    if (mkdir(journal->directory, 0755) != 0 && errno != EEXIST)
+    {
+        EPRINTF("Failed to create journal directory: %s\n", journal->directory);
+        goto error;
+    }
+
+    journal->segment_index = find_next_segment_index(journal);
+    journal->last_time_us = now_usecs();
+    if (!open_segment(journal))
+    {
+        goto error;
+    }
+
+    goto done;
+
+error:
+    event_journal_done(journal);
+    journal = NULL;
+
+done:
+    return journal;
+}
+
+void event_journal_done(event_journal_st * const journal)
+{
+    if (journal == NULL)
+    {
+        goto done;
+    }
+
+    flush_records(journal);
+    uloop_timeout_cancel(&journal->flush_timer);
+    if (journal->fd >= 0)
+    {
+        close(journal->fd);
+    }
+    free(journal->directory);
+    free(journal);
+
+done:
+    return;
+}
@@ -0,0 +1,36 @@
+#ifndef __EVENT_JOURNAL_H__
+#define __EVENT_JOURNAL_H__
+
+#include "event_journal_format.h"
+
+#include <libubox/blobmsg.h>
+
+#include <stdint.h>
+
+/* An append-only journal of IO changes, for analysis after the fact
+ * with tools/piface_journal.
+ * Records are buffered and written in batches to numbered segment files
+ * in a directory. A new segment is started when the current one is
+ * full, and the oldest is removed when there are too many.
+ * Configured by a section of the form:
+ *   {"directory":"/var/log/piface","segment_size":1048576,
+ *    "max_segments":16,"flush_interval_ms":1000}
+ */
+typedef struct event_journal_st event_journal_st;
+
+/* Returns NULL if the configuration is invalid or the journal can't be
+ * written.
+ */
+event_journal_st * event_journal_create(struct blob_attr * const config_section);
+
+/* Writes out anything still buffered. */
+void event_journal_done(event_journal_st * const journal);
+
+/* Safe to call with a NULL journal. */
+void event_journal_record(
+    event_journal_st * const journal,
+    event_journal_record_type_t const type,
+    uint8_t const changed,
+    uint8_t const states);
+
+#endif /* __EVENT_JOURNAL_H__ */
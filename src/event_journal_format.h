@@ -0,0 +1,43 @@
+#ifndef __EVENT_JOURNAL_FORMAT_H__
+#define __EVENT_JOURNAL_FORMAT_H__
+
+#include <stdint.h>
+
+/* The on-disk format of the event journal. Each segment file is a
+ * header followed by fixed size records, in host byte order.
+ * Record times are the number of microseconds since the previous
+ * record, or since the segment's start time for the first record.
+ */
+#define EVENT_JOURNAL_MAGIC 0x4a464950 /* "PIFJ" */
+#define EVENT_JOURNAL_VERSION 1
+#define EVENT_JOURNAL_FILE_PREFIX "journal-"
+#define EVENT_JOURNAL_FILE_SUFFIX ".pfj"
+
+typedef struct event_journal_header_st
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint64_t start_time_us; /* Microseconds since the epoch. */
+} event_journal_header_st;
+
+typedef enum event_journal_record_type_t
+{
+    /* Nothing changed. Only the time moved on, by more than a record's
+     * time delta can hold.
+     */
+    event_journal_record_gap = 0,
+    event_journal_record_inputs = 1,
+    event_journal_record_outputs = 2
+} event_journal_record_type_t;
+
+typedef struct event_journal_record_st
+{
+    uint32_t time_delta_us;
+    uint8_t type;
+    uint8_t reserved;
+    uint8_t changed; /* The IOs that changed. */
+    uint8_t states; /* All the IO states after the change. Active is 1. */
+} event_journal_record_st;
+
+#endif /* __EVENT_JOURNAL_FORMAT_H__ */
@@ -0,0 +1,246 @@
+#include "hw_sim.h"
+#include "debug.h"
+
+#include <mcp23s17.h>
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HW_SIM_MAGIC 0x50495349 /* "PISI" */
+#define HW_SIM_NUM_REGISTERS (OLATB + 1)
+
+/* The layout of the memory mapped register file. */
+typedef struct hw_sim_layout_st
+{
+    uint32_t magic;
+    atomic_uint_least8_t registers[HW_SIM_NUM_REGISTERS];
+} hw_sim_layout_st;
+
+struct hw_sim_st
+{
+    int fd;
+    hw_sim_layout_st * layout;
+    char * irq_path;
+    /* Opened for both reading and writing so that it never sees EOF and
+     * writes never fail for want of a reader.
+     */
+    int irq_fd;
+};
+
+static void
+layout_initialise(hw_sim_layout_st * const layout)
+{
+    for (size_t i = 0; i < HW_SIM_NUM_REGISTERS; i++)
+    {
+        atomic_init(&layout->registers[i], 0);
+    }
+    atomic_init(&layout->registers[IODIRA], 0xff);
+    atomic_init(&layout->registers[IODIRB], 0xff);
+    /* All inputs open. */
+    atomic_init(&layout->registers[GPIOB], 0xff);
+    layout->magic = HW_SIM_MAGIC;
+}
+
+hw_sim_st * hw_sim_open(char const * const path)
+{
+    hw_sim_st * sim = calloc(1, sizeof *sim);
+    struct stat st;
+
+    if (sim == NULL)
+    {
+        goto done;
+    }
+
+    sim->irq_fd = -1;
+    sim->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (sim->fd < 0)
+    {
+        EPRINTF("Failed to open simulator register file: %s\n", path);
+        goto error;
+    }
+
+    if (fstat(sim->fd, &st) != 0)
+    {
+        goto error;
+    }
+    if ((size_t)st.st_size < sizeof *sim->layout
+        && ftruncate(sim->fd, sizeof *sim->layout) != 0)
+    {
+        goto error;
+    }
+
+    sim->layout = mmap(NULL,
+                       sizeof *sim->layout,
+                       PROT_READ | PROT_WRITE,
+                       MAP_SHARED,
+                       sim->fd,
+                       0);
+    if (sim->layout == MAP_FAILED)
+    {
+        sim->layout = NULL;
+        goto error;
+    }
+
+    if (sim->layout->magic != HW_SIM_MAGIC)
+    {
+        layout_initialise(sim->layout);
+    }
+
+    if (asprintf(&sim->irq_path, "%s.irq", path) < 0)
+    {
+        sim->irq_path = NULL;
+        goto error;
+    }
+    if (mkfifo(sim->irq_path, 0644) != 0 && errno != EEXIST)
+    {
+        EPRINTF("Failed to create simulator interrupt FIFO: %s\n", sim->irq_path);
+        goto error;
+    }
+    sim->irq_fd = open(sim->irq_path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (sim->irq_fd < 0)
+    {
+        goto error;
+    }
+
+    goto done;
+
+error:
+    hw_sim_close(sim);
+    sim = NULL;
+
+done:
+    return sim;
+}
+
+void hw_sim_close(hw_sim_st * const sim)
+{
+    if (sim == NULL)
+    {
+        goto done;
+    }
+
+    if (sim->irq_fd >= 0)
+    {
+        close(sim->irq_fd);
+    }
+    free(sim->irq_path);
+    if (sim->layout != NULL)
+    {
+        munmap(sim->layout, sizeof *sim->layout);
+    }
+    if (sim->fd >= 0)
+    {
+        close(sim->fd);
+    }
+    free(sim);
+
+done:
+    return;
+}
+
+static void
+clear_interrupt(hw_sim_st * const sim)
+{
+    char buf[64];
+
+    /* Drain the FIFO before clearing the flags. A change made in between
+     * finds the flags still set and doesn't signal, but is still seen
+     * by the register read that follows.
+     */
+    while (read(sim->irq_fd, buf, sizeof buf) > 0)
+    {
+    }
+    atomic_store(&sim->layout->registers[INTFB], 0);
+}
+
+uint8_t hw_sim_read_reg(hw_sim_st * const sim, uint8_t const reg)
+{
+    uint8_t value;
+
+    if (reg >= HW_SIM_NUM_REGISTERS)
+    {
+        value = 0;
+        goto done;
+    }
+
+    if (reg == GPIOB || reg == INTCAPB)
+    {
+        clear_interrupt(sim);
+    }
+    value = atomic_load(&sim->layout->registers[reg]);
+
+done:
+    return value;
+}
+
+void hw_sim_write_reg(hw_sim_st * const sim, uint8_t const value, uint8_t const reg)
+{
+    if (reg >= HW_SIM_NUM_REGISTERS)
+    {
+        goto done;
+    }
+
+    atomic_store(&sim->layout->registers[reg], value);
+    /* The outputs drive port A directly. */
+    if (reg == OLATA)
+    {
+        atomic_store(&sim->layout->registers[GPIOA], value);
+    }
+    else if (reg == GPIOA)
+    {
+        atomic_store(&sim->layout->registers[OLATA], value);
+    }
+
+done:
+    return;
+}
+
+int hw_sim_open_interrupt_fd(hw_sim_st * const sim)
+{
+    return open(sim->irq_path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+}
+
+bool hw_sim_set_inputs(hw_sim_st * const sim, uint8_t const inputs)
+{
+    atomic_uint_least8_t * const registers = sim->layout->registers;
+    uint8_t const previous = atomic_exchange(&registers[GPIOB], inputs);
+    uint8_t const gpinten = atomic_load(&registers[GPINTENB]);
+    uint8_t const intcon = atomic_load(&registers[INTCONB]);
+    uint8_t const defval = atomic_load(&registers[DEFVALB]);
+    /* Pins set in INTCON interrupt while they differ from DEFVAL, the
+     * others on any change.
+     */
+    uint8_t const triggered =
+        gpinten & ((intcon & (inputs ^ defval)) | (~intcon & (inputs ^ previous)));
+    bool raised;
+
+    if (triggered == 0)
+    {
+        raised = false;
+        goto done;
+    }
+
+    /* Like the INT pin, only signal when no interrupt is already pending. */
+    if (atomic_fetch_or(&registers[INTFB], triggered) != 0)
+    {
+        raised = false;
+        goto done;
+    }
+    atomic_store(&registers[INTCAPB], inputs);
+
+    if (write(sim->irq_fd, "", 1) < 0)
+    {
+        EPRINTF("Failed to signal simulated interrupt\n");
+    }
+    raised = true;
+
+done:
+    return raised;
+}
@@ -0,0 +1,38 @@
+#ifndef __HW_SIM_H__
+#define __HW_SIM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A simulated MCP23S17, for testing without a PiFace.
+ * The registers live in a shared memory file so that another process
+ * can drive the inputs, and a FIFO next to it (<path>.irq) stands in for
+ * the interrupt pin. Only port B, which the PiFace uses for its inputs,
+ * generates interrupts.
+ */
+typedef struct hw_sim_st hw_sim_st;
+
+/* Open the simulator at path, creating the files if they don't exist. */
+hw_sim_st * hw_sim_open(char const * const path);
+
+void hw_sim_close(hw_sim_st * const sim);
+
+/* Reading GPIOB or INTCAPB clears any pending interrupt, as on the
+ * real device.
+ */
+uint8_t hw_sim_read_reg(hw_sim_st * const sim, uint8_t const reg);
+
+void hw_sim_write_reg(hw_sim_st * const sim, uint8_t const value, uint8_t const reg);
+
+/* Return a new file descriptor that polls as readable (edge triggered)
+ * whenever the simulated interrupt fires. The caller owns it.
+ */
+int hw_sim_open_interrupt_fd(hw_sim_st * const sim);
+
+/* Drive the input pins, raising an interrupt if the configuration in
+ * GPINTENB, INTCONB and DEFVALB says that the change should.
+ * Returns true if an interrupt was raised.
+ */
+bool hw_sim_set_inputs(hw_sim_st * const sim, uint8_t const inputs);
+
+#endif /* __HW_SIM_H__ */
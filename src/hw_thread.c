@@ -0,0 +1,550 @@
+#include "hw_thread.h"
+#include "spsc_ring.h"
+#include "piface_hw.h"
+#include "loop_profile.h"
+#include "debug.h"
+
+#include <pifacedigital.h>
+#include <mcp23s17.h>
+#include <libubox/uloop.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define HW_THREAD_RING_CAPACITY 256
+/* How often the inputs are read when there is no interrupt to say that
+ * they have changed.
+ */
+#define HW_THREAD_INPUT_POLL_MSECS 10
+#define HW_THREAD_ALL_INPUTS 0xff
+
+typedef enum hw_command_type_t
+{
+    hw_command_write_outputs,
+    hw_command_write_register,
+    hw_command_watch_interrupt,
+    hw_command_quit
+} hw_command_type_t;
+
+typedef struct hw_command_st
+{
+    hw_command_type_t type;
+    uint32_t write_mask;
+    uint32_t values;
+    uint8_t reg;
+    int fd;
+    hw_thread_complete_fn complete_cb;
+    void * complete_ctx;
+} hw_command_st;
+
+typedef enum hw_event_type_t
+{
+    hw_event_complete,
+    hw_event_input_change
+} hw_event_type_t;
+
+typedef struct hw_event_st
+{
+    hw_event_type_t type;
+    uint32_t inputs;
+    uint32_t outputs;
+    hw_thread_complete_fn complete_cb;
+    void * complete_ctx;
+} hw_event_st;
+
+struct hw_thread_st
+{
+    pthread_t thread;
+    bool thread_started;
+    int hw_addr;
+
+    /* uloop thread -> hardware thread */
+    spsc_ring_st * commands;
+    int command_event_fd;
+
+    /* hardware thread -> uloop thread */
+    spsc_ring_st * events;
+    struct uloop_fd event_fd;
+    /* Set when an input change couldn't be queued because the event ring
+     * was full. The uloop thread notifies the latest snapshot instead.
+     */
+    atomic_bool input_change_overflow;
+
+    hw_thread_input_change_fn input_change_cb;
+    void * input_change_ctx;
+
+    /* Only accessed by the hardware thread. */
+    int epoll_fd;
+    int gpio_pin_fd;
+    uint8_t output_register;
+    /* The inputs that raise an interrupt when they change. The rest
+     * must be polled.
+     */
+    uint8_t interrupt_enables;
+
+    atomic_uint_least32_t input_snapshot;
+    atomic_uint_least32_t output_snapshot;
+};
+
+static uint64_t
+now_usecs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void
+signal_event_fd(int const fd)
+{
+    uint64_t const value = 1;
+
+    if (write(fd, &value, sizeof value) < 0)
+    {
+        EPRINTF("eventfd write failed\n");
+    }
+}
+
+static void
+clear_event_fd(int const fd)
+{
+    uint64_t value;
+
+    if (read(fd, &value, sizeof value) < 0)
+    {
+        /* Nothing was pending. */
+    }
+}
+
+static void
+post_event(hw_thread_st * const hw_thread, hw_event_st const * const event)
+{
+    if (!spsc_ring_push(hw_thread->events, event))
+    {
+        if (event->type == hw_event_input_change)
+        {
+            atomic_store(&hw_thread->input_change_overflow, true);
+        }
+        else
+        {
+            EPRINTF("hardware event ring full. Completion lost\n");
+        }
+    }
+    signal_event_fd(hw_thread->event_fd.fd);
+}
+
+static uint32_t
+hw_read_inputs(hw_thread_st * const hw_thread)
+{
+    uint32_t const inputs = piface_hw_read_reg(INPUT, hw_thread->hw_addr);
+
+    atomic_store(&hw_thread->input_snapshot, inputs);
+
+    return inputs;
+}
+
+static void
+service_interrupt(hw_thread_st * const hw_thread)
+{
+    hw_event_st event =
+    {
+        .type = hw_event_input_change
+    };
+
+    /* Reading the input register clears the interrupt. */
+    event.inputs = hw_read_inputs(hw_thread);
+    post_event(hw_thread, &event);
+}
+
+static void
+process_command(
+    hw_thread_st * const hw_thread,
+    hw_command_st const * const command,
+    bool * const quit)
+{
+    hw_event_st event =
+    {
+        .type = hw_event_complete,
+        .complete_cb = command->complete_cb,
+        .complete_ctx = command->complete_ctx
+    };
+
+    switch (command->type)
+    {
+        case hw_command_write_outputs:
+            /* This thread is the only writer, so the cached value is the
+             * current register value and needn't be read back.
+             */
+            hw_thread->output_register &= ~command->write_mask;
+            hw_thread->output_register |= command->values & command->write_mask;
+            piface_hw_write_reg(hw_thread->output_register, OUTPUT, hw_thread->hw_addr);
+            atomic_store(&hw_thread->output_snapshot, hw_thread->output_register);
+            break;
+        case hw_command_write_register:
+            piface_hw_write_reg(command->values, command->reg, hw_thread->hw_addr);
+            if (command->reg == GPINTENB)
+            {
+                hw_thread->interrupt_enables = command->values;
+            }
+            break;
+        case hw_command_watch_interrupt:
+        {
+            struct epoll_event epoll_event =
+            {
+                .events = EPOLLIN | EPOLLPRI | EPOLLET,
+                .data.fd = command->fd
+            };
+
+            if (epoll_ctl(hw_thread->epoll_fd, EPOLL_CTL_ADD, command->fd, &epoll_event) != 0)
+            {
+                EPRINTF("Failed to watch GPIO interrupt pin\n");
+                close(command->fd);
+                break;
+            }
+            hw_thread->gpio_pin_fd = command->fd;
+            break;
+        }
+        case hw_command_quit:
+            *quit = true;
+            break;
+    }
+
+    if (command->complete_cb != NULL)
+    {
+        event.inputs = atomic_load(&hw_thread->input_snapshot);
+        event.outputs = atomic_load(&hw_thread->output_snapshot);
+        post_event(hw_thread, &event);
+    }
+}
+
+static bool
+input_poll_needed(hw_thread_st const * const hw_thread)
+{
+    return hw_thread->gpio_pin_fd < 0
+           || hw_thread->interrupt_enables != HW_THREAD_ALL_INPUTS;
+}
+
+/* Read the inputs if the poll deadline has passed, and return how long
+ * to wait for the next one, or -1 if no polling is needed.
+ */
+static int
+poll_inputs(hw_thread_st * const hw_thread, uint64_t * const next_poll_usecs)
+{
+    uint64_t const now = now_usecs();
+    int timeout;
+
+    if (!input_poll_needed(hw_thread))
+    {
+        timeout = -1;
+        goto done;
+    }
+
+    if (now >= *next_poll_usecs)
+    {
+        hw_read_inputs(hw_thread);
+        *next_poll_usecs = now + HW_THREAD_INPUT_POLL_MSECS * 1000;
+    }
+
+    timeout = (*next_poll_usecs - now + 999) / 1000;
+
+done:
+    return timeout;
+}
+
+/* Returns the number of events, or 0 if the wait timed out. */
+static int
+service_events(hw_thread_st * const hw_thread, int const timeout)
+{
+    struct epoll_event epoll_events[2];
+    int const num_events =
+        epoll_wait(hw_thread->epoll_fd, epoll_events, 2, timeout);
+
+    for (int i = 0; i < num_events; i++)
+    {
+        if (epoll_events[i].data.fd == hw_thread->command_event_fd)
+        {
+            clear_event_fd(hw_thread->command_event_fd);
+        }
+        else if (epoll_events[i].data.fd == hw_thread->gpio_pin_fd)
+        {
+            service_interrupt(hw_thread);
+        }
+    }
+
+    return num_events;
+}
+
+static void *
+hw_thread_main(void * const arg)
+{
+    hw_thread_st * const hw_thread = arg;
+    uint64_t next_poll_usecs = 0;
+    bool quit = false;
+
+    while (!quit)
+    {
+        hw_command_st command;
+
+        /* The poll runs to a deadline rather than after a quiet spell, so
+         * that a steady stream of commands can't hold it off.
+         */
+        service_events(hw_thread, poll_inputs(hw_thread, &next_poll_usecs));
+
+        while (!quit && spsc_ring_pop(hw_thread->commands, &command))
+        {
+            process_command(hw_thread, &command, &quit);
+            /* Don't let an interrupt wait behind a long run of commands. */
+            service_events(hw_thread, 0);
+            poll_inputs(hw_thread, &next_poll_usecs);
+        }
+    }
+
+    return NULL;
+}
+
+static void
+handle_hw_events(struct uloop_fd * u, unsigned int events)
+{
+    hw_thread_st * const hw_thread = container_of(u, hw_thread_st, event_fd);
+    uint64_t const profile_start = loop_profile_begin();
+    hw_event_st event;
+    (void)events;
+
+    clear_event_fd(hw_thread->event_fd.fd);
+
+    while (spsc_ring_pop(hw_thread->events, &event))
+    {
+        switch (event.type)
+        {
+            case hw_event_complete:
+                event.complete_cb(event.complete_ctx, event.inputs, event.outputs);
+                break;
+            case hw_event_input_change:
+                hw_thread->input_change_cb(hw_thread->input_change_ctx, event.inputs);
+                break;
+        }
+    }
+
+    if (atomic_exchange(&hw_thread->input_change_overflow, false))
+    {
+        hw_thread->input_change_cb(hw_thread->input_change_ctx,
+                                   atomic_load(&hw_thread->input_snapshot));
+    }
+    loop_profile_end(loop_profile_handler_hw_events, profile_start);
+}
+
+static bool
+send_command(
+    hw_thread_st * const hw_thread,
+    hw_command_st const * const command)
+{
+    bool sent;
+
+    if (!spsc_ring_push(hw_thread->commands, command))
+    {
+        EPRINTF("hardware command ring full\n");
+        sent = false;
+        goto done;
+    }
+
+    signal_event_fd(hw_thread->command_event_fd);
+    sent = true;
+
+done:
+    return sent;
+}
+
+bool hw_thread_watch_interrupt(
+    hw_thread_st * const hw_thread,
+    int const gpio_pin_fd)
+{
+    hw_command_st const command =
+    {
+        .type = hw_command_watch_interrupt,
+        .fd = gpio_pin_fd
+    };
+
+    return send_command(hw_thread, &command);
+}
+
+bool hw_thread_write_outputs(
+    hw_thread_st * const hw_thread,
+    uint32_t const write_mask,
+    uint32_t const values,
+    hw_thread_complete_fn const complete_cb,
+    void * const complete_ctx)
+{
+    hw_command_st const command =
+    {
+        .type = hw_command_write_outputs,
+        .write_mask = write_mask,
+        .values = values,
+        .complete_cb = complete_cb,
+        .complete_ctx = complete_ctx
+    };
+
+    return send_command(hw_thread, &command);
+}
+
+bool hw_thread_write_register(
+    hw_thread_st * const hw_thread,
+    uint8_t const reg,
+    uint8_t const value)
+{
+    hw_command_st const command =
+    {
+        .type = hw_command_write_register,
+        .reg = reg,
+        .values = value
+    };
+
+    return send_command(hw_thread, &command);
+}
+
+void hw_thread_get_snapshot(
+    hw_thread_st * const hw_thread,
+    uint32_t * const inputs,
+    uint32_t * const outputs)
+{
+    *inputs = atomic_load(&hw_thread->input_snapshot);
+    *outputs = atomic_load(&hw_thread->output_snapshot);
+}
+
+void hw_thread_destroy(hw_thread_st * const hw_thread)
+{
+    if (hw_thread == NULL)
+    {
+        goto done;
+    }
+
+    if (hw_thread->thread_started)
+    {
+        hw_command_st const command =
+        {
+            .type = hw_command_quit
+        };
+
+        /* Keep trying if the ring is full. The thread will make room. */
+        while (!send_command(hw_thread, &command))
+        {
+            usleep(1000);
+        }
+        pthread_join(hw_thread->thread, NULL);
+    }
+
+    if (hw_thread->event_fd.registered)
+    {
+        uloop_fd_delete(&hw_thread->event_fd);
+    }
+    if (hw_thread->event_fd.fd >= 0)
+    {
+        close(hw_thread->event_fd.fd);
+    }
+    if (hw_thread->command_event_fd >= 0)
+    {
+        close(hw_thread->command_event_fd);
+    }
+    if (hw_thread->gpio_pin_fd >= 0)
+    {
+        close(hw_thread->gpio_pin_fd);
+    }
+    if (hw_thread->epoll_fd >= 0)
+    {
+        close(hw_thread->epoll_fd);
+    }
+    spsc_ring_free(hw_thread->commands);
+    spsc_ring_free(hw_thread->events);
+    free(hw_thread);
+
+done:
+    return;
+}
+
+hw_thread_st * hw_thread_create(
+    int const hw_addr,
+    hw_thread_input_change_fn const input_change_cb,
+    void * const input_change_ctx)
+{
+    hw_thread_st * hw_thread = calloc(1, sizeof *hw_thread);
+
+    if (hw_thread == NULL)
+    {
+        goto done;
+    }
+
+    hw_thread->hw_addr = hw_addr;
+    hw_thread->input_change_cb = input_change_cb;
+    hw_thread->input_change_ctx = input_change_ctx;
+    hw_thread->command_event_fd = -1;
+    hw_thread->event_fd.fd = -1;
+    hw_thread->epoll_fd = -1;
+    hw_thread->gpio_pin_fd = -1;
+    atomic_init(&hw_thread->input_change_overflow, false);
+
+    hw_thread->commands =
+        spsc_ring_create(HW_THREAD_RING_CAPACITY, sizeof(hw_command_st));
+    hw_thread->events =
+        spsc_ring_create(HW_THREAD_RING_CAPACITY, sizeof(hw_event_st));
+    if (hw_thread->commands == NULL || hw_thread->events == NULL)
+    {
+        goto error;
+    }
+
+    hw_thread->command_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    hw_thread->event_fd.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    hw_thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (hw_thread->command_event_fd < 0
+        || hw_thread->event_fd.fd < 0
+        || hw_thread->epoll_fd < 0)
+    {
+        goto error;
+    }
+
+    struct epoll_event epoll_event =
+    {
+        .events = EPOLLIN,
+        .data.fd = hw_thread->command_event_fd
+    };
+
+    if (epoll_ctl(hw_thread->epoll_fd,
+                  EPOLL_CTL_ADD,
+                  hw_thread->command_event_fd,
+                  &epoll_event) != 0)
+    {
+        goto error;
+    }
+
+    /* Nothing else is touching the registers yet, so the initial
+     * states can be read from here.
+     */
+    hw_thread->output_register = piface_hw_read_reg(OUTPUT, hw_addr);
+    hw_thread->interrupt_enables = piface_hw_read_reg(GPINTENB, hw_addr);
+    atomic_init(&hw_thread->output_snapshot, hw_thread->output_register);
+    atomic_init(&hw_thread->input_snapshot, piface_hw_read_reg(INPUT, hw_addr));
+
+    hw_thread->event_fd.cb = handle_hw_events;
+    uloop_fd_add(&hw_thread->event_fd, ULOOP_READ);
+
+    if (pthread_create(&hw_thread->thread, NULL, hw_thread_main, hw_thread) != 0)
+    {
+        goto error;
+    }
+    hw_thread->thread_started = true;
+
+    goto done;
+
+error:
+    hw_thread_destroy(hw_thread);
+    hw_thread = NULL;
+
+done:
+    return hw_thread;
+}
@@ -0,0 +1,66 @@
+#ifndef __HW_THREAD_H__
+#define __HW_THREAD_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A thread that owns all access to the PiFace registers and the
+ * interrupt pin. The uloop thread passes commands to it, and it passes
+ * completions and input changes back, through lock-free rings.
+ * All callbacks are called from the uloop thread.
+ * Register values are the raw values; no inversion of the inputs is
+ * done here.
+ */
+typedef struct hw_thread_st hw_thread_st;
+
+/* Called once a command has been carried out, with the register states 
+ * straight after it. 
+ */
+typedef void (*hw_thread_complete_fn)(
+    void * const callback_ctx,
+    uint32_t const inputs,
+    uint32_t const outputs);
+
+typedef void (*hw_thread_input_change_fn)(
+    void * const callback_ctx,
+    uint32_t const inputs);
+
+hw_thread_st * hw_thread_create(
+    int const hw_addr,
+    hw_thread_input_change_fn const input_change_cb,
+    void * const input_change_ctx);
+
+void hw_thread_destroy(hw_thread_st * const hw_thread);
+
+/* Have the thread service the interrupt pin. The thread takes ownership
+ * of the file descriptor.
+ */
+bool hw_thread_watch_interrupt(
+    hw_thread_st * const hw_thread,
+    int const gpio_pin_fd);
+
+/* complete_cb may be NULL. It isn't called if the completion can't be 
+ * passed back, so a later completion's states should be relied on 
+ * instead. 
+ */
+bool hw_thread_write_outputs(
+    hw_thread_st * const hw_thread,
+    uint32_t const write_mask,
+    uint32_t const values,
+    hw_thread_complete_fn const complete_cb,
+    void * const complete_ctx);
+
+bool hw_thread_write_register(
+    hw_thread_st * const hw_thread,
+    uint8_t const reg,
+    uint8_t const value);
+
+/* Get the register states as last seen by the thread without waiting
+ * for the hardware.
+ */
+void hw_thread_get_snapshot(
+    hw_thread_st * const hw_thread,
+    uint32_t * const inputs,
+    uint32_t * const outputs);
+
+#endif /* __HW_THREAD_H__ */
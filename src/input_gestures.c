@@ -0,0 +1,477 @@
+#include "input_gestures.h"
+#include "loop_profile.h"
+#include "debug.h"
+
+#include <libubox/blobmsg.h>
+#include <libubox/uloop.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BIT(x) (1UL << (x))
+#define INPUT_GESTURES_MAX_INPUTS 32
+#define GESTURE_DEFAULT_SETTLE_MSECS 20
+
+typedef enum gesture_state_t
+{
+    gesture_state_idle,
+    /* Pressed, and may become a long press. */
+    gesture_state_pressed,
+    /* Still held after a long press. */
+    gesture_state_held,
+    /* Released, waiting to see if there is a second click. */
+    gesture_state_released,
+    /* Pressed for the second time. */
+    gesture_state_second_press
+} gesture_state_t;
+
+typedef struct gesture_input_st
+{
+    struct uloop_timeout timer;
+    /* Runs while the input is bouncing. */
+    struct uloop_timeout settle_timer;
+    input_gestures_st * gestures;
+    size_t instance;
+    bool enabled;
+    uint32_t settle_msecs;
+    uint32_t long_press_msecs;
+    uint32_t double_click_msecs;
+    uint32_t repeat_msecs;
+    /* The last level that stayed put for settle_msecs. */
+    bool settled_pressed;
+    /* The level the input has bounced to. */
+    bool pending_pressed;
+    gesture_state_t state;
+    uint32_t repeat_count;
+} gesture_input_st;
+
+struct input_gestures_st
+{
+    struct ubus_object ubus_object;
+    struct ubus_context * ubus_ctx;
+    size_t num_inputs;
+    gesture_input_st inputs[INPUT_GESTURES_MAX_INPUTS];
+};
+
+static char const input_gestures_ubus_name[] = "piface.gestures";
+static char const gesture_notification_name[] = "gesture";
+
+enum
+{
+    GESTURES_CONFIG_INPUTS,
+    __GESTURES_CONFIG_MAX
+};
+
+static struct blobmsg_policy const gestures_config_policy[__GESTURES_CONFIG_MAX] =
+{
+    [GESTURES_CONFIG_INPUTS] = { .name = "inputs", .type = BLOBMSG_TYPE_ARRAY }
+};
+
+enum
+{
+    GESTURE_CONFIG_INSTANCE,
+    GESTURE_CONFIG_SETTLE,
+    GESTURE_CONFIG_LONG_PRESS,
+    GESTURE_CONFIG_DOUBLE_CLICK,
+    GESTURE_CONFIG_REPEAT,
+    __GESTURE_CONFIG_MAX
+};
+
+static struct blobmsg_policy const gesture_config_policy[__GESTURE_CONFIG_MAX] =
+{
+    [GESTURE_CONFIG_INSTANCE] = { .name = "instance", .type = BLOBMSG_TYPE_INT32 },
+    [GESTURE_CONFIG_SETTLE] = { .name = "settle_ms", .type = BLOBMSG_TYPE_INT32 },
+    [GESTURE_CONFIG_LONG_PRESS] = { .name = "long_press_ms", .type = BLOBMSG_TYPE_INT32 },
+    [GESTURE_CONFIG_DOUBLE_CLICK] = { .name = "double_click_ms", .type = BLOBMSG_TYPE_INT32 },
+    [GESTURE_CONFIG_REPEAT] = { .name = "repeat_ms", .type = BLOBMSG_TYPE_INT32 }
+};
+
+static void
+send_gesture(
+    gesture_input_st const * const input,
+    char const * const gesture)
+{
+    input_gestures_st * const gestures = input->gestures;
+    struct blob_buf buf;
+
+    DPRINTF("Input %zu gesture: %s\n", input->instance, gesture);
+
+    if (!gestures->ubus_object.has_subscribers)
+    {
+        goto done;
+    }
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    blobmsg_add_u32(&buf, "instance", input->instance);
+    blobmsg_add_string(&buf, "gesture", gesture);
+    if (input->state == gesture_state_held && input->repeat_count > 0)
+    {
+        blobmsg_add_u32(&buf, "count", input->repeat_count);
+    }
+
+    ubus_notify(gestures->ubus_ctx, &gestures->ubus_object, gesture_notification_name, buf.head, -1);
+    blob_buf_free(&buf);
+
+done:
+    return;
+}
+
+static void
+gesture_timer_handler(struct uloop_timeout * const timeout)
+{
+    gesture_input_st * const input = container_of(timeout, gesture_input_st, timer);
+    uint64_t const profile_start = loop_profile_begin();
+
+    switch (input->state)
+    {
+        case gesture_state_pressed:
+            input->state = gesture_state_held;
+            send_gesture(input, "long_press");
+            if (input->repeat_msecs > 0)
+            {
+                uloop_timeout_set(&input->timer, input->repeat_msecs);
+            }
+            break;
+        case gesture_state_held:
+            input->repeat_count++;
+            send_gesture(input, "repeat");
+            uloop_timeout_set(&input->timer, input->repeat_msecs);
+            break;
+        case gesture_state_released:
+            input->state = gesture_state_idle;
+            send_gesture(input, "click");
+            break;
+        default:
+            break;
+    }
+    loop_profile_end(loop_profile_handler_gesture_timer, profile_start);
+}
+
+static void
+input_pressed(gesture_input_st * const input)
+{
+    switch (input->state)
+    {
+        case gesture_state_idle:
+            input->state = gesture_state_pressed;
+            input->repeat_count = 0;
+            if (input->long_press_msecs > 0)
+            {
+                uloop_timeout_set(&input->timer, input->long_press_msecs);
+            }
+            break;
+        case gesture_state_released:
+            uloop_timeout_cancel(&input->timer);
+            input->state = gesture_state_second_press;
+            break;
+        default:
+            /* An edge was missed. Carry on as if it hadn't been. */
+            break;
+    }
+}
+
+static void
+input_released(gesture_input_st * const input)
+{
+    switch (input->state)
+    {
+        case gesture_state_pressed:
+            uloop_timeout_cancel(&input->timer);
+            if (input->double_click_msecs > 0)
+            {
+                input->state = gesture_state_released;
+                uloop_timeout_set(&input->timer, input->double_click_msecs);
+            }
+            else
+            {
+                input->state = gesture_state_idle;
+                send_gesture(input, "click");
+            }
+            break;
+        case gesture_state_held:
+            uloop_timeout_cancel(&input->timer);
+            input->state = gesture_state_idle;
+            send_gesture(input, "long_release");
+            break;
+        case gesture_state_second_press:
+            input->state = gesture_state_idle;
+            send_gesture(input, "double_click");
+            break;
+        default:
+            break;
+    }
+}
+
+static void
+input_settled(gesture_input_st * const input, bool const pressed)
+{
+    if (pressed == input->settled_pressed)
+    {
+        /* Bounced back to where it was. */
+        goto done;
+    }
+
+    input->settled_pressed = pressed;
+    if (pressed)
+    {
+        input_pressed(input);
+    }
+    else
+    {
+        input_released(input);
+    }
+
+done:
+    return;
+}
+
+static void
+settle_timer_handler(struct uloop_timeout * const timeout)
+{
+    gesture_input_st * const input = container_of(timeout, gesture_input_st, settle_timer);
+    uint64_t const profile_start = loop_profile_begin();
+
+    input_settled(input, input->pending_pressed);
+    loop_profile_end(loop_profile_handler_gesture_timer, profile_start);
+}
+
+void input_gestures_inputs_changed(
+    input_gestures_st * const gestures,
+    uint32_t const changed_mask,
+    uint32_t const states)
+{
+    if (gestures == NULL)
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < gestures->num_inputs; i++)
+    {
+        gesture_input_st * const input = &gestures->inputs[i];
+
+        if (!input->enabled || (changed_mask & BIT(i)) == 0)
+        {
+            continue;
+        }
+
+        bool const pressed = (states & BIT(i)) != 0;
+
+        if (input->settle_msecs == 0)
+        {
+            input_settled(input, pressed);
+        }
+        else
+        {
+            /* Only accept the level once it has stopped changing. */
+            input->pending_pressed = pressed;
+            uloop_timeout_set(&input->settle_timer, input->settle_msecs);
+        }
+    }
+
+done:
+    return;
+}
+
+static int
+gestures_get_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    input_gestures_st * const gestures = container_of(obj, input_gestures_st, ubus_object);
+    struct blob_buf buf;
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    void * const array_cookie =
+        blobmsg_open_array(&buf, gestures_config_policy[GESTURES_CONFIG_INPUTS].name);
+
+    for (size_t i = 0; i < gestures->num_inputs; i++)
+    {
+        gesture_input_st const * const input = &gestures->inputs[i];
+
+        if (!input->enabled)
+        {
+            continue;
+        }
+
+        void * const table_cookie = blobmsg_open_table(&buf, NULL);
+
+        blobmsg_add_u32(&buf, gesture_config_policy[GESTURE_CONFIG_INSTANCE].name, i);
+        blobmsg_add_u32(&buf, gesture_config_policy[GESTURE_CONFIG_SETTLE].name,
+                        input->settle_msecs);
+        blobmsg_add_u32(&buf, gesture_config_policy[GESTURE_CONFIG_LONG_PRESS].name,
+                        input->long_press_msecs);
+        blobmsg_add_u32(&buf, gesture_config_policy[GESTURE_CONFIG_DOUBLE_CLICK].name,
+                        input->double_click_msecs);
+        blobmsg_add_u32(&buf, gesture_config_policy[GESTURE_CONFIG_REPEAT].name,
+                        input->repeat_msecs);
+        blobmsg_close_table(&buf, table_cookie);
+    }
+    blobmsg_close_array(&buf, array_cookie);
+
+    ubus_send_reply(ubus_ctx, req, buf.head);
+    blob_buf_free(&buf);
+
+    return UBUS_STATUS_OK;
+}
+
+static struct ubus_method const input_gestures_methods[] =
+{
+    UBUS_METHOD_NOARG("get", gestures_get_handler)
+};
+
+static struct ubus_object_type input_gestures_object_type =
+    UBUS_OBJECT_TYPE(input_gestures_ubus_name, input_gestures_methods);
+
+static bool
+parse_gesture_configs(
+    input_gestures_st * const gestures,
+    struct blob_attr * const config_section)
+{
+    struct blob_attr * tb[__GESTURES_CONFIG_MAX];
+    struct blob_attr * cur;
+    int rem;
+    bool parsed;
+
+    blobmsg_parse(gestures_config_policy, __GESTURES_CONFIG_MAX, tb,
+                  blobmsg_data(config_section), blobmsg_data_len(config_section));
+
+    if (tb[GESTURES_CONFIG_INPUTS] == NULL)
+    {
+        parsed = false;
+        goto done;
+    }
+
+    blobmsg_for_each_attr(cur, tb[GESTURES_CONFIG_INPUTS], rem)
+    {
+        struct blob_attr * input_tb[__GESTURE_CONFIG_MAX];
+
+        if (blobmsg_type(cur) != BLOBMSG_TYPE_TABLE)
+        {
+            parsed = false;
+            goto done;
+        }
+
+        blobmsg_parse(gesture_config_policy, __GESTURE_CONFIG_MAX, input_tb,
+                      blobmsg_data(cur), blobmsg_data_len(cur));
+
+        if (input_tb[GESTURE_CONFIG_INSTANCE] == NULL)
+        {
+            parsed = false;
+            goto done;
+        }
+
+        uint32_t const instance = blobmsg_get_u32(input_tb[GESTURE_CONFIG_INSTANCE]);
+
+        if (instance >= gestures->num_inputs)
+        {
+            parsed = false;
+            goto done;
+        }
+
+        gesture_input_st * const input = &gestures->inputs[instance];
+
+        input->enabled = true;
+        if (input_tb[GESTURE_CONFIG_SETTLE] != NULL)
+        {
+            input->settle_msecs = blobmsg_get_u32(input_tb[GESTURE_CONFIG_SETTLE]);
+        }
+        if (input_tb[GESTURE_CONFIG_LONG_PRESS] != NULL)
+        {
+            input->long_press_msecs = blobmsg_get_u32(input_tb[GESTURE_CONFIG_LONG_PRESS]);
+        }
+        if (input_tb[GESTURE_CONFIG_DOUBLE_CLICK] != NULL)
+        {
+            input->double_click_msecs = blobmsg_get_u32(input_tb[GESTURE_CONFIG_DOUBLE_CLICK]);
+        }
+        if (input_tb[GESTURE_CONFIG_REPEAT] != NULL)
+        {
+            input->repeat_msecs = blobmsg_get_u32(input_tb[GESTURE_CONFIG_REPEAT]);
+        }
+    }
+
+    parsed = true;
+
+done:
+    return parsed;
+}
+
+input_gestures_st * input_gestures_create(
+    struct ubus_context * const ubus_ctx,
+    struct blob_attr * const config_section,
+    size_t const num_inputs,
+    uint32_t const states)
+{
+    input_gestures_st * gestures = calloc(1, sizeof *gestures);
+
+    if (gestures == NULL)
+    {
+        goto done;
+    }
+
+    gestures->ubus_ctx = ubus_ctx;
+    gestures->num_inputs =
+        num_inputs < INPUT_GESTURES_MAX_INPUTS ? num_inputs : INPUT_GESTURES_MAX_INPUTS;
+    for (size_t i = 0; i < gestures->num_inputs; i++)
+    {
+        gesture_input_st * const input = &gestures->inputs[i];
+
+        input->gestures = gestures;
+        input->instance = i;
+        input->timer.cb = gesture_timer_handler;
+        input->settle_timer.cb = settle_timer_handler;
+        input->settle_msecs = GESTURE_DEFAULT_SETTLE_MSECS;
+        input->settled_pressed = (states & BIT(i)) != 0;
+        input->pending_pressed = input->settled_pressed;
+    }
+
+    if (!parse_gesture_configs(gestures, config_section))
+    {
+        EPRINTF("Invalid gestures configuration\n");
+        free(gestures);
+        gestures = NULL;
+        goto done;
+    }
+
+    gestures->ubus_object.name = input_gestures_ubus_name;
+    gestures->ubus_object.type = &input_gestures_object_type;
+    gestures->ubus_object.methods = input_gestures_methods;
+    gestures->ubus_object.n_methods = ARRAY_SIZE(input_gestures_methods);
+
+    if (ubus_add_object(ubus_ctx, &gestures->ubus_object) != 0)
+    {
+        EPRINTF("Failed to add ubus object: %s\n", input_gestures_ubus_name);
+        free(gestures);
+        gestures = NULL;
+        goto done;
+    }
+
+done:
+    return gestures;
+}
+
+void input_gestures_done(input_gestures_st * const gestures)
+{
+    if (gestures == NULL)
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < gestures->num_inputs; i++)
+    {
+        uloop_timeout_cancel(&gestures->inputs[i].timer);
+        uloop_timeout_cancel(&gestures->inputs[i].settle_timer);
+    }
+    ubus_remove_object(gestures->ubus_ctx, &gestures->ubus_object);
+    free(gestures);
+
+done:
+    return;
+}
@@ -0,0 +1,53 @@
+#ifndef __INPUT_GESTURES_H__
+#define __INPUT_GESTURES_H__
+
+#include <libubus.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Turns the presses of buttons on the inputs into gestures, so that
+ * subscribers to piface.gestures get a single "gesture" notification of
+ * the form {"instance":0,"gesture":"double_click"} rather than each edge.
+ * The gestures are:
+ *   click         pressed and released, and not pressed again in time
+ *                 to make a double click
+ *   double_click  a second click within double_click_ms of the first
+ *   long_press    held for long_press_ms
+ *   repeat        every repeat_ms while still held after a long_press,
+ *                 with a "count" of the repeats so far
+ *   long_release  released after a long_press
+ * Configured by a section of the form:
+ *   {"inputs":[{"instance":0,"settle_ms":20,"long_press_ms":800,
+ *               "double_click_ms":300,"repeat_ms":200}]}
+ * Only the listed inputs are watched. A time of 0 disables that gesture,
+ * and with no double click a click is sent as soon as it is released.
+ * An edge is only accepted once the input has stayed put for settle_ms
+ * (default 20), so that contact bounce isn't taken for a double click.
+ * Gestures are driven by input changes, so need the daemon to be
+ * listening for them (-n); the daemon won't start with gestures
+ * configured otherwise.
+ */
+typedef struct input_gestures_st input_gestures_st;
+
+/* Returns NULL if the configuration is invalid. states are the current 
+ * input states, active when set, so that an input that is already held 
+ * isn't taken to be pressed or released by its first change. 
+ */
+input_gestures_st * input_gestures_create(
+    struct ubus_context * const ubus_ctx,
+    struct blob_attr * const config_section,
+    size_t const num_inputs,
+    uint32_t const states);
+
+void input_gestures_done(input_gestures_st * const gestures);
+
+/* Feed the input changes through the state machines. States are active
+ * (pressed) when set. Safe to call with NULL gestures.
+ */
+void input_gestures_inputs_changed(
+    input_gestures_st * const gestures,
+    uint32_t const changed_mask,
+    uint32_t const states);
+
+#endif /* __INPUT_GESTURES_H__ */
@@ -0,0 +1,309 @@
+#include "input_wait.h"
+#include "loop_profile.h"
+#include "debug.h"
+
+#include <libubox/blobmsg.h>
+#include <libubox/list.h>
+#include <libubox/uloop.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#define BIT(x) (1UL << (x))
+#define INPUT_WAIT_MAX_INPUTS 32
+#define INPUT_WAIT_MAX_WAITERS 64
+
+typedef struct input_waiter_st
+{
+    /* One entry on the list of each input in the mask. */
+    struct list_head entries[INPUT_WAIT_MAX_INPUTS];
+    struct uloop_timeout timeout;
+    struct ubus_request_data req;
+    input_wait_ctx_st * ctx;
+    uint32_t mask;
+    uint32_t value;
+} input_waiter_st;
+
+struct input_wait_ctx_st
+{
+    struct ubus_object ubus_object;
+    struct ubus_context * ubus_ctx;
+    input_wait_read_fn read_cb;
+    void * callback_ctx;
+    /* Waits can only be completed early when input changes are seen. */
+    bool inputs_notified;
+    uint32_t valid_mask;
+    size_t num_waiters;
+    /* The waiters that depend on each input. */
+    struct list_head waiters[INPUT_WAIT_MAX_INPUTS];
+};
+
+static char const input_wait_ubus_name[] = "piface.inputs";
+
+enum
+{
+    WAIT_MASK,
+    WAIT_VALUE,
+    WAIT_TIMEOUT,
+    __WAIT_MAX
+};
+
+static struct blobmsg_policy const wait_policy[__WAIT_MAX] =
+{
+    [WAIT_MASK] = { .name = "mask", .type = BLOBMSG_TYPE_INT32 },
+    [WAIT_VALUE] = { .name = "value", .type = BLOBMSG_TYPE_INT32 },
+    [WAIT_TIMEOUT] = { .name = "timeout", .type = BLOBMSG_TYPE_INT32 }
+};
+
+static void
+send_wait_reply(
+    struct ubus_context * const ubus_ctx,
+    struct ubus_request_data * const req,
+    bool const met,
+    uint32_t const states)
+{
+    struct blob_buf buf;
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    blobmsg_add_bool(&buf, "success", met);
+    blobmsg_add_u32(&buf, "states", states);
+
+    ubus_send_reply(ubus_ctx, req, buf.head);
+    blob_buf_free(&buf);
+}
+
+static void
+complete_waiter(
+    input_waiter_st * const waiter,
+    bool const met,
+    uint32_t const states)
+{
+    input_wait_ctx_st * const ctx = waiter->ctx;
+
+    send_wait_reply(ctx->ubus_ctx, &waiter->req, met, states);
+    ubus_complete_deferred_request(ctx->ubus_ctx, &waiter->req, UBUS_STATUS_OK);
+
+    for (size_t i = 0; i < INPUT_WAIT_MAX_INPUTS; i++)
+    {
+        if ((waiter->mask & BIT(i)) != 0)
+        {
+            list_del(&waiter->entries[i]);
+        }
+    }
+    uloop_timeout_cancel(&waiter->timeout);
+    ctx->num_waiters--;
+    free(waiter);
+}
+
+static void
+waiter_timeout_handler(struct uloop_timeout * const timeout)
+{
+    uint64_t const profile_start = loop_profile_begin();
+    input_waiter_st * const waiter = container_of(timeout, input_waiter_st, timeout);
+    input_wait_ctx_st * const ctx = waiter->ctx;
+    uint32_t const states = ctx->read_cb(ctx->callback_ctx) & ctx->valid_mask;
+
+    complete_waiter(waiter, (states & waiter->mask) == waiter->value, states);
+    loop_profile_end(loop_profile_handler_wait_timeout, profile_start);
+}
+
+static int
+wait_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    input_wait_ctx_st * const ctx = container_of(obj, input_wait_ctx_st, ubus_object);
+    struct blob_attr * tb[__WAIT_MAX];
+    int result;
+
+    blobmsg_parse(wait_policy, __WAIT_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (tb[WAIT_MASK] == NULL || tb[WAIT_VALUE] == NULL || tb[WAIT_TIMEOUT] == NULL)
+    {
+        result = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    uint32_t const mask = blobmsg_get_u32(tb[WAIT_MASK]);
+    uint32_t const value = blobmsg_get_u32(tb[WAIT_VALUE]) & mask;
+    uint32_t const timeout_msecs = blobmsg_get_u32(tb[WAIT_TIMEOUT]);
+
+    /* uloop takes the timeout as an int. */
+    if ((mask & ~ctx->valid_mask) != 0 || timeout_msecs > INT_MAX)
+    {
+        result = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    uint32_t const states = ctx->read_cb(ctx->callback_ctx) & ctx->valid_mask;
+
+    /* No need to wait if the condition already holds, or if the caller
+     * only wanted to check it.
+     */
+    if ((states & mask) == value || timeout_msecs == 0)
+    {
+        send_wait_reply(ubus_ctx, req, (states & mask) == value, states);
+        result = UBUS_STATUS_OK;
+        goto done;
+    }
+
+    /* Otherwise the wait would only ever end at the timeout. */
+    if (!ctx->inputs_notified)
+    {
+        result = UBUS_STATUS_NOT_SUPPORTED;
+        goto done;
+    }
+
+    if (ctx->num_waiters == INPUT_WAIT_MAX_WAITERS)
+    {
+        WPRINTF("Too many input waiters\n");
+        result = UBUS_STATUS_UNKNOWN_ERROR;
+        goto done;
+    }
+
+    input_waiter_st * const waiter = calloc(1, sizeof *waiter);
+
+    if (waiter == NULL)
+    {
+        result = UBUS_STATUS_UNKNOWN_ERROR;
+        goto done;
+    }
+
+    waiter->ctx = ctx;
+    waiter->mask = mask;
+    waiter->value = value;
+    for (size_t i = 0; i < INPUT_WAIT_MAX_INPUTS; i++)
+    {
+        if ((mask & BIT(i)) != 0)
+        {
+            list_add_tail(&waiter->entries[i], &ctx->waiters[i]);
+        }
+    }
+    ctx->num_waiters++;
+
+    ubus_defer_request(ubus_ctx, req, &waiter->req);
+    waiter->timeout.cb = waiter_timeout_handler;
+    uloop_timeout_set(&waiter->timeout, timeout_msecs);
+
+    result = UBUS_STATUS_OK;
+
+done:
+    return result;
+}
+
+static struct ubus_method const input_wait_methods[] =
+{
+    UBUS_METHOD("wait", wait_handler, wait_policy)
+};
+
+static struct ubus_object_type input_wait_object_type =
+    UBUS_OBJECT_TYPE(input_wait_ubus_name, input_wait_methods);
+
+void input_wait_inputs_changed(
+    input_wait_ctx_st * const ctx,
+    uint32_t const changed_mask,
+    uint32_t const states)
+{
+    uint32_t const changed = changed_mask & ctx->valid_mask;
+
+    for (size_t i = 0; i < INPUT_WAIT_MAX_INPUTS; i++)
+    {
+        input_waiter_st * waiter;
+        input_waiter_st * tmp;
+
+        if ((changed & BIT(i)) == 0)
+        {
+            continue;
+        }
+
+        list_for_each_entry_safe(waiter, tmp, &ctx->waiters[i], entries[i])
+        {
+            /* Already checked on the list of a lower changed input. */
+            if ((waiter->mask & changed & (BIT(i) - 1)) != 0)
+            {
+                continue;
+            }
+            if ((states & waiter->mask) == waiter->value)
+            {
+                complete_waiter(waiter, true, states & ctx->valid_mask);
+            }
+        }
+    }
+}
+
+input_wait_ctx_st * input_wait_initialise(
+    struct ubus_context * const ubus_ctx,
+    size_t const num_inputs,
+    bool const inputs_notified,
+    input_wait_read_fn const read_cb,
+    void * const callback_ctx)
+{
+    input_wait_ctx_st * ctx = calloc(1, sizeof *ctx);
+
+    if (ctx == NULL)
+    {
+        goto done;
+    }
+
+    ctx->ubus_ctx = ubus_ctx;
+    ctx->inputs_notified = inputs_notified;
+    ctx->read_cb = read_cb;
+    ctx->callback_ctx = callback_ctx;
+    ctx->valid_mask =
+        num_inputs >= INPUT_WAIT_MAX_INPUTS ? UINT32_MAX : BIT(num_inputs) - 1;
+    for (size_t i = 0; i < INPUT_WAIT_MAX_INPUTS; i++)
+    {
+        INIT_LIST_HEAD(&ctx->waiters[i]);
+    }
+
+    ctx->ubus_object.name = input_wait_ubus_name;
+    ctx->ubus_object.type = &input_wait_object_type;
+    ctx->ubus_object.methods = input_wait_methods;
+    ctx->ubus_object.n_methods = ARRAY_SIZE(input_wait_methods);
+
+    if (ubus_add_object(ubus_ctx, &ctx->ubus_object) != 0)
+    {
+        EPRINTF("Failed to add ubus object: %s\n", input_wait_ubus_name);
+        free(ctx);
+        ctx = NULL;
+        goto done;
+    }
+
+done:
+    return ctx;
+}
+
+void input_wait_done(input_wait_ctx_st * const ctx)
+{
+    if (ctx == NULL)
+    {
+        goto done;
+    }
+
+    uint32_t const states = ctx->read_cb(ctx->callback_ctx) & ctx->valid_mask;
+
+    /* A deferred wait always has at least one input in its mask. */
+    for (size_t i = 0; i < INPUT_WAIT_MAX_INPUTS; i++)
+    {
+        while (!list_empty(&ctx->waiters[i]))
+        {
+            input_waiter_st * const waiter =
+                list_first_entry(&ctx->waiters[i], input_waiter_st, entries[i]);
+
+            complete_waiter(waiter, (states & waiter->mask) == waiter->value, states);
+        }
+    }
+
+    ubus_remove_object(ctx->ubus_ctx, &ctx->ubus_object);
+    free(ctx);
+
+done:
+    return;
+}
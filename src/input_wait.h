@@ -0,0 +1,44 @@
+#ifndef __INPUT_WAIT_H__
+#define __INPUT_WAIT_H__
+
+#include <libubus.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Lets clients wait for a condition on the inputs rather than polling:
+ *   {"mask":10,"value":10,"timeout":5000}
+ * waits for up to 5 seconds for inputs 1 and 3 to both be active. The
+ * reply is deferred until the condition holds or the timeout (in ms)
+ * expires, and holds whether it was met and the input states at the time.
+ * Inputs use the same sense as the get method, i.e. active when closed.
+ * The timeout can be at most INT_MAX.
+ * A wait can only end early while the daemon is listening for input
+ * changes (-n). Otherwise only waits that can be answered at once are
+ * accepted, i.e. those whose condition already holds or with a timeout
+ * of 0, and the rest fail with UBUS_STATUS_NOT_SUPPORTED.
+ */
+typedef struct input_wait_ctx_st input_wait_ctx_st;
+
+typedef uint32_t (*input_wait_read_fn)(void * const callback_ctx);
+
+input_wait_ctx_st * input_wait_initialise(
+    struct ubus_context * const ubus_ctx,
+    size_t const num_inputs,
+    bool const inputs_notified,
+    input_wait_read_fn const read_cb,
+    void * const callback_ctx);
+
+/* Completes any outstanding waits against the current input states. */
+void input_wait_done(input_wait_ctx_st * const ctx);
+
+/* Completes the waits that the change satisfies. Only the waiters on the
+ * inputs in changed_mask are checked.
+ */
+void input_wait_inputs_changed(
+    input_wait_ctx_st * const ctx,
+    uint32_t const changed_mask,
+    uint32_t const states);
+
+#endif /* __INPUT_WAIT_H__ */
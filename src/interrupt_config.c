@@ -0,0 +1,303 @@
+#include "interrupt_config.h"
+#include "debug.h"
+
+#include <libubox/blobmsg.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BIT(x) (1UL << (x))
+
+typedef struct pin_config_st
+{
+    bool enabled;
+} pin_config_st;
+
+struct interrupt_config_ctx_st
+{
+    struct ubus_object ubus_object;
+    struct ubus_context * ubus_ctx;
+    config_st * config;
+    interrupt_config_apply_fn apply_cb;
+    void * apply_ctx;
+    pin_config_st pins[INTERRUPT_CONFIG_NUM_PINS];
+};
+
+static char const interrupt_config_ubus_name[] = "piface.interrupts";
+static char const interrupts_section_name[] = "interrupts";
+
+enum
+{
+    INTERRUPT_CONFIG_INPUTS,
+    __INTERRUPT_CONFIG_MAX
+};
+
+static struct blobmsg_policy const interrupt_config_policy[__INTERRUPT_CONFIG_MAX] =
+{
+    [INTERRUPT_CONFIG_INPUTS] = { .name = "inputs", .type = BLOBMSG_TYPE_ARRAY }
+};
+
+enum
+{
+    PIN_CONFIG_INSTANCE,
+    PIN_CONFIG_ENABLED,
+    __PIN_CONFIG_MAX
+};
+
+static struct blobmsg_policy const pin_config_policy[__PIN_CONFIG_MAX] =
+{
+    [PIN_CONFIG_INSTANCE] = { .name = "instance", .type = BLOBMSG_TYPE_INT32 },
+    [PIN_CONFIG_ENABLED] = { .name = "enabled", .type = BLOBMSG_TYPE_BOOL }
+};
+
+/* Parse a table of the form { "inputs": [ { "instance": n, ... } ] } into
+ * the supplied pin configuration. Pins that aren't mentioned are left
+ * alone. Nothing is modified unless the whole table is valid.
+ */
+static bool parse_pin_configs(
+    void * const data,
+    size_t const len,
+    pin_config_st * const pins)
+{
+    bool parsed;
+    struct blob_attr * tb[__INTERRUPT_CONFIG_MAX];
+    pin_config_st new_pins[INTERRUPT_CONFIG_NUM_PINS];
+    struct blob_attr * cur;
+    int rem;
+
+    blobmsg_parse(interrupt_config_policy, __INTERRUPT_CONFIG_MAX, tb, data, len);
+
+    if (tb[INTERRUPT_CONFIG_INPUTS] == NULL)
+    {
+        parsed = false;
+        goto done;
+    }
+
+    memcpy(new_pins, pins, sizeof new_pins);
+
+    blobmsg_for_each_attr(cur, tb[INTERRUPT_CONFIG_INPUTS], rem)
+    {
+        struct blob_attr * pin_tb[__PIN_CONFIG_MAX];
+
+        if (blobmsg_type(cur) != BLOBMSG_TYPE_TABLE)
+        {
+            parsed = false;
+            goto done;
+        }
+
+        blobmsg_parse(pin_config_policy, __PIN_CONFIG_MAX, pin_tb,
+                      blobmsg_data(cur), blobmsg_data_len(cur));
+
+        if (pin_tb[PIN_CONFIG_INSTANCE] == NULL)
+        {
+            parsed = false;
+            goto done;
+        }
+
+        uint32_t const instance = blobmsg_get_u32(pin_tb[PIN_CONFIG_INSTANCE]);
+
+        if (instance >= INTERRUPT_CONFIG_NUM_PINS)
+        {
+            parsed = false;
+            goto done;
+        }
+
+        pin_config_st * const pin = &new_pins[instance];
+
+        if (pin_tb[PIN_CONFIG_ENABLED] != NULL)
+        {
+            pin->enabled = blobmsg_get_bool(pin_tb[PIN_CONFIG_ENABLED]);
+        }
+    }
+
+    memcpy(pins, new_pins, sizeof new_pins);
+    parsed = true;
+
+done:
+    return parsed;
+}
+
+static void add_pin_configs(
+    struct blob_buf * const buf,
+    pin_config_st const * const pins)
+{
+    void * const array_cookie =
+        blobmsg_open_array(buf, interrupt_config_policy[INTERRUPT_CONFIG_INPUTS].name);
+
+    for (size_t i = 0; i < INTERRUPT_CONFIG_NUM_PINS; i++)
+    {
+        void * const table_cookie = blobmsg_open_table(buf, NULL);
+
+        blobmsg_add_u32(buf, pin_config_policy[PIN_CONFIG_INSTANCE].name, i);
+        blobmsg_add_bool(buf, pin_config_policy[PIN_CONFIG_ENABLED].name, pins[i].enabled);
+
+        blobmsg_close_table(buf, table_cookie);
+    }
+
+    blobmsg_close_array(buf, array_cookie);
+}
+
+static void interrupt_config_save(interrupt_config_ctx_st * const ctx)
+{
+    struct blob_buf buf;
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    void * const cookie = blobmsg_open_table(&buf, interrupts_section_name);
+
+    add_pin_configs(&buf, ctx->pins);
+    blobmsg_close_table(&buf, cookie);
+
+    if (!config_set_section(ctx->config, blob_data(buf.head)))
+    {
+        EPRINTF("Failed to save interrupt configuration\n");
+    }
+
+    blob_buf_free(&buf);
+}
+
+uint8_t interrupt_config_get_enabled_mask(
+    interrupt_config_ctx_st const * const ctx)
+{
+    uint8_t enabled_mask = 0;
+
+    for (size_t i = 0; i < INTERRUPT_CONFIG_NUM_PINS; i++)
+    {
+        if (ctx->pins[i].enabled)
+        {
+            enabled_mask |= BIT(i);
+        }
+    }
+
+    return enabled_mask;
+}
+
+static void interrupt_config_apply(interrupt_config_ctx_st * const ctx)
+{
+    ctx->apply_cb(ctx->apply_ctx, interrupt_config_get_enabled_mask(ctx));
+}
+
+static int interrupt_config_get_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    interrupt_config_ctx_st * const ctx =
+        container_of(obj, interrupt_config_ctx_st, ubus_object);
+    struct blob_buf buf;
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    add_pin_configs(&buf, ctx->pins);
+    ubus_send_reply(ubus_ctx, req, buf.head);
+
+    blob_buf_free(&buf);
+
+    return UBUS_STATUS_OK;
+}
+
+static int interrupt_config_set_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    interrupt_config_ctx_st * const ctx =
+        container_of(obj, interrupt_config_ctx_st, ubus_object);
+    int result;
+
+    if (!parse_pin_configs(blob_data(msg), blob_len(msg), ctx->pins))
+    {
+        result = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    interrupt_config_apply(ctx);
+    interrupt_config_save(ctx);
+
+    result = UBUS_STATUS_OK;
+
+done:
+    return result;
+}
+
+static struct ubus_method const interrupt_config_methods[] =
+{
+    UBUS_METHOD_NOARG("get", interrupt_config_get_handler),
+    UBUS_METHOD("set", interrupt_config_set_handler, interrupt_config_policy)
+};
+
+static struct ubus_object_type interrupt_config_object_type =
+    UBUS_OBJECT_TYPE(interrupt_config_ubus_name, interrupt_config_methods);
+
+interrupt_config_ctx_st * interrupt_config_initialise(
+    struct ubus_context * const ubus_ctx,
+    config_st * const config,
+    interrupt_config_apply_fn const apply_cb,
+    void * const apply_ctx)
+{
+    interrupt_config_ctx_st * ctx = calloc(1, sizeof *ctx);
+
+    if (ctx == NULL)
+    {
+        goto done;
+    }
+
+    ctx->ubus_ctx = ubus_ctx;
+    ctx->config = config;
+    ctx->apply_cb = apply_cb;
+    ctx->apply_ctx = apply_ctx;
+
+    /* Default to the previous behaviour of interrupting on any change
+     * of any input.
+     */
+    for (size_t i = 0; i < INTERRUPT_CONFIG_NUM_PINS; i++)
+    {
+        ctx->pins[i].enabled = true;
+    }
+
+    struct blob_attr * const section =
+        config_get_section(config, interrupts_section_name);
+
+    if (section != NULL
+        && !parse_pin_configs(blobmsg_data(section), blobmsg_data_len(section), ctx->pins))
+    {
+        WPRINTF("Invalid interrupt configuration. Using defaults\n");
+    }
+
+    ctx->ubus_object.name = interrupt_config_ubus_name;
+    ctx->ubus_object.type = &interrupt_config_object_type;
+    ctx->ubus_object.methods = interrupt_config_methods;
+    ctx->ubus_object.n_methods = ARRAY_SIZE(interrupt_config_methods);
+
+    if (ubus_add_object(ubus_ctx, &ctx->ubus_object) != 0)
+    {
+        EPRINTF("Failed to add ubus object: %s\n", interrupt_config_ubus_name);
+        free(ctx);
+        ctx = NULL;
+        goto done;
+    }
+
+done:
+    return ctx;
+}
+
+void interrupt_config_done(
+    interrupt_config_ctx_st * const ctx)
+{
+    if (ctx == NULL)
+    {
+        goto done;
+    }
+
+    ubus_remove_object(ctx->ubus_ctx, &ctx->ubus_object);
+    free(ctx);
+
+done:
+    return;
+}
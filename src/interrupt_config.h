@@ -0,0 +1,44 @@
+#ifndef __INTERRUPT_CONFIG_H__
+#define __INTERRUPT_CONFIG_H__
+
+#include "config.h"
+
+#include <libubus.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define INTERRUPT_CONFIG_NUM_PINS 8
+
+/* Which inputs raise a hardware interrupt, from the "interrupts" section
+ * of the config, or set at run time through piface.interrupts:
+ *   {"interrupts":{"inputs":[{"instance":0,"enabled":true}]}}
+ * Inputs with interrupts disabled are still read, but their changes are
+ * only seen when something else causes the inputs to be read.
+ * Inputs interrupt on any change. The MCP23S17's compare modes aren't
+ * offered: they hold INT asserted for as long as the input differs from
+ * DEFVAL, and reading the input doesn't clear it. The interrupt pin is
+ * watched for edges, so while one such input was held no other input's
+ * changes would be seen.
+ */
+
+/* Called with the value for GPINTENB, bit n enabling input n. */
+typedef void (*interrupt_config_apply_fn)(
+    void * const apply_ctx,
+    uint8_t const enabled_mask);
+
+typedef struct interrupt_config_ctx_st interrupt_config_ctx_st;
+
+interrupt_config_ctx_st * interrupt_config_initialise(
+    struct ubus_context * const ubus_ctx,
+    config_st * const config,
+    interrupt_config_apply_fn const apply_cb,
+    void * const apply_ctx);
+
+void interrupt_config_done(
+    interrupt_config_ctx_st * const ctx);
+
+uint8_t interrupt_config_get_enabled_mask(
+    interrupt_config_ctx_st const * const ctx);
+
+#endif /* __INTERRUPT_CONFIG_H__ */
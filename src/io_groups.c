@@ -0,0 +1,439 @@
+#include "io_groups.h"
+#include "debug.h"
+
+#include <libubox/blobmsg.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BIT(x) (1UL << (x))
+#define IO_GROUP_MAX_MEMBERS 32
+
+typedef struct io_group_st
+{
+    char * name;
+    uint32_t mask;
+    /* In the order given in the config. */
+    uint8_t members[IO_GROUP_MAX_MEMBERS];
+    size_t num_members;
+} io_group_st;
+
+struct io_groups_ctx_st
+{
+    struct ubus_object ubus_object;
+    struct ubus_context * ubus_ctx;
+    io_groups_write_fn write_cb;
+    io_groups_read_fn read_cb;
+    void * callback_ctx;
+    io_group_st * groups;
+    size_t num_groups;
+};
+
+static char const io_groups_ubus_name[] = "piface.groups";
+static char const groups_section_name[] = "groups";
+
+enum
+{
+    GROUP_GET_GROUP,
+    __GROUP_GET_MAX
+};
+
+static struct blobmsg_policy const group_get_policy[__GROUP_GET_MAX] =
+{
+    [GROUP_GET_GROUP] = { .name = "group", .type = BLOBMSG_TYPE_STRING }
+};
+
+enum
+{
+    GROUP_SET_GROUP,
+    GROUP_SET_STATE,
+    GROUP_SET_VALUES,
+    __GROUP_SET_MAX
+};
+
+static struct blobmsg_policy const group_set_policy[__GROUP_SET_MAX] =
+{
+    [GROUP_SET_GROUP] = { .name = "group", .type = BLOBMSG_TYPE_STRING },
+    /* Set every member to the same state... */
+    [GROUP_SET_STATE] = { .name = "state", .type = BLOBMSG_TYPE_BOOL },
+    /* ...or each member to its own, in member order. */
+    [GROUP_SET_VALUES] = { .name = "values", .type = BLOBMSG_TYPE_ARRAY }
+};
+
+static io_group_st const *
+find_group(
+    io_groups_ctx_st const * const ctx,
+    char const * const name)
+{
+    io_group_st const * group = NULL;
+
+    for (size_t i = 0; i < ctx->num_groups; i++)
+    {
+        if (strcmp(ctx->groups[i].name, name) == 0)
+        {
+            group = &ctx->groups[i];
+            break;
+        }
+    }
+
+    return group;
+}
+
+static void
+add_group_members(
+    struct blob_buf * const buf,
+    char const * const name,
+    io_group_st const * const group)
+{
+    void * const cookie = blobmsg_open_array(buf, name);
+
+    for (size_t i = 0; i < group->num_members; i++)
+    {
+        blobmsg_add_u32(buf, NULL, group->members[i]);
+    }
+    blobmsg_close_array(buf, cookie);
+}
+
+static int
+groups_list_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    io_groups_ctx_st * const ctx = container_of(obj, io_groups_ctx_st, ubus_object);
+    struct blob_buf buf;
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    void * const cookie = blobmsg_open_table(&buf, "groups");
+
+    for (size_t i = 0; i < ctx->num_groups; i++)
+    {
+        add_group_members(&buf, ctx->groups[i].name, &ctx->groups[i]);
+    }
+    blobmsg_close_table(&buf, cookie);
+
+    ubus_send_reply(ubus_ctx, req, buf.head);
+    blob_buf_free(&buf);
+
+    return UBUS_STATUS_OK;
+}
+
+static int
+groups_get_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    io_groups_ctx_st * const ctx = container_of(obj, io_groups_ctx_st, ubus_object);
+    struct blob_attr * tb[__GROUP_GET_MAX];
+    io_group_st const * group;
+    struct blob_buf buf;
+    int result;
+
+    blobmsg_parse(group_get_policy, __GROUP_GET_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (tb[GROUP_GET_GROUP] == NULL)
+    {
+        result = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    group = find_group(ctx, blobmsg_get_string(tb[GROUP_GET_GROUP]));
+    if (group == NULL)
+    {
+        result = UBUS_STATUS_NOT_FOUND;
+        goto done;
+    }
+
+    uint32_t const states = ctx->read_cb(ctx->callback_ctx) & group->mask;
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    blobmsg_add_string(&buf, "group", group->name);
+    add_group_members(&buf, "outputs", group);
+
+    void * const cookie = blobmsg_open_array(&buf, "states");
+
+    for (size_t i = 0; i < group->num_members; i++)
+    {
+        blobmsg_add_bool(&buf, NULL, (states & BIT(group->members[i])) != 0);
+    }
+    blobmsg_close_array(&buf, cookie);
+
+    blobmsg_add_bool(&buf, "all", states == group->mask);
+    blobmsg_add_bool(&buf, "any", states != 0);
+
+    ubus_send_reply(ubus_ctx, req, buf.head);
+    blob_buf_free(&buf);
+
+    result = UBUS_STATUS_OK;
+
+done:
+    return result;
+}
+
+static bool
+parse_member_values(
+    io_group_st const * const group,
+    struct blob_attr * const values_attr,
+    uint32_t * const values)
+{
+    struct blob_attr * cur;
+    int rem;
+    size_t index = 0;
+    bool parsed;
+
+    if (blobmsg_check_array(values_attr, BLOBMSG_TYPE_BOOL) != (int)group->num_members)
+    {
+        parsed = false;
+        goto done;
+    }
+
+    *values = 0;
+    blobmsg_for_each_attr(cur, values_attr, rem)
+    {
+        if (blobmsg_get_bool(cur))
+        {
+            *values |= BIT(group->members[index]);
+        }
+        index++;
+    }
+
+    parsed = true;
+
+done:
+    return parsed;
+}
+
+static int
+groups_set_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    io_groups_ctx_st * const ctx = container_of(obj, io_groups_ctx_st, ubus_object);
+    struct blob_attr * tb[__GROUP_SET_MAX];
+    io_group_st const * group;
+    uint32_t values;
+    int result;
+
+    blobmsg_parse(group_set_policy, __GROUP_SET_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (tb[GROUP_SET_GROUP] == NULL
+        || (tb[GROUP_SET_STATE] == NULL) == (tb[GROUP_SET_VALUES] == NULL))
+    {
+        result = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    group = find_group(ctx, blobmsg_get_string(tb[GROUP_SET_GROUP]));
+    if (group == NULL)
+    {
+        result = UBUS_STATUS_NOT_FOUND;
+        goto done;
+    }
+
+    if (tb[GROUP_SET_STATE] != NULL)
+    {
+        values = blobmsg_get_bool(tb[GROUP_SET_STATE]) ? group->mask : 0;
+    }
+    else if (!parse_member_values(group, tb[GROUP_SET_VALUES], &values))
+    {
+        result = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    /* The whole group changes in the one write. */
+    if (!ctx->write_cb(ctx->callback_ctx, group->mask, values))
+    {
+        result = UBUS_STATUS_UNKNOWN_ERROR;
+        goto done;
+    }
+
+    result = UBUS_STATUS_OK;
+
+done:
+    return result;
+}
+
+static struct ubus_method const io_groups_methods[] =
+{
+    UBUS_METHOD_NOARG("list", groups_list_handler),
+    UBUS_METHOD("get", groups_get_handler, group_get_policy),
+    UBUS_METHOD("set", groups_set_handler, group_set_policy)
+};
+
+static struct ubus_object_type io_groups_object_type =
+    UBUS_OBJECT_TYPE(io_groups_ubus_name, io_groups_methods);
+
+static bool
+parse_group(
+    struct blob_attr * const group_attr,
+    size_t const num_outputs,
+    io_group_st * const group)
+{
+    struct blob_attr * cur;
+    int rem;
+    bool parsed;
+
+    if (blobmsg_type(group_attr) != BLOBMSG_TYPE_ARRAY
+        || blobmsg_check_array(group_attr, BLOBMSG_TYPE_INT32) <= 0)
+    {
+        parsed = false;
+        goto done;
+    }
+
+    blobmsg_for_each_attr(cur, group_attr, rem)
+    {
+        uint32_t const instance = blobmsg_get_u32(cur);
+
+        if (instance >= num_outputs
+            || (group->mask & BIT(instance)) != 0
+            || group->num_members == IO_GROUP_MAX_MEMBERS)
+        {
+            parsed = false;
+            goto done;
+        }
+        group->members[group->num_members++] = instance;
+        group->mask |= BIT(instance);
+    }
+
+    group->name = strdup(blobmsg_name(group_attr));
+    parsed = group->name != NULL;
+
+done:
+    return parsed;
+}
+
+static bool
+load_groups(
+    io_groups_ctx_st * const ctx,
+    config_st const * const config,
+    size_t const num_outputs)
+{
+    struct blob_attr * const section = config_get_section(config, groups_section_name);
+    struct blob_attr * cur;
+    int rem;
+    bool loaded;
+
+    if (section == NULL)
+    {
+        loaded = true;
+        goto done;
+    }
+
+    if (blobmsg_type(section) != BLOBMSG_TYPE_TABLE)
+    {
+        WPRINTF("Invalid groups configuration\n");
+        loaded = true;
+        goto done;
+    }
+
+    size_t num_groups = 0;
+
+    blobmsg_for_each_attr(cur, section, rem)
+    {
+        num_groups++;
+    }
+
+    ctx->groups = calloc(num_groups + 1, sizeof *ctx->groups);
+    if (ctx->groups == NULL)
+    {
+        loaded = false;
+        goto done;
+    }
+
+    blobmsg_for_each_attr(cur, section, rem)
+    {
+        io_group_st * const group = &ctx->groups[ctx->num_groups];
+
+        if (!parse_group(cur, num_outputs, group))
+        {
+            WPRINTF("Invalid output group: %s\n", blobmsg_name(cur));
+            memset(group, 0, sizeof *group);
+            continue;
+        }
+        ctx->num_groups++;
+    }
+
+    loaded = true;
+
+done:
+    return loaded;
+}
+
+io_groups_ctx_st * io_groups_initialise(
+    struct ubus_context * const ubus_ctx,
+    config_st const * const config,
+    size_t const num_outputs,
+    io_groups_write_fn const write_cb,
+    io_groups_read_fn const read_cb,
+    void * const callback_ctx)
+{
+    io_groups_ctx_st * ctx = calloc(1, sizeof *ctx);
+
+    if (ctx == NULL)
+    {
+        goto done;
+    }
+
+    ctx->ubus_ctx = ubus_ctx;
+    ctx->write_cb = write_cb;
+    ctx->read_cb = read_cb;
+    ctx->callback_ctx = callback_ctx;
+
+    if (!load_groups(ctx, config, num_outputs))
+    {
+        io_groups_done(ctx);
+        ctx = NULL;
+        goto done;
+    }
+
+    ctx->ubus_object.name = io_groups_ubus_name;
+    ctx->ubus_object.type = &io_groups_object_type;
+    ctx->ubus_object.methods = io_groups_methods;
+    ctx->ubus_object.n_methods = ARRAY_SIZE(io_groups_methods);
+
+    if (ubus_add_object(ubus_ctx, &ctx->ubus_object) != 0)
+    {
+        EPRINTF("Failed to add ubus object: %s\n", io_groups_ubus_name);
+        io_groups_done(ctx);
+        ctx = NULL;
+        goto done;
+    }
+
+done:
+    return ctx;
+}
+
+void io_groups_done(io_groups_ctx_st * const ctx)
+{
+    if (ctx == NULL)
+    {
+        goto done;
+    }
+
+    if (ctx->ubus_object.id != 0)
+    {
+        ubus_remove_object(ctx->ubus_ctx, &ctx->ubus_object);
+    }
+    for (size_t i = 0; i < ctx->num_groups; i++)
+    {
+        free(ctx->groups[i].name);
+    }
+    free(ctx->groups);
+    free(ctx);
+
+done:
+    return;
+}
@@ -0,0 +1,37 @@
+#ifndef __IO_GROUPS_H__
+#define __IO_GROUPS_H__
+
+#include "config.h"
+
+#include <libubus.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Named groups of outputs, from the "groups" section of the config:
+ *   {"groups":{"zone_a_lights":[0,1,2],"pump_bank":[4,5]}}
+ * Each group is resolved to an output mask when loaded, and is read or
+ * written as a whole with a single output write.
+ */
+typedef struct io_groups_ctx_st io_groups_ctx_st;
+
+/* Returns false if the write couldn't be made. */
+typedef bool (*io_groups_write_fn)(
+    void * const callback_ctx,
+    uint32_t const write_mask,
+    uint32_t const values);
+
+typedef uint32_t (*io_groups_read_fn)(void * const callback_ctx);
+
+io_groups_ctx_st * io_groups_initialise(
+    struct ubus_context * const ubus_ctx,
+    config_st const * const config,
+    size_t const num_outputs,
+    io_groups_write_fn const write_cb,
+    io_groups_read_fn const read_cb,
+    void * const callback_ctx);
+
+void io_groups_done(io_groups_ctx_st * const ctx);
+
+#endif /* __IO_GROUPS_H__ */
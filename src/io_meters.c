@@ -0,0 +1,423 @@
+#include "io_meters.h"
+#include "loop_profile.h"
+#include "debug.h"
+
+#include <libubox/blobmsg.h>
+#include <libubox/uloop.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+
+#define BIT(x) (1UL << (x))
+
+#define IO_METERS_FILE_MAGIC 0x4d464950 /* "PIFM" */
+#define IO_METERS_FILE_VERSION 1
+#define IO_METERS_MAX_IOS 32
+#define IO_METERS_DEFAULT_CHECKPOINT_SECS 300
+
+typedef struct io_meter_st
+{
+    uint64_t on_time_msecs;
+    uint64_t transitions;
+} io_meter_st;
+
+/* The layout of the checkpoint file. */
+typedef struct io_meters_layout_st
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_ios[__io_meters_type_max];
+    io_meter_st meters[__io_meters_type_max][IO_METERS_MAX_IOS];
+    uint32_t checksum;
+} io_meters_layout_st;
+
+struct io_meters_st
+{
+    struct ubus_object ubus_object;
+    struct ubus_context * ubus_ctx;
+    struct uloop_timeout checkpoint_timer;
+    char * path;
+    uint32_t checkpoint_interval_secs;
+
+    /* Whether the changes of each type are seen. Totals that aren't
+     * are left as loaded, and left out of replies.
+     */
+    bool metered[__io_meters_type_max];
+    uint32_t states[__io_meters_type_max];
+    /* When each IO that is on last turned on, or had its on-time added to
+     * the total.
+     */
+    uint64_t on_since_msecs[__io_meters_type_max][IO_METERS_MAX_IOS];
+    io_meters_layout_st totals;
+};
+
+static char const io_meters_ubus_name[] = "piface.meters";
+static char const meters_section_name[] = "meters";
+
+static char const * const type_names[] =
+{
+    [io_meters_inputs] = "inputs",
+    [io_meters_outputs] = "outputs"
+};
+
+enum
+{
+    METERS_CONFIG_FILE,
+    METERS_CONFIG_CHECKPOINT_INTERVAL,
+    __METERS_CONFIG_MAX
+};
+
+static struct blobmsg_policy const meters_config_policy[__METERS_CONFIG_MAX] =
+{
+    [METERS_CONFIG_FILE] = { .name = "file", .type = BLOBMSG_TYPE_STRING },
+    [METERS_CONFIG_CHECKPOINT_INTERVAL] = { .name = "checkpoint_interval", .type = BLOBMSG_TYPE_INT32 }
+};
+
+static uint64_t
+now_msecs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static uint32_t
+valid_mask(io_meters_st const * const meters, io_meters_type_t const type)
+{
+    uint32_t const num_ios = meters->totals.num_ios[type];
+
+    return num_ios >= IO_METERS_MAX_IOS ? UINT32_MAX : BIT(num_ios) - 1;
+}
+
+static uint32_t
+calculate_checksum(io_meters_layout_st const * const layout)
+{
+    /* FNV-1a over everything up to the checksum field. */
+    uint8_t const * const bytes = (uint8_t const *)layout;
+    uint32_t hash = 2166136261U;
+
+    for (size_t i = 0; i < offsetof(io_meters_layout_st, checksum); i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+/* Bring the totals of the IOs that are on up to now. */
+static void
+accumulate_on_time(io_meters_st * const meters, uint64_t const now)
+{
+    for (size_t type = 0; type < __io_meters_type_max; type++)
+    {
+        if (!meters->metered[type])
+        {
+            continue;
+        }
+        for (size_t i = 0; i < meters->totals.num_ios[type]; i++)
+        {
+            if ((meters->states[type] & BIT(i)) == 0)
+            {
+                continue;
+            }
+            meters->totals.meters[type][i].on_time_msecs +=
+                now - meters->on_since_msecs[type][i];
+            meters->on_since_msecs[type][i] = now;
+        }
+    }
+}
+
+static void
+load_checkpoint(io_meters_st * const meters)
+{
+    io_meters_layout_st layout;
+    int const fd = open(meters->path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        goto done;
+    }
+
+    if (read(fd, &layout, sizeof layout) != sizeof layout
+        || layout.magic != IO_METERS_FILE_MAGIC
+        || layout.version != IO_METERS_FILE_VERSION
+        || layout.checksum != calculate_checksum(&layout)
+        || memcmp(layout.num_ios, meters->totals.num_ios, sizeof layout.num_ios) != 0)
+    {
+        WPRINTF("No valid meters checkpoint in: %s\n", meters->path);
+        goto done;
+    }
+
+    memcpy(meters->totals.meters, layout.meters, sizeof layout.meters);
+
+done:
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+/* Written to a temporary file that then replaces the checkpoint, so
+ * there is always a whole checkpoint to load.
+ */
+static void
+write_checkpoint(io_meters_st * const meters)
+{
+    char temp_path[PATH_MAX];
+    int fd = -1;
+
+    if (meters->path == NULL)
+    {
+        goto done;
+    }
+
+    accumulate_on_time(meters, now_msecs());
+    meters->totals.checksum = calculate_checksum(&meters->totals);
+
+    snprintf(temp_path, sizeof temp_path, "%s.tmp", meters->path);
+    fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        EPRINTF("Failed to open meters checkpoint: %s\n", temp_path);
+        goto done;
+    }
+
+    if (write(fd, &meters->totals, sizeof meters->totals) != sizeof meters->totals
+        || fsync(fd) != 0
+        || rename(temp_path, meters->path) != 0)
+    {
+        EPRINTF("Failed to write meters checkpoint: %s\n", meters->path);
+        unlink(temp_path);
+    }
+
+done:
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+static void
+checkpoint_timer_handler(struct uloop_timeout * const timeout)
+{
+    io_meters_st * const meters = container_of(timeout, io_meters_st, checkpoint_timer);
+    uint64_t const profile_start = loop_profile_begin();
+
+    write_checkpoint(meters);
+    uloop_timeout_set(&meters->checkpoint_timer, meters->checkpoint_interval_secs * 1000);
+    loop_profile_end(loop_profile_handler_meters_checkpoint, profile_start);
+}
+
+void io_meters_update(
+    io_meters_st * const meters,
+    io_meters_type_t const type,
+    uint32_t const changed_mask,
+    uint32_t const states)
+{
+    uint32_t const changed = changed_mask & valid_mask(meters, type);
+    uint64_t const now = now_msecs();
+
+    if (!meters->metered[type])
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < meters->totals.num_ios[type]; i++)
+    {
+        if ((changed & BIT(i)) == 0)
+        {
+            continue;
+        }
+
+        io_meter_st * const meter = &meters->totals.meters[type][i];
+
+        meter->transitions++;
+        if ((states & BIT(i)) != 0)
+        {
+            meters->on_since_msecs[type][i] = now;
+        }
+        else
+        {
+            meter->on_time_msecs += now - meters->on_since_msecs[type][i];
+        }
+    }
+
+    meters->states[type] = (meters->states[type] & ~changed) | (states & changed);
+
+done:
+    return;
+}
+
+static int
+meters_get_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    io_meters_st * const meters = container_of(obj, io_meters_st, ubus_object);
+    struct blob_buf buf;
+
+    accumulate_on_time(meters, now_msecs());
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    for (size_t type = 0; type < __io_meters_type_max; type++)
+    {
+        if (!meters->metered[type])
+        {
+            continue;
+        }
+
+        void * const array_cookie = blobmsg_open_array(&buf, type_names[type]);
+
+        for (size_t i = 0; i < meters->totals.num_ios[type]; i++)
+        {
+            io_meter_st const * const meter = &meters->totals.meters[type][i];
+            void * const table_cookie = blobmsg_open_table(&buf, NULL);
+
+            blobmsg_add_u32(&buf, "instance", i);
+            blobmsg_add_bool(&buf, "state", (meters->states[type] & BIT(i)) != 0);
+            blobmsg_add_u64(&buf, "on_time_ms", meter->on_time_msecs);
+            blobmsg_add_u64(&buf, "transitions", meter->transitions);
+            blobmsg_close_table(&buf, table_cookie);
+        }
+        blobmsg_close_array(&buf, array_cookie);
+    }
+
+    ubus_send_reply(ubus_ctx, req, buf.head);
+    blob_buf_free(&buf);
+
+    return UBUS_STATUS_OK;
+}
+
+static struct ubus_method const io_meters_methods[] =
+{
+    UBUS_METHOD_NOARG("get", meters_get_handler)
+};
+
+static struct ubus_object_type io_meters_object_type =
+    UBUS_OBJECT_TYPE(io_meters_ubus_name, io_meters_methods);
+
+static size_t
+clamp_num_ios(size_t const num_ios)
+{
+    return num_ios < IO_METERS_MAX_IOS ? num_ios : IO_METERS_MAX_IOS;
+}
+
+io_meters_st * io_meters_initialise(
+    struct ubus_context * const ubus_ctx,
+    config_st const * const config,
+    size_t const num_inputs,
+    uint32_t const input_states,
+    bool const inputs_notified,
+    size_t const num_outputs,
+    uint32_t const output_states)
+{
+    io_meters_st * meters = calloc(1, sizeof *meters);
+    struct blob_attr * const section = config_get_section(config, meters_section_name);
+    uint64_t const now = now_msecs();
+
+    if (meters == NULL)
+    {
+        goto done;
+    }
+
+    meters->ubus_ctx = ubus_ctx;
+    meters->checkpoint_timer.cb = checkpoint_timer_handler;
+    meters->checkpoint_interval_secs = IO_METERS_DEFAULT_CHECKPOINT_SECS;
+    meters->metered[io_meters_inputs] = inputs_notified;
+    meters->metered[io_meters_outputs] = true;
+    if (!inputs_notified)
+    {
+        WPRINTF("Not listening for input changes, so inputs won't be metered\n");
+    }
+
+    meters->totals.magic = IO_METERS_FILE_MAGIC;
+    meters->totals.version = IO_METERS_FILE_VERSION;
+    meters->totals.num_ios[io_meters_inputs] = clamp_num_ios(num_inputs);
+    meters->totals.num_ios[io_meters_outputs] = clamp_num_ios(num_outputs);
+    meters->states[io_meters_inputs] = input_states & valid_mask(meters, io_meters_inputs);
+    meters->states[io_meters_outputs] = output_states & valid_mask(meters, io_meters_outputs);
+    for (size_t type = 0; type < __io_meters_type_max; type++)
+    {
+        for (size_t i = 0; i < IO_METERS_MAX_IOS; i++)
+        {
+            meters->on_since_msecs[type][i] = now;
+        }
+    }
+
+    if (section != NULL)
+    {
+        struct blob_attr * tb[__METERS_CONFIG_MAX];
+
+        blobmsg_parse(meters_config_policy,
+                      ARRAY_SIZE(meters_config_policy),
+                      tb,
+                      blobmsg_data(section),
+                      blobmsg_data_len(section));
+
+        if (tb[METERS_CONFIG_FILE] != NULL)
+        {
+            meters->path = strdup(blobmsg_get_string(tb[METERS_CONFIG_FILE]));
+        }
+        if (tb[METERS_CONFIG_CHECKPOINT_INTERVAL] != NULL
+            && blobmsg_get_u32(tb[METERS_CONFIG_CHECKPOINT_INTERVAL]) > 0)
+        {
+            meters->checkpoint_interval_secs =
+                blobmsg_get_u32(tb[METERS_CONFIG_CHECKPOINT_INTERVAL]);
+        }
+    }
+
+    if (meters->path != NULL)
+    {
+        load_checkpoint(meters);
+        uloop_timeout_set(&meters->checkpoint_timer, meters->checkpoint_interval_secs * 1000);
+    }
+
+    meters->ubus_object.name = io_meters_ubus_name;
+    meters->ubus_object.type = &io_meters_object_type;
+    meters->ubus_object.methods = io_meters_methods;
+    meters->ubus_object.n_methods = ARRAY_SIZE(io_meters_methods);
+
+    if (ubus_add_object(ubus_ctx, &meters->ubus_object) != 0)
+    {
+        EPRINTF("Failed to add ubus object: %s\n", io_meters_ubus_name);
+        uloop_timeout_cancel(&meters->checkpoint_timer);
+        free(meters->path);
+        free(meters);
+        meters = NULL;
+        goto done;
+    }
+
+done:
+    return meters;
+}
+
+void io_meters_done(io_meters_st * const meters)
+{
+    if (meters == NULL)
+    {
+        goto done;
+    }
+
+    uloop_timeout_cancel(&meters->checkpoint_timer);
+    write_checkpoint(meters);
+    ubus_remove_object(meters->ubus_ctx, &meters->ubus_object);
+    free(meters->path);
+    free(meters);
+
+done:
+    return;
+}
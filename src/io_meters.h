@@ -0,0 +1,50 @@
+#ifndef __IO_METERS_H__
+#define __IO_METERS_H__
+
+#include "config.h"
+
+#include <libubus.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Cumulative on-time and transition counts for every input and output,
+ * read with piface.meters get. Inputs are on when active (closed).
+ * The totals are checkpointed to the file given by the "meters" section
+ * of the config, and carried on from there after a restart:
+ *   {"meters":{"file":"/etc/piface/meters","checkpoint_interval":300}}
+ * The interval is in seconds. Without a file the totals start from zero
+ * each time.
+ * Input changes are only seen while the daemon is listening for them
+ * (-n). Otherwise inputs are left out of the reply, and their saved
+ * totals are kept as they were.
+ */
+typedef struct io_meters_st io_meters_st;
+
+typedef enum io_meters_type_t
+{
+    io_meters_inputs,
+    io_meters_outputs,
+    __io_meters_type_max
+} io_meters_type_t;
+
+io_meters_st * io_meters_initialise(
+    struct ubus_context * const ubus_ctx,
+    config_st const * const config,
+    size_t const num_inputs,
+    uint32_t const input_states,
+    bool const inputs_notified,
+    size_t const num_outputs,
+    uint32_t const output_states);
+
+/* Writes a final checkpoint. */
+void io_meters_done(io_meters_st * const meters);
+
+void io_meters_update(
+    io_meters_st * const meters,
+    io_meters_type_t const type,
+    uint32_t const changed_mask,
+    uint32_t const states);
+
+#endif /* __IO_METERS_H__ */
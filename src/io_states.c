@@ -4,13 +4,15 @@
 #include <stdlib.h>
 #include <stdint.h>
 
-#define BIT(x) (1UL << (x))
+#define BITS_PER_WORD 64
+#define IO_STATES_NUM_WORDS ((IO_STATES_MAX_CHANNELS + BITS_PER_WORD - 1) / BITS_PER_WORD)
+#define WORD_BIT(x) ((uint64_t)1 << ((x) % BITS_PER_WORD))
 
 struct io_states_st
 {
-    uint32_t states_modified; /* Bitmask indicating which bits in desired_states have meaning. */
-    uint32_t states; /* Bitmask of the desired states. */
-}; 
+    uint64_t states_modified[IO_STATES_NUM_WORDS]; /* Which bits in states have meaning. */
+    uint64_t states[IO_STATES_NUM_WORDS]; /* The desired states. */
+};
 
 io_states_st * io_states_create(void)
 {
@@ -24,32 +26,210 @@ void io_states_free(io_states_st * const io_state_ctx)
     free(io_state_ctx);
 }
 
-void 
+bool
 io_states_set_state(
     io_states_st * const io_state_ctx,
-    unsigned int index, 
+    unsigned int index,
     bool const state)
 {
-    io_state_ctx->states_modified |= BIT(index);
+    bool set_state;
+
+    if (index >= IO_STATES_MAX_CHANNELS)
+    {
+        set_state = false;
+        goto done;
+    }
+
+    size_t const word = index / BITS_PER_WORD;
+
+    io_state_ctx->states_modified[word] |= WORD_BIT(index);
     if (state)
     {
-        io_state_ctx->states |= BIT(index);
+        io_state_ctx->states[word] |= WORD_BIT(index);
     }
     else
     {
-        io_state_ctx->states &= ~BIT(index);
+        io_state_ctx->states[word] &= ~WORD_BIT(index);
+    }
+
+    set_state = true;
+
+done:
+    return set_state;
+}
+
+bool
+io_states_get_state(
+    io_states_st const * const io_state_ctx,
+    unsigned int index,
+    bool * const state)
+{
+    bool got_state;
+
+    if (index >= IO_STATES_MAX_CHANNELS)
+    {
+        got_state = false;
+        goto done;
+    }
+
+    size_t const word = index / BITS_PER_WORD;
+
+    if ((io_state_ctx->states_modified[word] & WORD_BIT(index)) == 0)
+    {
+        got_state = false;
+        goto done;
+    }
+
+    *state = (io_state_ctx->states[word] & WORD_BIT(index)) != 0;
+    got_state = true;
+
+done:
+    return got_state;
+}
+
+void io_states_merge(
+    io_states_st * const dst,
+    io_states_st const * const src)
+{
+    for (size_t i = 0; i < IO_STATES_NUM_WORDS; i++)
+    {
+        dst->states[i] = (dst->states[i] & ~src->states_modified[i])
+                         | (src->states[i] & src->states_modified[i]);
+        dst->states_modified[i] |= src->states_modified[i];
+    }
+}
+
+bool io_states_diff(
+    io_states_st const * const current,
+    io_states_st const * const requested,
+    io_states_st * const changes)
+{
+    uint64_t any_changes = 0;
+
+    for (size_t i = 0; i < IO_STATES_NUM_WORDS; i++)
+    {
+        uint64_t const unchanged =
+            current->states_modified[i] & ~(current->states[i] ^ requested->states[i]);
+        uint64_t const changed = requested->states_modified[i] & ~unchanged;
+
+        changes->states_modified[i] = changed;
+        changes->states[i] = requested->states[i] & changed;
+        any_changes |= changed;
     }
+
+    return any_changes != 0;
 }
 
-uint32_t io_states_get_interesting_states_mask(
+static size_t
+count_bits(uint64_t const * const words)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < IO_STATES_NUM_WORDS; i++)
+    {
+        count += __builtin_popcountll(words[i]);
+    }
+
+    return count;
+}
+
+size_t io_states_count_modified(
     io_states_st const * const io_state_ctx)
 {
-    return io_state_ctx->states_modified;
+    return count_bits(io_state_ctx->states_modified);
 }
 
-uint32_t io_states_get_states_mask(
+size_t io_states_count_active(
     io_states_st const * const io_state_ctx)
 {
-    return io_state_ctx->states;
+    uint64_t active[IO_STATES_NUM_WORDS];
+
+    for (size_t i = 0; i < IO_STATES_NUM_WORDS; i++)
+    {
+        active[i] = io_state_ctx->states[i] & io_state_ctx->states_modified[i];
+    }
+
+    return count_bits(active);
+}
+
+static uint32_t
+get_bits(
+    uint64_t const * const words,
+    unsigned int const first,
+    unsigned int const count)
+{
+    size_t const word = first / BITS_PER_WORD;
+    unsigned int const shift = first % BITS_PER_WORD;
+    uint64_t bits = words[word] >> shift;
+
+    /* The slice may straddle two words. */
+    if (shift + count > BITS_PER_WORD && word + 1 < IO_STATES_NUM_WORDS)
+    {
+        bits |= words[word + 1] << (BITS_PER_WORD - shift);
+    }
+
+    return bits & (((uint64_t)1 << count) - 1);
 }
 
+static void
+set_bits(
+    uint64_t * const words,
+    unsigned int const first,
+    unsigned int const count,
+    uint32_t const mask,
+    uint32_t const values)
+{
+    size_t const word = first / BITS_PER_WORD;
+    unsigned int const shift = first % BITS_PER_WORD;
+    uint64_t const slice_mask = mask & (((uint64_t)1 << count) - 1);
+
+    words[word] = (words[word] & ~(slice_mask << shift))
+                  | (((uint64_t)values & slice_mask) << shift);
+    if (shift + count > BITS_PER_WORD && word + 1 < IO_STATES_NUM_WORDS)
+    {
+        unsigned int const high_shift = BITS_PER_WORD - shift;
+
+        words[word + 1] = (words[word + 1] & ~(slice_mask >> high_shift))
+                          | (((uint64_t)values & slice_mask) >> high_shift);
+    }
+}
+
+void io_states_get_slice(
+    io_states_st const * const io_state_ctx,
+    unsigned int const first,
+    unsigned int const count,
+    uint32_t * const modified_mask,
+    uint32_t * const states_mask)
+{
+    if (first >= IO_STATES_MAX_CHANNELS || count == 0 || count > 32)
+    {
+        *modified_mask = 0;
+        *states_mask = 0;
+        goto done;
+    }
+
+    *modified_mask = get_bits(io_state_ctx->states_modified, first, count);
+    *states_mask = get_bits(io_state_ctx->states, first, count) & *modified_mask;
+
+done:
+    return;
+}
+
+void io_states_set_slice(
+    io_states_st * const io_state_ctx,
+    unsigned int const first,
+    unsigned int const count,
+    uint32_t const modified_mask,
+    uint32_t const states_mask)
+{
+    if (first >= IO_STATES_MAX_CHANNELS || count == 0 || count > 32)
+    {
+        goto done;
+    }
+
+    set_bits(io_state_ctx->states, first, count, modified_mask, states_mask);
+    set_bits(io_state_ctx->states_modified, first, count, modified_mask, modified_mask);
+
+done:
+    return;
+}
@@ -5,6 +5,16 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+/* A set of IO states, indexed by channel, recording which channels have
+ * been given a state and what that state is. Channels are numbered
+ * across all boards, so board n's channels start at
+ * n * channels_per_board.
+ * Operations on whole sets work a word at a time.
+ */
+#ifndef IO_STATES_MAX_CHANNELS
+#define IO_STATES_MAX_CHANNELS 512
+#endif
+
 typedef struct io_states_st io_states_st;
 
 io_states_st * io_states_create(void);
@@ -12,16 +22,59 @@ io_states_st * io_states_create(void);
 void io_states_free(
     io_states_st * const io_state_ctx);
 
-void 
+/* Returns false if index is out of range. */
+bool
 io_states_set_state(
     io_states_st * const io_state_ctx,
-    unsigned int index, 
+    unsigned int index,
     bool const state);
 
-uint32_t io_states_get_interesting_states_mask(
+/* Returns false if the channel hasn't been given a state. */
+bool
+io_states_get_state(
+    io_states_st const * const io_state_ctx,
+    unsigned int index,
+    bool * const state);
+
+/* Apply the states set in src on top of those in dst. */
+void io_states_merge(
+    io_states_st * const dst,
+    io_states_st const * const src);
+
+/* Set changes to the states in requested that aren't already known to
+ * be in place in current. Returns true if there are any.
+ */
+bool io_states_diff(
+    io_states_st const * const current,
+    io_states_st const * const requested,
+    io_states_st * const changes);
+
+/* The number of channels that have been given a state. */
+size_t io_states_count_modified(
     io_states_st const * const io_state_ctx);
 
-uint32_t io_states_get_states_mask(
+/* The number of channels that have been given a state of true. */
+size_t io_states_count_active(
     io_states_st const * const io_state_ctx);
 
+/* Extract count (at most 32) channels starting at first, typically
+ * those of one board, as bitmasks with bit 0 being channel first.
+ */
+void io_states_get_slice(
+    io_states_st const * const io_state_ctx,
+    unsigned int const first,
+    unsigned int const count,
+    uint32_t * const modified_mask,
+    uint32_t * const states_mask);
+
+/* Set the states of the channels in modified_mask, with bit 0 being
+ * channel first.
+ */
+void io_states_set_slice(
+    io_states_st * const io_state_ctx,
+    unsigned int const first,
+    unsigned int const count,
+    uint32_t const modified_mask,
+    uint32_t const states_mask);
+
 #endif /* __IO_STATES_H__ */
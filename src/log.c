@@ -0,0 +1,335 @@
+#include "log.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_RING_SIZE 256 /* Must be a power of 2. */
+#define LOG_MESSAGE_MAX_LENGTH 200
+#define LOG_DRAIN_INTERVAL_MSECS 50
+
+typedef struct log_slot_st
+{
+    /* Bounded MPSC queue slot, after Dmitry Vyukov's bounded queue.
+     * sequence == position: free for the producer claiming that position.
+     * sequence == position + 1: holds a message for the consumer.
+     * The slot's index is subtracted from the stored value so that the
+     * zero initialised ring is valid before log_init() is called.
+     */
+    atomic_size_t sequence;
+    int level;
+    struct timespec timestamp;
+    char text[LOG_MESSAGE_MAX_LENGTH];
+} log_slot_st;
+
+typedef struct log_ctx_st
+{
+    log_slot_st slots[LOG_RING_SIZE];
+    atomic_size_t enqueue_pos;
+    size_t dequeue_pos;
+    atomic_uint_fast32_t dropped;
+
+    pthread_t thread;
+    atomic_bool running;
+    bool thread_started;
+    bool use_syslog;
+    FILE * fp;
+} log_ctx_st;
+
+static log_ctx_st log_ctx;
+
+/* Until log_init() is called, messages are only queued. */
+int log_runtime_level = LOG_INFO;
+
+static char const * const level_names[] =
+{
+    [LOG_EMERG] = "emerg",
+    [LOG_ALERT] = "alert",
+    [LOG_CRIT] = "crit",
+    [LOG_ERR] = "err",
+    [LOG_WARNING] = "warning",
+    [LOG_NOTICE] = "notice",
+    [LOG_INFO] = "info",
+    [LOG_DEBUG] = "debug"
+};
+
+static size_t
+slot_sequence_load(size_t const pos, log_slot_st * const slot)
+{
+    return atomic_load_explicit(&slot->sequence, memory_order_acquire)
+           + (pos & (LOG_RING_SIZE - 1));
+}
+
+static void
+slot_sequence_store(size_t const pos, log_slot_st * const slot, size_t const sequence)
+{
+    atomic_store_explicit(&slot->sequence,
+                          sequence - (pos & (LOG_RING_SIZE - 1)),
+                          memory_order_release);
+}
+
+/* Called from any thread. Never blocks. */
+void log_message(
+    int const level,
+    char const * const func,
+    int const line,
+    char const * const format,
+    ...)
+{
+    size_t pos = atomic_load_explicit(&log_ctx.enqueue_pos, memory_order_relaxed);
+    log_slot_st * slot;
+
+    for (;;)
+    {
+        slot = &log_ctx.slots[pos & (LOG_RING_SIZE - 1)];
+
+        size_t const sequence = slot_sequence_load(pos, slot);
+        intptr_t const diff = (intptr_t)sequence - (intptr_t)pos;
+
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&log_ctx.enqueue_pos,
+                                                      &pos,
+                                                      pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            /* Full. Drop the message rather than wait. */
+            atomic_fetch_add_explicit(&log_ctx.dropped, 1, memory_order_relaxed);
+            goto done;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&log_ctx.enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    va_list args;
+    int prefix_length;
+
+    slot->level = level;
+    clock_gettime(CLOCK_REALTIME, &slot->timestamp);
+    prefix_length = snprintf(slot->text, sizeof slot->text, "%s(%d): ", func, line);
+    if (prefix_length < 0 || (size_t)prefix_length >= sizeof slot->text)
+    {
+        prefix_length = 0;
+    }
+
+    va_start(args, format);
+    vsnprintf(slot->text + prefix_length, sizeof slot->text - prefix_length, format, args);
+    va_end(args);
+
+    slot_sequence_store(pos, slot, pos + 1);
+
+done:
+    return;
+}
+
+/* Many messages have leading and trailing line breaks meant for a
+ * terminal. Strip them so each message is a single line.
+ */
+static char *
+trim_line_breaks(char * const text)
+{
+    char * start = text;
+    size_t length;
+
+    while (*start == '\r' || *start == '\n')
+    {
+        start++;
+    }
+
+    length = strlen(start);
+    while (length > 0 && (start[length - 1] == '\r' || start[length - 1] == '\n'))
+    {
+        length--;
+    }
+    start[length] = '\0';
+
+    return start;
+}
+
+static void
+write_message(int const level, struct timespec const * const timestamp, char * const text)
+{
+    char * const line = trim_line_breaks(text);
+
+    if (log_ctx.use_syslog)
+    {
+        syslog(level, "%s", line);
+    }
+    else if (log_ctx.fp != NULL)
+    {
+        struct tm tm;
+        char time_str[32];
+
+        localtime_r(&timestamp->tv_sec, &tm);
+        strftime(time_str, sizeof time_str, "%Y-%m-%d %H:%M:%S", &tm);
+        fprintf(log_ctx.fp,
+                "%s.%03ld %s: %s\n",
+                time_str,
+                timestamp->tv_nsec / 1000000,
+                level_names[level],
+                line);
+    }
+}
+
+/* Only called by one thread at a time: the logging thread, or by
+ * log_done() once the logging thread has stopped.
+ */
+static void
+log_drain(void)
+{
+    bool wrote_message = false;
+
+    for (;;)
+    {
+        log_slot_st * const slot =
+            &log_ctx.slots[log_ctx.dequeue_pos & (LOG_RING_SIZE - 1)];
+        size_t const sequence = slot_sequence_load(log_ctx.dequeue_pos, slot);
+
+        if (sequence != log_ctx.dequeue_pos + 1)
+        {
+            break;
+        }
+
+        write_message(slot->level, &slot->timestamp, slot->text);
+        wrote_message = true;
+
+        slot_sequence_store(log_ctx.dequeue_pos, slot, log_ctx.dequeue_pos + LOG_RING_SIZE);
+        log_ctx.dequeue_pos++;
+    }
+
+    uint_fast32_t const dropped = atomic_exchange(&log_ctx.dropped, 0);
+
+    if (dropped > 0)
+    {
+        char text[LOG_MESSAGE_MAX_LENGTH];
+        struct timespec now;
+
+        clock_gettime(CLOCK_REALTIME, &now);
+        snprintf(text, sizeof text, "%lu log messages dropped", (unsigned long)dropped);
+        write_message(LOG_WARNING, &now, text);
+        wrote_message = true;
+    }
+
+    if (wrote_message && log_ctx.fp != NULL)
+    {
+        fflush(log_ctx.fp);
+    }
+}
+
+static void *
+log_thread(void * const arg)
+{
+    struct timespec const interval =
+    {
+        .tv_sec = 0,
+        .tv_nsec = LOG_DRAIN_INTERVAL_MSECS * 1000000L
+    };
+    (void)arg;
+
+    while (atomic_load(&log_ctx.running))
+    {
+        log_drain();
+        nanosleep(&interval, NULL);
+    }
+
+    return NULL;
+}
+
+void log_set_level(int const level)
+{
+    log_runtime_level = level;
+}
+
+int log_level_from_string(char const * const level_name)
+{
+    int level = -1;
+
+    for (size_t i = 0; i < sizeof level_names / sizeof level_names[0]; i++)
+    {
+        if (strcasecmp(level_name, level_names[i]) == 0)
+        {
+            level = i;
+            break;
+        }
+    }
+
+    return level;
+}
+
+bool log_init(
+    char const * const ident,
+    char const * const log_filename,
+    bool const use_syslog)
+{
+    bool initialised;
+
+    if (log_filename != NULL)
+    {
+        log_ctx.fp = fopen(log_filename, "a");
+        if (log_ctx.fp == NULL)
+        {
+            initialised = false;
+            goto done;
+        }
+    }
+    else if (use_syslog)
+    {
+        openlog(ident, LOG_PID, LOG_DAEMON);
+        log_ctx.use_syslog = true;
+    }
+    else
+    {
+        log_ctx.fp = stderr;
+    }
+
+    atomic_store(&log_ctx.running, true);
+    if (pthread_create(&log_ctx.thread, NULL, log_thread, NULL) != 0)
+    {
+        atomic_store(&log_ctx.running, false);
+        initialised = false;
+        goto done;
+    }
+    log_ctx.thread_started = true;
+
+    initialised = true;
+
+done:
+    return initialised;
+}
+
+void log_done(void)
+{
+    if (log_ctx.thread_started)
+    {
+        atomic_store(&log_ctx.running, false);
+        pthread_join(log_ctx.thread, NULL);
+        log_ctx.thread_started = false;
+    }
+
+    log_drain();
+
+    if (log_ctx.use_syslog)
+    {
+        closelog();
+        log_ctx.use_syslog = false;
+    }
+    if (log_ctx.fp != NULL && log_ctx.fp != stderr)
+    {
+        fclose(log_ctx.fp);
+    }
+    log_ctx.fp = NULL;
+}
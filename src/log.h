@@ -0,0 +1,35 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <stdbool.h>
+#include <syslog.h>
+
+/* Messages are formatted by the caller into a lock-free in-memory ring,
+ * and written out to syslog, a file or stderr by a separate thread, so
+ * logging never waits for I/O.
+ * Levels are the syslog levels.
+ */
+
+extern int log_runtime_level;
+
+bool log_init(
+    char const * const ident,
+    char const * const log_filename,
+    bool const use_syslog);
+
+/* Write out any queued messages and stop the logging thread. */
+void log_done(void);
+
+void log_set_level(int const level);
+
+/* Returns -1 if the name isn't a known level. */
+int log_level_from_string(char const * const level_name);
+
+void log_message(
+    int const level,
+    char const * const func,
+    int const line,
+    char const * const format,
+    ...) __attribute__((format(printf, 4, 5)));
+
+#endif /* __LOG_H__ */
@@ -0,0 +1,501 @@
+#include "loop_profile.h"
+#include "debug.h"
+
+#include <libubox/blobmsg.h>
+#include <libubox/uloop.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#define LOOP_PROFILE_DEFAULT_THRESHOLD_MSECS 100
+#define LOOP_PROFILE_DEFAULT_HISTORY 32
+#define LOOP_PROFILE_MAX_HISTORY 1024
+
+typedef struct loop_handler_stats_st
+{
+    uint64_t calls;
+    uint64_t total_usecs;
+    uint64_t max_usecs;
+    uint64_t stalls;
+} loop_handler_stats_st;
+
+typedef struct loop_stall_st
+{
+    loop_profile_handler_t handler;
+    /* Wall clock time, so that it can be matched up with other logs. */
+    time_t time;
+    uint64_t duration_usecs;
+} loop_stall_st;
+
+struct loop_profile_st
+{
+    struct ubus_object ubus_object;
+    struct ubus_context * ubus_ctx;
+    struct uloop_fd signal_fd;
+    struct sigaction previous_action;
+    bool dump_on_signal;
+    uint64_t threshold_usecs;
+
+    loop_handler_stats_st handlers[__loop_profile_handler_max];
+
+    /* The most recent stalls, oldest first from next_stall. */
+    loop_stall_st * stalls;
+    size_t history;
+    size_t next_stall;
+    uint64_t num_stalls;
+};
+
+static char const loop_profile_ubus_name[] = "piface.profile";
+
+static char const * const handler_names[] =
+{
+    [loop_profile_handler_ubus] = "ubus",
+    [loop_profile_handler_ubus_reconnect] = "ubus_reconnect",
+    [loop_profile_handler_gpio_interrupt] = "gpio_interrupt",
+    [loop_profile_handler_hw_events] = "hw_events",
+    [loop_profile_handler_socket_accept] = "socket_accept",
+    [loop_profile_handler_socket_client] = "socket_client",
+    [loop_profile_handler_request_lanes] = "request_lanes",
+    [loop_profile_handler_sequence_timer] = "sequence_timer",
+    [loop_profile_handler_pwm_timer] = "pwm_timer",
+    [loop_profile_handler_journal_flush] = "journal_flush",
+    [loop_profile_handler_meters_checkpoint] = "meters_checkpoint",
+    [loop_profile_handler_wait_timeout] = "wait_timeout",
+    [loop_profile_handler_gesture_timer] = "gesture_timer"
+};
+
+/* The profile in use, if any. */
+static loop_profile_st * active_profile;
+/* The eventfd that the SIGUSR1 handler signals. */
+static volatile sig_atomic_t dump_event_fd = -1;
+
+enum
+{
+    PROFILE_CONFIG_THRESHOLD,
+    PROFILE_CONFIG_HISTORY,
+    PROFILE_CONFIG_DUMP_ON_SIGNAL,
+    __PROFILE_CONFIG_MAX
+};
+
+static struct blobmsg_policy const profile_config_policy[__PROFILE_CONFIG_MAX] =
+{
+    [PROFILE_CONFIG_THRESHOLD] = { .name = "threshold_ms", .type = BLOBMSG_TYPE_INT32 },
+    [PROFILE_CONFIG_HISTORY] = { .name = "history", .type = BLOBMSG_TYPE_INT32 },
+    [PROFILE_CONFIG_DUMP_ON_SIGNAL] = { .name = "dump_on_signal", .type = BLOBMSG_TYPE_BOOL }
+};
+
+static uint64_t
+now_usecs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void
+record_stall(
+    loop_profile_st * const profile,
+    loop_profile_handler_t const handler,
+    uint64_t const duration_usecs)
+{
+    loop_stall_st * const stall = &profile->stalls[profile->next_stall];
+
+    stall->handler = handler;
+    stall->time = time(NULL);
+    stall->duration_usecs = duration_usecs;
+    profile->next_stall = (profile->next_stall + 1) % profile->history;
+    profile->num_stalls++;
+    profile->handlers[handler].stalls++;
+
+    WPRINTF("Event loop stalled for %llu ms in %s\n",
+            (unsigned long long)(duration_usecs / 1000),
+            handler_names[handler]);
+}
+
+uint64_t loop_profile_begin(void)
+{
+    return active_profile != NULL ? now_usecs() : 0;
+}
+
+void loop_profile_end(
+    loop_profile_handler_t const handler,
+    uint64_t const start_usecs)
+{
+    loop_profile_st * const profile = active_profile;
+
+    if (profile == NULL || start_usecs == 0)
+    {
+        goto done;
+    }
+
+    uint64_t const duration_usecs = now_usecs() - start_usecs;
+    loop_handler_stats_st * const stats = &profile->handlers[handler];
+
+    stats->calls++;
+    stats->total_usecs += duration_usecs;
+    if (duration_usecs > stats->max_usecs)
+    {
+        stats->max_usecs = duration_usecs;
+    }
+
+    if (duration_usecs > profile->threshold_usecs)
+    {
+        record_stall(profile, handler, duration_usecs);
+    }
+
+done:
+    return;
+}
+
+/* Calls the visitor with the stalls still held, oldest first. */
+static void
+for_each_stall(
+    loop_profile_st const * const profile,
+    void (*visitor)(loop_stall_st const * const stall, void * const visitor_ctx),
+    void * const visitor_ctx)
+{
+    size_t const num_held =
+        profile->num_stalls < profile->history ? profile->num_stalls : profile->history;
+    size_t const first =
+        (profile->next_stall + profile->history - num_held) % profile->history;
+
+    for (size_t i = 0; i < num_held; i++)
+    {
+        visitor(&profile->stalls[(first + i) % profile->history], visitor_ctx);
+    }
+}
+
+static void
+log_stall(loop_stall_st const * const stall, void * const visitor_ctx)
+{
+    struct tm tm;
+    char time_str[32];
+    (void)visitor_ctx;
+
+    localtime_r(&stall->time, &tm);
+    strftime(time_str, sizeof time_str, "%Y-%m-%d %H:%M:%S", &tm);
+    IPRINTF("  %s %s %llu us\n",
+            time_str,
+            handler_names[stall->handler],
+            (unsigned long long)stall->duration_usecs);
+}
+
+static void
+log_profile(loop_profile_st const * const profile)
+{
+    IPRINTF("Event loop profile, threshold %llu ms:\n",
+            (unsigned long long)(profile->threshold_usecs / 1000));
+    for (size_t i = 0; i < __loop_profile_handler_max; i++)
+    {
+        loop_handler_stats_st const * const stats = &profile->handlers[i];
+
+        if (stats->calls == 0)
+        {
+            continue;
+        }
+        IPRINTF("  %s: calls %llu, mean %llu us, max %llu us, stalls %llu\n",
+                handler_names[i],
+                (unsigned long long)stats->calls,
+                (unsigned long long)(stats->total_usecs / stats->calls),
+                (unsigned long long)stats->max_usecs,
+                (unsigned long long)stats->stalls);
+    }
+    IPRINTF("Most recent of %llu stalls:\n", (unsigned long long)profile->num_stalls);
+    for_each_stall(profile, log_stall, NULL);
+}
+
+static void
+add_stall(loop_stall_st const * const stall, void * const visitor_ctx)
+{
+    struct blob_buf * const buf = visitor_ctx;
+    void * const cookie = blobmsg_open_table(buf, NULL);
+
+    blobmsg_add_string(buf, "handler", handler_names[stall->handler]);
+    blobmsg_add_u64(buf, "time", stall->time);
+    blobmsg_add_u64(buf, "duration_us", stall->duration_usecs);
+    blobmsg_close_table(buf, cookie);
+}
+
+static int
+profile_stats_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    loop_profile_st * const profile = container_of(obj, loop_profile_st, ubus_object);
+    struct blob_buf buf;
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    blobmsg_add_u32(&buf, "threshold_ms", profile->threshold_usecs / 1000);
+    blobmsg_add_u64(&buf, "stalls", profile->num_stalls);
+
+    void * const handlers_cookie = blobmsg_open_table(&buf, "handlers");
+
+    for (size_t i = 0; i < __loop_profile_handler_max; i++)
+    {
+        loop_handler_stats_st const * const stats = &profile->handlers[i];
+        void * const handler_cookie = blobmsg_open_table(&buf, handler_names[i]);
+
+        blobmsg_add_u64(&buf, "calls", stats->calls);
+        blobmsg_add_u64(&buf, "mean_us",
+                        stats->calls > 0 ? stats->total_usecs / stats->calls : 0);
+        blobmsg_add_u64(&buf, "max_us", stats->max_usecs);
+        blobmsg_add_u64(&buf, "stalls", stats->stalls);
+        blobmsg_close_table(&buf, handler_cookie);
+    }
+    blobmsg_close_table(&buf, handlers_cookie);
+
+    ubus_send_reply(ubus_ctx, req, buf.head);
+    blob_buf_free(&buf);
+
+    return UBUS_STATUS_OK;
+}
+
+static int
+profile_stalls_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    loop_profile_st * const profile = container_of(obj, loop_profile_st, ubus_object);
+    struct blob_buf buf;
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    void * const stalls_cookie = blobmsg_open_array(&buf, "stalls");
+
+    for_each_stall(profile, add_stall, &buf);
+    blobmsg_close_array(&buf, stalls_cookie);
+
+    ubus_send_reply(ubus_ctx, req, buf.head);
+    blob_buf_free(&buf);
+
+    return UBUS_STATUS_OK;
+}
+
+static int
+profile_reset_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    loop_profile_st * const profile = container_of(obj, loop_profile_st, ubus_object);
+
+    memset(profile->handlers, 0, sizeof profile->handlers);
+    profile->next_stall = 0;
+    profile->num_stalls = 0;
+
+    return UBUS_STATUS_OK;
+}
+
+static struct ubus_method const loop_profile_methods[] =
+{
+    UBUS_METHOD_NOARG("stats", profile_stats_handler),
+    UBUS_METHOD_NOARG("stalls", profile_stalls_handler),
+    UBUS_METHOD_NOARG("reset", profile_reset_handler)
+};
+
+static struct ubus_object_type loop_profile_object_type =
+    UBUS_OBJECT_TYPE(loop_profile_ubus_name, loop_profile_methods);
+
+static void
+dump_signal_handler(int const signal_number)
+{
+    uint64_t const value = 1;
+    (void)signal_number;
+
+    /* Only async-signal-safe calls are allowed here, so the dump itself
+     * is done from the loop.
+     */
+    if (write(dump_event_fd, &value, sizeof value) < 0)
+    {
+        /* A dump is already pending. */
+    }
+}
+
+static void
+handle_dump_event(struct uloop_fd * u, unsigned int events)
+{
+    loop_profile_st * const profile = container_of(u, loop_profile_st, signal_fd);
+    uint64_t value;
+    (void)events;
+
+    if (read(profile->signal_fd.fd, &value, sizeof value) < 0)
+    {
+        goto done;
+    }
+
+    log_profile(profile);
+
+done:
+    return;
+}
+
+static bool
+listen_for_dump_signal(loop_profile_st * const profile)
+{
+    struct sigaction action;
+    bool listening;
+
+    profile->signal_fd.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (profile->signal_fd.fd < 0)
+    {
+        listening = false;
+        goto done;
+    }
+    dump_event_fd = profile->signal_fd.fd;
+    profile->signal_fd.cb = handle_dump_event;
+    uloop_fd_add(&profile->signal_fd, ULOOP_READ);
+
+    memset(&action, 0, sizeof action);
+    action.sa_handler = dump_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGUSR1, &action, &profile->previous_action) != 0)
+    {
+        uloop_fd_delete(&profile->signal_fd);
+        close(profile->signal_fd.fd);
+        profile->signal_fd.fd = -1;
+        dump_event_fd = -1;
+        listening = false;
+        goto done;
+    }
+
+    listening = true;
+
+done:
+    return listening;
+}
+
+static bool
+parse_profile_config(
+    loop_profile_st * const profile,
+    struct blob_attr * const config_section)
+{
+    struct blob_attr * tb[__PROFILE_CONFIG_MAX];
+    uint32_t threshold_msecs = LOOP_PROFILE_DEFAULT_THRESHOLD_MSECS;
+    uint32_t history = LOOP_PROFILE_DEFAULT_HISTORY;
+    bool parsed;
+
+    blobmsg_parse(profile_config_policy, __PROFILE_CONFIG_MAX, tb,
+                  blobmsg_data(config_section), blobmsg_data_len(config_section));
+
+    if (tb[PROFILE_CONFIG_THRESHOLD] != NULL)
+    {
+        threshold_msecs = blobmsg_get_u32(tb[PROFILE_CONFIG_THRESHOLD]);
+    }
+    if (tb[PROFILE_CONFIG_HISTORY] != NULL)
+    {
+        history = blobmsg_get_u32(tb[PROFILE_CONFIG_HISTORY]);
+    }
+    if (history == 0 || history > LOOP_PROFILE_MAX_HISTORY)
+    {
+        parsed = false;
+        goto done;
+    }
+
+    profile->threshold_usecs = (uint64_t)threshold_msecs * 1000;
+    profile->history = history;
+    profile->dump_on_signal =
+        tb[PROFILE_CONFIG_DUMP_ON_SIGNAL] != NULL
+        && blobmsg_get_bool(tb[PROFILE_CONFIG_DUMP_ON_SIGNAL]);
+    parsed = true;
+
+done:
+    return parsed;
+}
+
+loop_profile_st * loop_profile_create(
+    struct ubus_context * const ubus_ctx,
+    struct blob_attr * const config_section)
+{
+    loop_profile_st * profile = calloc(1, sizeof *profile);
+
+    if (profile == NULL)
+    {
+        goto done;
+    }
+
+    profile->ubus_ctx = ubus_ctx;
+    profile->signal_fd.fd = -1;
+
+    if (!parse_profile_config(profile, config_section))
+    {
+        EPRINTF("Invalid profile configuration\n");
+        free(profile);
+        profile = NULL;
+        goto done;
+    }
+
+    profile->stalls = calloc(profile->history, sizeof *profile->stalls);
+    if (profile->stalls == NULL)
+    {
+        free(profile);
+        profile = NULL;
+        goto done;
+    }
+
+    profile->ubus_object.name = loop_profile_ubus_name;
+    profile->ubus_object.type = &loop_profile_object_type;
+    profile->ubus_object.methods = loop_profile_methods;
+    profile->ubus_object.n_methods = ARRAY_SIZE(loop_profile_methods);
+
+    if (ubus_add_object(ubus_ctx, &profile->ubus_object) != 0)
+    {
+        EPRINTF("Failed to add ubus object: %s\n", loop_profile_ubus_name);
+        free(profile->stalls);
+        free(profile);
+        profile = NULL;
+        goto done;
+    }
+
+    /* Profiling is still useful through ubus without the signal. */
+    if (profile->dump_on_signal && !listen_for_dump_signal(profile))
+    {
+        WPRINTF("Failed to listen for SIGUSR1\n");
+    }
+
+    active_profile = profile;
+
+done:
+    return profile;
+}
+
+void loop_profile_done(loop_profile_st * const profile)
+{
+    if (profile == NULL)
+    {
+        goto done;
+    }
+
+    active_profile = NULL;
+    if (profile->signal_fd.fd >= 0)
+    {
+        sigaction(SIGUSR1, &profile->previous_action, NULL);
+        dump_event_fd = -1;
+        uloop_fd_delete(&profile->signal_fd);
+        close(profile->signal_fd.fd);
+    }
+    ubus_remove_object(profile->ubus_ctx, &profile->ubus_object);
+    free(profile->stalls);
+    free(profile);
+
+done:
+    return;
+}
@@ -0,0 +1,55 @@
+#ifndef __LOOP_PROFILE_H__
+#define __LOOP_PROFILE_H__
+
+#include <libubus.h>
+
+#include <stdint.h>
+
+/* Self-profiling of the event loop, to find what holds it up when the
+ * daemon is slow to respond. Each uloop callback is timed, and any that
+ * runs for longer than the threshold is recorded as a stall along with
+ * which handler it was. The results are available from piface.profile,
+ * and are logged on SIGUSR1 if dump_on_signal is set.
+ * Configured by a section of the form:
+ *   {"threshold_ms":100,"history":32,"dump_on_signal":true}
+ * where history is the number of most recent stalls kept.
+ * The handlers are spread across modules that have no other link to the
+ * profile, so, like uloop itself, there is only one.
+ */
+typedef enum loop_profile_handler_t
+{
+    loop_profile_handler_ubus,
+    loop_profile_handler_ubus_reconnect,
+    loop_profile_handler_gpio_interrupt,
+    loop_profile_handler_hw_events,
+    loop_profile_handler_socket_accept,
+    loop_profile_handler_socket_client,
+    loop_profile_handler_request_lanes,
+    loop_profile_handler_sequence_timer,
+    loop_profile_handler_pwm_timer,
+    loop_profile_handler_journal_flush,
+    loop_profile_handler_meters_checkpoint,
+    loop_profile_handler_wait_timeout,
+    loop_profile_handler_gesture_timer,
+    __loop_profile_handler_max
+} loop_profile_handler_t;
+
+typedef struct loop_profile_st loop_profile_st;
+
+/* Returns NULL if the configuration is invalid. */
+loop_profile_st * loop_profile_create(
+    struct ubus_context * const ubus_ctx,
+    struct blob_attr * const config_section);
+
+void loop_profile_done(loop_profile_st * const profile);
+
+/* Called at the start of a callback. Returns the start time to pass to
+ * loop_profile_end(), or 0 while there is no profile.
+ */
+uint64_t loop_profile_begin(void);
+
+void loop_profile_end(
+    loop_profile_handler_t const handler,
+    uint64_t const start_usecs);
+
+#endif /* __LOOP_PROFILE_H__ */
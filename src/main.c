@@ -1,9 +1,10 @@
+#include "config.h"
 #include "daemonize.h"
 #include "debug.h"
+#include "log.h"
+#include "piface_hw.h"
 #include "ubus_server.h"
 
-#include <pifacedigital.h>
-
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -20,6 +21,10 @@ static void usage(char const * const program_name)
     fprintf(stdout, "  -s %-21s %s\n", "ubus socket", "Ubus socket path");
     fprintf(stdout, "  -h %-21s %s\n", "", "PiFace SPI address");
     fprintf(stdout, "  -d %-21s %s\n", "", "Send state change notifications");
+    fprintf(stdout, "  -c %-21s %s\n", "config file", "Configuration file");
+    fprintf(stdout, "  -t %-21s %s\n", "", "Use a dedicated hardware I/O thread");
+    fprintf(stdout, "  -l %-21s %s\n", "log level", "Log level (err, warning, info, debug)");
+    fprintf(stdout, "  -S %-21s %s\n", "register file", "Use the PiFace simulator instead of the hardware");
 }
 
 int main(int argc, char * * argv)
@@ -31,8 +36,16 @@ int main(int argc, char * * argv)
     char const * ubus_socket_name = NULL;
     int hw_addr = 0;
     bool send_state_change_notifications = false;
+    bool use_hw_thread = false;
+    char const * config_filename = NULL;
+    config_st * config = NULL;
+    char const * log_level_name = NULL;
+    piface_hw_options_st hw_options =
+    {
+        .spi_speed_hz = PIFACE_HW_DEFAULT_SPI_SPEED_HZ
+    };
 
-    while ((option = getopt(argc, argv, "h:s:?dn")) != -1)
+    while ((option = getopt(argc, argv, "h:s:c:l:S:?dnt")) != -1)
     {
         switch (option)
         {
@@ -40,14 +53,26 @@ int main(int argc, char * * argv)
                 daemonise = true;
                 break;
             case 's':
-                ubus_socket_name = argv[optind];
+                ubus_socket_name = optarg;
                 break;
             case 'h':
-                hw_addr = atoi(argv[optind]);
+                hw_addr = atoi(optarg);
                 break;
             case 'n':
                 send_state_change_notifications = true;
                 break;
+            case 't':
+                use_hw_thread = true;
+                break;
+            case 'c':
+                config_filename = optarg;
+                break;
+            case 'l':
+                log_level_name = optarg;
+                break;
+            case 'S':
+                hw_options.simulator_path = optarg;
+                break;
             case '?':
                 usage(basename(argv[0]));
                 exit_code = EXIT_SUCCESS;
@@ -72,18 +97,58 @@ int main(int argc, char * * argv)
         }
     }
 
-    if (pifacedigital_open(hw_addr) < 0)
+    config = config_load(config_filename);
+    if (config == NULL)
+    {
+        fprintf(stderr, "Failed to load configuration\n");
+        exit_code = EXIT_FAILURE;
+        goto done;
+    }
+
+    if (log_level_name == NULL)
+    {
+        log_level_name = config_get_string(config, "log_level");
+    }
+    if (log_level_name != NULL)
+    {
+        int const log_level = log_level_from_string(log_level_name);
+
+        if (log_level < 0)
+        {
+            fprintf(stderr, "Unknown log level: %s\n", log_level_name);
+            exit_code = EXIT_FAILURE;
+            goto done;
+        }
+        log_set_level(log_level);
+    }
+
+    /* The logging thread must be started after daemonising, as threads
+     * don't survive fork(). Anything logged before now is still queued.
+     */
+    if (!log_init(basename(argv[0]), config_get_string(config, "log_file"), daemonise))
+    {
+        fprintf(stderr, "Failed to initialise logging\n");
+        exit_code = EXIT_FAILURE;
+        goto done;
+    }
+
+    hw_options.spi_device = config_get_string(config, "spi_device");
+    config_get_u32(config, "spi_speed_hz", &hw_options.spi_speed_hz);
+
+    if (!piface_hw_open(hw_addr, &hw_options))
     {
-        fprintf(stderr, "Failed to open connection to piface module\n");
+        EPRINTF("Failed to open connection to piface module\n");
         exit_code = EXIT_FAILURE;
         goto done;
     }
 
     if (run_ubus_server(hw_addr, 
                         ubus_socket_name,
-                        send_state_change_notifications) < 0)
+                        send_state_change_notifications,
+                        use_hw_thread,
+                        config) < 0)
     {
-        fprintf(stderr, "Error running UBUS server\n");
+        EPRINTF("Error running UBUS server\n");
         exit_code = EXIT_FAILURE;
         goto done;
     }
@@ -91,7 +156,9 @@ int main(int argc, char * * argv)
     exit_code = EXIT_SUCCESS;
 
 done:
-    pifacedigital_close(hw_addr);
+    piface_hw_close(hw_addr);
+    config_free(config);
+    log_done();
 
     exit(exit_code);
 }
@@ -0,0 +1,232 @@
+#include "mcp23s17_spidev.h"
+#include "debug.h"
+
+#include <mcp23s17.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+
+#define MCP23S17_SPIDEV_BITS_PER_WORD 8
+/* The opcode is 0100 A2 A1 A0 R/W. */
+#define MCP23S17_OPCODE_BASE 0x40
+#define MCP23S17_HEADER_LENGTH 2
+
+struct mcp23s17_spidev_st
+{
+    int fd;
+    uint32_t speed_hz;
+    uint8_t hw_addr;
+};
+
+static uint8_t
+control_byte(
+    mcp23s17_spidev_st const * const dev,
+    bool const write)
+{
+    return MCP23S17_OPCODE_BASE
+           | ((dev->hw_addr & 0x07) << 1)
+           | (write ? WRITE_CMD : READ_CMD);
+}
+
+bool mcp23s17_spidev_transfer(
+    mcp23s17_spidev_st * const dev,
+    mcp23s17_spidev_op_st const * const ops,
+    size_t const num_ops)
+{
+    uint8_t tx[MCP23S17_SPIDEV_MAX_OPS][MCP23S17_HEADER_LENGTH + MCP23S17_SPIDEV_MAX_RUN];
+    uint8_t rx[MCP23S17_SPIDEV_MAX_OPS][MCP23S17_HEADER_LENGTH + MCP23S17_SPIDEV_MAX_RUN];
+    struct spi_ioc_transfer transfers[MCP23S17_SPIDEV_MAX_OPS];
+    bool transferred;
+
+    if (num_ops == 0 || num_ops > MCP23S17_SPIDEV_MAX_OPS)
+    {
+        transferred = false;
+        goto done;
+    }
+
+    memset(transfers, 0, sizeof transfers);
+
+    for (size_t i = 0; i < num_ops; i++)
+    {
+        mcp23s17_spidev_op_st const * const op = &ops[i];
+
+        if (op->count == 0 || op->count > MCP23S17_SPIDEV_MAX_RUN)
+        {
+            transferred = false;
+            goto done;
+        }
+
+        tx[i][0] = control_byte(dev, op->write);
+        tx[i][1] = op->first_reg;
+        if (op->write)
+        {
+            memcpy(&tx[i][MCP23S17_HEADER_LENGTH], op->values, op->count);
+        }
+        else
+        {
+            memset(&tx[i][MCP23S17_HEADER_LENGTH], 0, op->count);
+        }
+
+        transfers[i].tx_buf = (uintptr_t)tx[i];
+        transfers[i].rx_buf = (uintptr_t)rx[i];
+        transfers[i].len = MCP23S17_HEADER_LENGTH + op->count;
+        transfers[i].speed_hz = dev->speed_hz;
+        transfers[i].bits_per_word = MCP23S17_SPIDEV_BITS_PER_WORD;
+        /* Each operation is a separate command, so the chip must be
+         * deselected in between. The last one deselects anyway.
+         */
+        transfers[i].cs_change = i + 1 < num_ops;
+    }
+
+    if (ioctl(dev->fd, SPI_IOC_MESSAGE(num_ops), transfers) < 0)
+    {
+        EPRINTF("SPI transfer failed\n");
+        transferred = false;
+        goto done;
+    }
+
+    for (size_t i = 0; i < num_ops; i++)
+    {
+        if (!ops[i].write)
+        {
+            memcpy(ops[i].values, &rx[i][MCP23S17_HEADER_LENGTH], ops[i].count);
+        }
+    }
+
+    transferred = true;
+
+done:
+    return transferred;
+}
+
+uint8_t mcp23s17_spidev_read_reg(
+    mcp23s17_spidev_st * const dev,
+    uint8_t const reg)
+{
+    uint8_t value = 0;
+    mcp23s17_spidev_op_st const op =
+    {
+        .write = false,
+        .first_reg = reg,
+        .values = &value,
+        .count = 1
+    };
+
+    mcp23s17_spidev_transfer(dev, &op, 1);
+
+    return value;
+}
+
+void mcp23s17_spidev_write_reg(
+    mcp23s17_spidev_st * const dev,
+    uint8_t const value,
+    uint8_t const reg)
+{
+    uint8_t data = value;
+    mcp23s17_spidev_op_st const op =
+    {
+        .write = true,
+        .first_reg = reg,
+        .values = &data,
+        .count = 1
+    };
+
+    mcp23s17_spidev_transfer(dev, &op, 1);
+}
+
+static bool
+configure_device(mcp23s17_spidev_st * const dev)
+{
+    uint8_t mode = SPI_MODE_0;
+    uint8_t bits_per_word = MCP23S17_SPIDEV_BITS_PER_WORD;
+
+    return ioctl(dev->fd, SPI_IOC_WR_MODE, &mode) >= 0
+           && ioctl(dev->fd, SPI_IOC_WR_BITS_PER_WORD, &bits_per_word) >= 0
+           && ioctl(dev->fd, SPI_IOC_WR_MAX_SPEED_HZ, &dev->speed_hz) >= 0;
+}
+
+static bool
+configure_chip(mcp23s17_spidev_st * const dev)
+{
+    /* Sequential operation stays enabled (SEQOP_ON), unlike with
+     * libpifacedigital, so that runs of registers can be transferred
+     * at once.
+     */
+    uint8_t ioconfig =
+        BANK_OFF | INT_MIRROR_OFF | SEQOP_ON | DISSLW_OFF | HAEN_ON | ODR_OFF | INTPOL_LOW;
+    uint8_t outputs_off = 0;
+    uint8_t directions[] = { 0x00, 0xff }; /* IODIRA, IODIRB */
+    uint8_t pull_ups = 0xff;
+    mcp23s17_spidev_op_st const ops[] =
+    {
+        { .write = true, .first_reg = IOCON, .values = &ioconfig, .count = 1 },
+        { .write = true, .first_reg = GPIOA, .values = &outputs_off, .count = 1 },
+        { .write = true, .first_reg = IODIRA, .values = directions, .count = sizeof directions },
+        { .write = true, .first_reg = GPPUB, .values = &pull_ups, .count = 1 }
+    };
+
+    return mcp23s17_spidev_transfer(dev, ops, sizeof ops / sizeof ops[0]);
+}
+
+mcp23s17_spidev_st * mcp23s17_spidev_open(
+    char const * const device,
+    uint32_t const speed_hz,
+    uint8_t const hw_addr)
+{
+    mcp23s17_spidev_st * dev = calloc(1, sizeof *dev);
+
+    if (dev == NULL)
+    {
+        goto done;
+    }
+
+    dev->speed_hz = speed_hz;
+    dev->hw_addr = hw_addr;
+    dev->fd = open(device, O_RDWR | O_CLOEXEC);
+    if (dev->fd < 0)
+    {
+        EPRINTF("Failed to open SPI device: %s\n", device);
+        goto error;
+    }
+
+    if (!configure_device(dev))
+    {
+        EPRINTF("Failed to configure SPI device: %s\n", device);
+        goto error;
+    }
+
+    if (!configure_chip(dev))
+    {
+        goto error;
+    }
+
+    goto done;
+
+error:
+    mcp23s17_spidev_close(dev);
+    dev = NULL;
+
+done:
+    return dev;
+}
+
+void mcp23s17_spidev_close(mcp23s17_spidev_st * const dev)
+{
+    if (dev == NULL)
+    {
+        goto done;
+    }
+
+    if (dev->fd >= 0)
+    {
+        close(dev->fd);
+    }
+    free(dev);
+
+done:
+    return;
+}
@@ -0,0 +1,54 @@
+#ifndef __MCP23S17_SPIDEV_H__
+#define __MCP23S17_SPIDEV_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Direct access to an MCP23S17 through /dev/spidevX.Y.
+ * The device is put in sequential address mode, so a run of registers
+ * is read or written in one transfer, and a list of operations is
+ * carried out in one SPI_IOC_MESSAGE ioctl.
+ */
+#define MCP23S17_SPIDEV_MAX_OPS 8
+#define MCP23S17_SPIDEV_MAX_RUN 22 /* The number of registers in bank 0 mode. */
+
+typedef struct mcp23s17_spidev_st mcp23s17_spidev_st;
+
+typedef struct mcp23s17_spidev_op_st
+{
+    bool write;
+    uint8_t first_reg;
+    /* Written from, or read into. */
+    uint8_t * values;
+    size_t count;
+} mcp23s17_spidev_op_st;
+
+/* Open the device and configure the chip for the PiFace: port A
+ * outputs, all off, and port B inputs with pull ups.
+ */
+mcp23s17_spidev_st * mcp23s17_spidev_open(
+    char const * const device,
+    uint32_t const speed_hz,
+    uint8_t const hw_addr);
+
+void mcp23s17_spidev_close(mcp23s17_spidev_st * const dev);
+
+/* Carry out up to MCP23S17_SPIDEV_MAX_OPS operations, each on up to
+ * MCP23S17_SPIDEV_MAX_RUN consecutive registers, in one kernel call.
+ */
+bool mcp23s17_spidev_transfer(
+    mcp23s17_spidev_st * const dev,
+    mcp23s17_spidev_op_st const * const ops,
+    size_t const num_ops);
+
+uint8_t mcp23s17_spidev_read_reg(
+    mcp23s17_spidev_st * const dev,
+    uint8_t const reg);
+
+void mcp23s17_spidev_write_reg(
+    mcp23s17_spidev_st * const dev,
+    uint8_t const value,
+    uint8_t const reg);
+
+#endif /* __MCP23S17_SPIDEV_H__ */
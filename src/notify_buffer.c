@@ -0,0 +1,92 @@
+#include "notify_buffer.h"
+
+#include <stdlib.h>
+
+/* A FIFO of input states waiting to be notified. 
+ * A state that is the same as the most recently buffered state is 
+ * dropped, and once the buffer is full the most recent entry is 
+ * overwritten. This loses some intermediate states, but the last state 
+ * notified is always the latest state. 
+ */
+struct notify_buffer_st
+{
+    size_t capacity;
+    size_t head;
+    size_t count;
+    uint32_t states[];
+};
+
+notify_buffer_st * notify_buffer_create(size_t const capacity)
+{
+    notify_buffer_st * buffer = NULL;
+
+    if (capacity == 0)
+    {
+        goto done;
+    }
+
+    buffer = calloc(1, sizeof *buffer + capacity * sizeof buffer->states[0]);
+    if (buffer == NULL)
+    {
+        goto done;
+    }
+
+    buffer->capacity = capacity;
+
+done:
+    return buffer;
+}
+
+void notify_buffer_free(notify_buffer_st * const buffer)
+{
+    free(buffer);
+}
+
+void notify_buffer_add(
+    notify_buffer_st * const buffer,
+    uint32_t const states)
+{
+    if (buffer->count > 0)
+    {
+        size_t const newest = 
+            (buffer->head + buffer->count - 1) % buffer->capacity;
+
+        if (buffer->states[newest] == states)
+        {
+            goto done;
+        }
+
+        if (buffer->count == buffer->capacity)
+        {
+            buffer->states[newest] = states;
+            goto done;
+        }
+    }
+
+    buffer->states[(buffer->head + buffer->count) % buffer->capacity] = states;
+    buffer->count++;
+
+done:
+    return;
+}
+
+bool notify_buffer_remove(
+    notify_buffer_st * const buffer,
+    uint32_t * const states)
+{
+    bool removed;
+
+    if (buffer->count == 0)
+    {
+        removed = false;
+        goto done;
+    }
+
+    *states = buffer->states[buffer->head];
+    buffer->head = (buffer->head + 1) % buffer->capacity;
+    buffer->count--;
+    removed = true;
+
+done:
+    return removed;
+}
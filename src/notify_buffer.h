@@ -0,0 +1,22 @@
+#ifndef __NOTIFY_BUFFER_H__
+#define __NOTIFY_BUFFER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct notify_buffer_st notify_buffer_st;
+
+notify_buffer_st * notify_buffer_create(size_t const capacity);
+
+void notify_buffer_free(notify_buffer_st * const buffer);
+
+void notify_buffer_add(
+    notify_buffer_st * const buffer,
+    uint32_t const states);
+
+bool notify_buffer_remove(
+    notify_buffer_st * const buffer,
+    uint32_t * const states);
+
+#endif /* __NOTIFY_BUFFER_H__ */
@@ -0,0 +1,165 @@
+#include "output_cas.h"
+#include "debug.h"
+
+#include <libubox/blobmsg.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BIT(x) (1UL << (x))
+
+struct output_cas_ctx_st
+{
+    struct ubus_object ubus_object;
+    struct ubus_context * ubus_ctx;
+    output_cas_write_fn write_cb;
+    output_cas_read_fn read_cb;
+    void * callback_ctx;
+    uint32_t valid_mask;
+};
+
+static char const output_cas_ubus_name[] = "piface.outputs";
+
+enum
+{
+    CAS_EXPECTED_MASK,
+    CAS_EXPECTED,
+    CAS_MASK,
+    CAS_VALUES,
+    __CAS_MAX
+};
+
+static struct blobmsg_policy const cas_policy[__CAS_MAX] =
+{
+    [CAS_EXPECTED_MASK] = { .name = "expected_mask", .type = BLOBMSG_TYPE_INT32 },
+    [CAS_EXPECTED] = { .name = "expected", .type = BLOBMSG_TYPE_INT32 },
+    [CAS_MASK] = { .name = "mask", .type = BLOBMSG_TYPE_INT32 },
+    [CAS_VALUES] = { .name = "values", .type = BLOBMSG_TYPE_INT32 }
+};
+
+static int
+compare_and_set_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    output_cas_ctx_st * const ctx = container_of(obj, output_cas_ctx_st, ubus_object);
+    struct blob_attr * tb[__CAS_MAX];
+    struct blob_buf buf;
+    int result;
+
+    blobmsg_parse(cas_policy, __CAS_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (tb[CAS_EXPECTED_MASK] == NULL
+        || tb[CAS_EXPECTED] == NULL
+        || tb[CAS_MASK] == NULL
+        || tb[CAS_VALUES] == NULL)
+    {
+        result = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    uint32_t const expected_mask = blobmsg_get_u32(tb[CAS_EXPECTED_MASK]);
+    uint32_t const expected = blobmsg_get_u32(tb[CAS_EXPECTED]);
+    uint32_t const write_mask = blobmsg_get_u32(tb[CAS_MASK]);
+    uint32_t const values = blobmsg_get_u32(tb[CAS_VALUES]);
+
+    if ((expected_mask & ~ctx->valid_mask) != 0 || (write_mask & ~ctx->valid_mask) != 0)
+    {
+        result = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    /* Handlers run to completion on the event loop, and every output
+     * write is made from it, so nothing can change the outputs between
+     * the compare and the write.
+     */
+    uint32_t states = ctx->read_cb(ctx->callback_ctx);
+    bool const matched = (states & expected_mask) == (expected & expected_mask);
+
+    if (matched && write_mask != 0)
+    {
+        if (!ctx->write_cb(ctx->callback_ctx, write_mask, values))
+        {
+            result = UBUS_STATUS_UNKNOWN_ERROR;
+            goto done;
+        }
+        states = ctx->read_cb(ctx->callback_ctx);
+    }
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    blobmsg_add_bool(&buf, "success", matched);
+    blobmsg_add_u32(&buf, "states", states & ctx->valid_mask);
+
+    ubus_send_reply(ubus_ctx, req, buf.head);
+    blob_buf_free(&buf);
+
+    result = UBUS_STATUS_OK;
+
+done:
+    return result;
+}
+
+static struct ubus_method const output_cas_methods[] =
+{
+    UBUS_METHOD("compare_and_set", compare_and_set_handler, cas_policy)
+};
+
+static struct ubus_object_type output_cas_object_type =
+    UBUS_OBJECT_TYPE(output_cas_ubus_name, output_cas_methods);
+
+output_cas_ctx_st * output_cas_initialise(
+    struct ubus_context * const ubus_ctx,
+    size_t const num_outputs,
+    output_cas_write_fn const write_cb,
+    output_cas_read_fn const read_cb,
+    void * const callback_ctx)
+{
+    output_cas_ctx_st * ctx = calloc(1, sizeof *ctx);
+
+    if (ctx == NULL)
+    {
+        goto done;
+    }
+
+    ctx->ubus_ctx = ubus_ctx;
+    ctx->write_cb = write_cb;
+    ctx->read_cb = read_cb;
+    ctx->callback_ctx = callback_ctx;
+    ctx->valid_mask = num_outputs >= 32 ? UINT32_MAX : BIT(num_outputs) - 1;
+
+    ctx->ubus_object.name = output_cas_ubus_name;
+    ctx->ubus_object.type = &output_cas_object_type;
+    ctx->ubus_object.methods = output_cas_methods;
+    ctx->ubus_object.n_methods = ARRAY_SIZE(output_cas_methods);
+
+    if (ubus_add_object(ubus_ctx, &ctx->ubus_object) != 0)
+    {
+        EPRINTF("Failed to add ubus object: %s\n", output_cas_ubus_name);
+        free(ctx);
+        ctx = NULL;
+        goto done;
+    }
+
+done:
+    return ctx;
+}
+
+void output_cas_done(output_cas_ctx_st * const ctx)
+{
+    if (ctx == NULL)
+    {
+        goto done;
+    }
+
+    ubus_remove_object(ctx->ubus_ctx, &ctx->ubus_object);
+    free(ctx);
+
+done:
+    return;
+}
@@ -0,0 +1,39 @@
+#ifndef __OUTPUT_CAS_H__
+#define __OUTPUT_CAS_H__
+
+#include <libubus.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Compare-and-set of the outputs, so that clients sharing outputs can
+ * coordinate without a separate get and set:
+ *   {"expected_mask":3,"expected":1,"mask":4,"values":4}
+ * The write is only applied if the outputs under expected_mask match
+ * expected. The reply holds whether it was applied and the output states
+ * that the decision was made against, or that the write left.
+ */
+typedef struct output_cas_ctx_st output_cas_ctx_st;
+
+/* Returns false if the write couldn't be made. */
+typedef bool (*output_cas_write_fn)(
+    void * const callback_ctx,
+    uint32_t const write_mask,
+    uint32_t const values);
+
+/* Returns the output states as last written by the daemon, including
+ * any writes still queued to the hardware.
+ */
+typedef uint32_t (*output_cas_read_fn)(void * const callback_ctx);
+
+output_cas_ctx_st * output_cas_initialise(
+    struct ubus_context * const ubus_ctx,
+    size_t const num_outputs,
+    output_cas_write_fn const write_cb,
+    output_cas_read_fn const read_cb,
+    void * const callback_ctx);
+
+void output_cas_done(output_cas_ctx_st * const ctx);
+
+#endif /* __OUTPUT_CAS_H__ */
@@ -0,0 +1,478 @@
+#include "output_sequence.h"
+#include "loop_profile.h"
+#include "debug.h"
+
+#include <libubox/blobmsg.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#define OUTPUT_SEQUENCE_MAX_STEPS 1024
+#define NSECS_PER_SEC 1000000000L
+#define NSECS_PER_USEC 1000L
+/* Steps that run later than this are counted as late. */
+#define LATE_STEP_THRESHOLD_USECS 1000
+
+typedef struct sequence_step_st
+{
+    uint32_t write_mask;
+    uint32_t values;
+    uint32_t delay_usecs;
+} sequence_step_st;
+
+struct output_sequence_ctx_st
+{
+    struct ubus_object ubus_object;
+    struct ubus_context * ubus_ctx;
+    struct uloop_fd timer_fd;
+    uint32_t valid_outputs_mask;
+    output_sequence_write_fn write_cb;
+    void * write_ctx;
+
+    bool running;
+    sequence_step_st * steps;
+    size_t num_steps;
+    size_t current_step;
+    /* The number of times to play the sequence. 0 repeats forever. */
+    uint32_t repeat_count;
+    uint32_t iteration;
+    /* Steps are scheduled relative to the previous step's deadline
+     * rather than when it actually ran, so lateness doesn't accumulate.
+     */
+    struct timespec next_deadline;
+    uint64_t late_steps;
+    uint32_t max_lateness_usecs;
+};
+
+static char const output_sequence_ubus_name[] = "piface.sequence";
+
+enum
+{
+    SEQUENCE_START_STEPS,
+    SEQUENCE_START_REPEAT,
+    __SEQUENCE_START_MAX
+};
+
+static struct blobmsg_policy const sequence_start_policy[__SEQUENCE_START_MAX] =
+{
+    [SEQUENCE_START_STEPS] = { .name = "steps", .type = BLOBMSG_TYPE_ARRAY },
+    [SEQUENCE_START_REPEAT] = { .name = "repeat", .type = BLOBMSG_TYPE_INT32 }
+};
+
+enum
+{
+    SEQUENCE_STEP_MASK,
+    SEQUENCE_STEP_VALUES,
+    SEQUENCE_STEP_DELAY,
+    __SEQUENCE_STEP_MAX
+};
+
+static struct blobmsg_policy const sequence_step_policy[__SEQUENCE_STEP_MAX] =
+{
+    [SEQUENCE_STEP_MASK] = { .name = "mask", .type = BLOBMSG_TYPE_INT32 },
+    [SEQUENCE_STEP_VALUES] = { .name = "values", .type = BLOBMSG_TYPE_INT32 },
+    [SEQUENCE_STEP_DELAY] = { .name = "delay_us", .type = BLOBMSG_TYPE_INT32 }
+};
+
+static void
+timespec_add_usecs(struct timespec * const ts, uint32_t const usecs)
+{
+    ts->tv_sec += usecs / 1000000;
+    ts->tv_nsec += (long)(usecs % 1000000) * NSECS_PER_USEC;
+    if (ts->tv_nsec >= NSECS_PER_SEC)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= NSECS_PER_SEC;
+    }
+}
+
+static void
+arm_timer(output_sequence_ctx_st * const ctx)
+{
+    struct itimerspec const timer_spec =
+    {
+        .it_value = ctx->next_deadline
+    };
+
+    timerfd_settime(ctx->timer_fd.fd, TFD_TIMER_ABSTIME, &timer_spec, NULL);
+}
+
+static void
+disarm_timer(output_sequence_ctx_st * const ctx)
+{
+    struct itimerspec const timer_spec = { { 0, 0 }, { 0, 0 } };
+
+    timerfd_settime(ctx->timer_fd.fd, 0, &timer_spec, NULL);
+}
+
+static void
+sequence_stop(output_sequence_ctx_st * const ctx)
+{
+    disarm_timer(ctx);
+    ctx->running = false;
+    free(ctx->steps);
+    ctx->steps = NULL;
+    ctx->num_steps = 0;
+}
+
+/* Write the current step's outputs and schedule the next step. */
+static void
+sequence_run_step(output_sequence_ctx_st * const ctx)
+{
+    sequence_step_st const * const step = &ctx->steps[ctx->current_step];
+
+    /* Steps can be left with no outputs once others are released. */
+    if (step->write_mask != 0)
+    {
+        ctx->write_cb(ctx->write_ctx, step->write_mask, step->values);
+    }
+    timespec_add_usecs(&ctx->next_deadline, step->delay_usecs);
+
+    ctx->current_step++;
+    if (ctx->current_step == ctx->num_steps)
+    {
+        ctx->current_step = 0;
+        ctx->iteration++;
+        if (ctx->repeat_count != 0 && ctx->iteration >= ctx->repeat_count)
+        {
+            /* The final step's outputs are left as they are. */
+            sequence_stop(ctx);
+            goto done;
+        }
+    }
+
+    arm_timer(ctx);
+
+done:
+    return;
+}
+
+static void
+sequence_timer_handler(struct uloop_fd * u, unsigned int events)
+{
+    output_sequence_ctx_st * const ctx =
+        container_of(u, output_sequence_ctx_st, timer_fd);
+    uint64_t const profile_start = loop_profile_begin();
+    uint64_t expirations;
+    struct timespec now;
+    (void)events;
+
+    if (read(ctx->timer_fd.fd, &expirations, sizeof expirations) != sizeof expirations)
+    {
+        goto done;
+    }
+
+    if (!ctx->running)
+    {
+        goto done;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int64_t const lateness_usecs =
+        ((int64_t)(now.tv_sec - ctx->next_deadline.tv_sec) * NSECS_PER_SEC
+         + (now.tv_nsec - ctx->next_deadline.tv_nsec)) / NSECS_PER_USEC;
+
+    if (lateness_usecs > LATE_STEP_THRESHOLD_USECS)
+    {
+        ctx->late_steps++;
+    }
+    if (lateness_usecs > ctx->max_lateness_usecs)
+    {
+        ctx->max_lateness_usecs = lateness_usecs;
+    }
+
+    sequence_run_step(ctx);
+
+done:
+    loop_profile_end(loop_profile_handler_sequence_timer, profile_start);
+}
+
+static bool
+parse_steps(
+    output_sequence_ctx_st const * const ctx,
+    struct blob_attr * const steps_attr,
+    sequence_step_st * * const steps_out,
+    size_t * const num_steps_out)
+{
+    bool parsed;
+    int const num_steps = blobmsg_check_array(steps_attr, BLOBMSG_TYPE_TABLE);
+    sequence_step_st * steps = NULL;
+    struct blob_attr * cur;
+    size_t index = 0;
+    int rem;
+
+    if (num_steps <= 0 || num_steps > OUTPUT_SEQUENCE_MAX_STEPS)
+    {
+        parsed = false;
+        goto done;
+    }
+
+    steps = calloc(num_steps, sizeof *steps);
+    if (steps == NULL)
+    {
+        parsed = false;
+        goto done;
+    }
+
+    blobmsg_for_each_attr(cur, steps_attr, rem)
+    {
+        struct blob_attr * tb[__SEQUENCE_STEP_MAX];
+
+        blobmsg_parse(sequence_step_policy, __SEQUENCE_STEP_MAX, tb,
+                      blobmsg_data(cur), blobmsg_data_len(cur));
+
+        if (tb[SEQUENCE_STEP_MASK] == NULL
+            || tb[SEQUENCE_STEP_VALUES] == NULL
+            || tb[SEQUENCE_STEP_DELAY] == NULL)
+        {
+            parsed = false;
+            goto done;
+        }
+
+        sequence_step_st * const step = &steps[index];
+
+        step->write_mask =
+            blobmsg_get_u32(tb[SEQUENCE_STEP_MASK]) & ctx->valid_outputs_mask;
+        step->values = blobmsg_get_u32(tb[SEQUENCE_STEP_VALUES]) & step->write_mask;
+        step->delay_usecs = blobmsg_get_u32(tb[SEQUENCE_STEP_DELAY]);
+        index++;
+    }
+
+    parsed = true;
+
+done:
+    if (parsed)
+    {
+        *steps_out = steps;
+        *num_steps_out = num_steps;
+    }
+    else
+    {
+        free(steps);
+    }
+
+    return parsed;
+}
+
+static int
+sequence_start_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    output_sequence_ctx_st * const ctx =
+        container_of(obj, output_sequence_ctx_st, ubus_object);
+    struct blob_attr * tb[__SEQUENCE_START_MAX];
+    sequence_step_st * steps;
+    size_t num_steps;
+    uint32_t repeat_count;
+    uint64_t total_delay_usecs = 0;
+    int result;
+
+    blobmsg_parse(sequence_start_policy, __SEQUENCE_START_MAX, tb,
+                  blob_data(msg), blob_len(msg));
+
+    if (tb[SEQUENCE_START_STEPS] == NULL
+        || !parse_steps(ctx, tb[SEQUENCE_START_STEPS], &steps, &num_steps))
+    {
+        result = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    repeat_count =
+        tb[SEQUENCE_START_REPEAT] != NULL ? blobmsg_get_u32(tb[SEQUENCE_START_REPEAT]) : 1;
+
+    for (size_t i = 0; i < num_steps; i++)
+    {
+        total_delay_usecs += steps[i].delay_usecs;
+    }
+
+    /* Don't allow a sequence that would write the outputs as fast as 
+     * possible forever. 
+     */
+    if (repeat_count == 0 && total_delay_usecs == 0)
+    {
+        free(steps);
+        result = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    /* Any sequence that is already playing is replaced. */
+    sequence_stop(ctx);
+
+    ctx->steps = steps;
+    ctx->num_steps = num_steps;
+    ctx->current_step = 0;
+    ctx->iteration = 0;
+    ctx->late_steps = 0;
+    ctx->max_lateness_usecs = 0;
+    ctx->repeat_count = repeat_count;
+    ctx->running = true;
+
+    clock_gettime(CLOCK_MONOTONIC, &ctx->next_deadline);
+    sequence_run_step(ctx);
+
+    result = UBUS_STATUS_OK;
+
+done:
+    return result;
+}
+
+static int
+sequence_cancel_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    output_sequence_ctx_st * const ctx =
+        container_of(obj, output_sequence_ctx_st, ubus_object);
+
+    sequence_stop(ctx);
+
+    return UBUS_STATUS_OK;
+}
+
+static int
+sequence_status_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    output_sequence_ctx_st * const ctx =
+        container_of(obj, output_sequence_ctx_st, ubus_object);
+    struct blob_buf buf;
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    blobmsg_add_bool(&buf, "running", ctx->running);
+    if (ctx->running)
+    {
+        blobmsg_add_u32(&buf, "steps", ctx->num_steps);
+        blobmsg_add_u32(&buf, "step", ctx->current_step);
+        blobmsg_add_u32(&buf, "iteration", ctx->iteration);
+        blobmsg_add_u32(&buf, "repeat", ctx->repeat_count);
+    }
+    blobmsg_add_u64(&buf, "late_steps", ctx->late_steps);
+    blobmsg_add_u32(&buf, "max_lateness_us", ctx->max_lateness_usecs);
+
+    ubus_send_reply(ubus_ctx, req, buf.head);
+    blob_buf_free(&buf);
+
+    return UBUS_STATUS_OK;
+}
+
+static struct ubus_method const output_sequence_methods[] =
+{
+    UBUS_METHOD("start", sequence_start_handler, sequence_start_policy),
+    UBUS_METHOD_NOARG("cancel", sequence_cancel_handler),
+    UBUS_METHOD_NOARG("status", sequence_status_handler)
+};
+
+static struct ubus_object_type output_sequence_object_type =
+    UBUS_OBJECT_TYPE(output_sequence_ubus_name, output_sequence_methods);
+
+output_sequence_ctx_st * output_sequence_initialise(
+    struct ubus_context * const ubus_ctx,
+    uint32_t const valid_outputs_mask,
+    output_sequence_write_fn const write_cb,
+    void * const write_ctx)
+{
+    output_sequence_ctx_st * ctx = calloc(1, sizeof *ctx);
+
+    if (ctx == NULL)
+    {
+        goto done;
+    }
+
+    ctx->ubus_ctx = ubus_ctx;
+    ctx->valid_outputs_mask = valid_outputs_mask;
+    ctx->write_cb = write_cb;
+    ctx->write_ctx = write_ctx;
+
+    ctx->timer_fd.fd =
+        timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (ctx->timer_fd.fd < 0)
+    {
+        free(ctx);
+        ctx = NULL;
+        goto done;
+    }
+    ctx->timer_fd.cb = sequence_timer_handler;
+    uloop_fd_add(&ctx->timer_fd, ULOOP_READ);
+
+    ctx->ubus_object.name = output_sequence_ubus_name;
+    ctx->ubus_object.type = &output_sequence_object_type;
+    ctx->ubus_object.methods = output_sequence_methods;
+    ctx->ubus_object.n_methods = ARRAY_SIZE(output_sequence_methods);
+
+    if (ubus_add_object(ubus_ctx, &ctx->ubus_object) != 0)
+    {
+        EPRINTF("Failed to add ubus object: %s\n", output_sequence_ubus_name);
+        uloop_fd_delete(&ctx->timer_fd);
+        close(ctx->timer_fd.fd);
+        free(ctx);
+        ctx = NULL;
+        goto done;
+    }
+
+done:
+    return ctx;
+}
+
+void output_sequence_release(
+    output_sequence_ctx_st * const ctx,
+    uint32_t const output_mask)
+{
+    uint32_t remaining_mask = 0;
+
+    if (!ctx->running)
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < ctx->num_steps; i++)
+    {
+        sequence_step_st * const step = &ctx->steps[i];
+
+        step->write_mask &= ~output_mask;
+        step->values &= ~output_mask;
+        remaining_mask |= step->write_mask;
+    }
+
+    if (remaining_mask == 0)
+    {
+        sequence_stop(ctx);
+    }
+
+done:
+    return;
+}
+
+void output_sequence_done(output_sequence_ctx_st * const ctx)
+{
+    if (ctx == NULL)
+    {
+        goto done;
+    }
+
+    sequence_stop(ctx);
+    ubus_remove_object(ctx->ubus_ctx, &ctx->ubus_object);
+    uloop_fd_delete(&ctx->timer_fd);
+    close(ctx->timer_fd.fd);
+    free(ctx);
+
+done:
+    return;
+}
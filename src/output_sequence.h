@@ -0,0 +1,31 @@
+#ifndef __OUTPUT_SEQUENCE_H__
+#define __OUTPUT_SEQUENCE_H__
+
+#include <libubus.h>
+
+#include <stdint.h>
+
+typedef void (*output_sequence_write_fn)(
+    void * const write_ctx,
+    uint32_t const write_mask,
+    uint32_t const values);
+
+typedef struct output_sequence_ctx_st output_sequence_ctx_st;
+
+output_sequence_ctx_st * output_sequence_initialise(
+    struct ubus_context * const ubus_ctx,
+    uint32_t const valid_outputs_mask,
+    output_sequence_write_fn const write_cb,
+    void * const write_ctx);
+
+void output_sequence_done(output_sequence_ctx_st * const ctx);
+
+/* Stop the running sequence from writing the outputs in output_mask, 
+ * because something else has taken them over. The sequence carries on 
+ * with its other outputs, and is stopped if it has none left. 
+ */
+void output_sequence_release(
+    output_sequence_ctx_st * const ctx,
+    uint32_t const output_mask);
+
+#endif /* __OUTPUT_SEQUENCE_H__ */
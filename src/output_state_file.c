@@ -0,0 +1,213 @@
+#include "output_state_file.h"
+#include "debug.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BIT(x) (1UL << (x))
+
+#define OUTPUT_STATE_FILE_MAGIC 0x50494653 /* "PIFS" */
+#define OUTPUT_STATE_FILE_VERSION 1
+#define OUTPUT_STATE_NUM_OUTPUTS 8
+
+typedef struct output_metadata_st
+{
+    uint64_t last_change_time; /* Seconds since the epoch. */
+    uint32_t write_count;
+    uint32_t change_count;
+} output_metadata_st;
+
+/* The layout of the memory mapped state file. */
+typedef struct output_state_layout_st
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t commanded_mask;
+    uint32_t states;
+    output_metadata_st outputs[OUTPUT_STATE_NUM_OUTPUTS];
+    uint32_t checksum;
+} output_state_layout_st;
+
+struct output_state_file_st
+{
+    int fd;
+    output_state_layout_st * state;
+};
+
+static uint32_t
+calculate_checksum(output_state_layout_st const * const state)
+{
+    /* FNV-1a over everything up to the checksum field. */
+    uint8_t const * const bytes = (uint8_t const *)state;
+    uint32_t hash = 2166136261U;
+
+    for (size_t i = 0; i < offsetof(output_state_layout_st, checksum); i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static bool
+state_is_valid(output_state_layout_st const * const state)
+{
+    return state->magic == OUTPUT_STATE_FILE_MAGIC
+           && state->version == OUTPUT_STATE_FILE_VERSION
+           && state->checksum == calculate_checksum(state);
+}
+
+static void
+state_initialise(output_state_layout_st * const state)
+{
+    memset(state, 0, sizeof *state);
+    state->magic = OUTPUT_STATE_FILE_MAGIC;
+    state->version = OUTPUT_STATE_FILE_VERSION;
+    state->checksum = calculate_checksum(state);
+}
+
+output_state_file_st * output_state_file_open(char const * const path)
+{
+    output_state_file_st * state_file = calloc(1, sizeof *state_file);
+
+    if (state_file == NULL)
+    {
+        goto done;
+    }
+
+    state_file->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (state_file->fd < 0)
+    {
+        EPRINTF("Failed to open output state file: %s\n", path);
+        goto error;
+    }
+
+    if (ftruncate(state_file->fd, sizeof *state_file->state) != 0)
+    {
+        goto error;
+    }
+
+    state_file->state = mmap(NULL,
+                             sizeof *state_file->state,
+                             PROT_READ | PROT_WRITE,
+                             MAP_SHARED,
+                             state_file->fd,
+                             0);
+    if (state_file->state == MAP_FAILED)
+    {
+        state_file->state = NULL;
+        goto error;
+    }
+
+    if (!state_is_valid(state_file->state))
+    {
+        /* Either a new file, or one left half written by a crash.
+         * Either way, there is nothing to restore.
+         */
+        WPRINTF("No valid saved output state in: %s\n", path);
+        state_initialise(state_file->state);
+    }
+
+    goto done;
+
+error:
+    output_state_file_close(state_file);
+    state_file = NULL;
+
+done:
+    return state_file;
+}
+
+void output_state_file_close(output_state_file_st * const state_file)
+{
+    if (state_file == NULL)
+    {
+        goto done;
+    }
+
+    if (state_file->state != NULL)
+    {
+        msync(state_file->state, sizeof *state_file->state, MS_SYNC);
+        munmap(state_file->state, sizeof *state_file->state);
+    }
+    if (state_file->fd >= 0)
+    {
+        close(state_file->fd);
+    }
+    free(state_file);
+
+done:
+    return;
+}
+
+bool output_state_file_get(
+    output_state_file_st const * const state_file,
+    uint32_t * const commanded_mask,
+    uint32_t * const states)
+{
+    bool got_state;
+
+    if (state_file == NULL || state_file->state->commanded_mask == 0)
+    {
+        got_state = false;
+        goto done;
+    }
+
+    *commanded_mask = state_file->state->commanded_mask;
+    *states = state_file->state->states;
+    got_state = true;
+
+done:
+    return got_state;
+}
+
+void output_state_file_update(
+    output_state_file_st * const state_file,
+    uint32_t const write_mask,
+    uint32_t const values)
+{
+    if (state_file == NULL)
+    {
+        goto done;
+    }
+
+    output_state_layout_st * const state = state_file->state;
+    uint32_t const new_states = (state->states & ~write_mask) | (values & write_mask);
+    uint32_t const changed = (state->states ^ new_states) | (write_mask & ~state->commanded_mask);
+    uint64_t const now = time(NULL);
+
+    for (size_t i = 0; i < OUTPUT_STATE_NUM_OUTPUTS; i++)
+    {
+        if ((write_mask & BIT(i)) == 0)
+        {
+            continue;
+        }
+
+        output_metadata_st * const output = &state->outputs[i];
+
+        output->write_count++;
+        if ((changed & BIT(i)) != 0)
+        {
+            output->change_count++;
+            output->last_change_time = now;
+        }
+    }
+
+    state->commanded_mask |= write_mask;
+    state->states = new_states;
+    state->checksum = calculate_checksum(state);
+
+    /* The kernel writes the page back in its own time, which is all
+     * that is required to survive a daemon restart.
+     */
+
+done:
+    return;
+}
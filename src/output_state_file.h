@@ -0,0 +1,27 @@
+#ifndef __OUTPUT_STATE_FILE_H__
+#define __OUTPUT_STATE_FILE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct output_state_file_st output_state_file_st;
+
+output_state_file_st * output_state_file_open(char const * const path);
+
+void output_state_file_close(output_state_file_st * const state_file);
+
+/* Retrieve the last commanded output states.
+ * commanded_mask indicates which outputs have ever been written.
+ * Returns false if there is no valid saved state.
+ */
+bool output_state_file_get(
+    output_state_file_st const * const state_file,
+    uint32_t * const commanded_mask,
+    uint32_t * const states);
+
+void output_state_file_update(
+    output_state_file_st * const state_file,
+    uint32_t const write_mask,
+    uint32_t const values);
+
+#endif /* __OUTPUT_STATE_FILE_H__ */
@@ -0,0 +1,245 @@
+#include "piface_hw.h"
+#include "hw_sim.h"
+#include "mcp23s17_spidev.h"
+
+#include <pifacedigital.h>
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#define GPIO_INTERRUPT_PIN 25
+
+/* When not NULL, the simulator is used instead of the hardware. */
+static hw_sim_st * hw_sim;
+/* When not NULL, the hardware is accessed directly rather than through
+ * libpifacedigital.
+ */
+static mcp23s17_spidev_st * spidev;
+/* The spidev output latch. The daemon is its only writer. */
+static uint8_t spidev_outputs;
+
+bool piface_hw_open(int const hw_addr, piface_hw_options_st const * const options)
+{
+    bool opened;
+
+    if (options->simulator_path != NULL)
+    {
+        hw_sim = hw_sim_open(options->simulator_path);
+        opened = hw_sim != NULL;
+        goto done;
+    }
+
+    if (options->spi_device != NULL)
+    {
+        spidev = mcp23s17_spidev_open(options->spi_device, options->spi_speed_hz, hw_addr);
+        if (spidev == NULL)
+        {
+            opened = false;
+            goto done;
+        }
+        spidev_outputs = mcp23s17_spidev_read_reg(spidev, OUTPUT);
+        opened = true;
+        goto done;
+    }
+
+    opened = pifacedigital_open(hw_addr) >= 0;
+
+done:
+    return opened;
+}
+
+void piface_hw_close(int const hw_addr)
+{
+    if (hw_sim != NULL)
+    {
+        hw_sim_close(hw_sim);
+        hw_sim = NULL;
+        goto done;
+    }
+
+    if (spidev != NULL)
+    {
+        mcp23s17_spidev_close(spidev);
+        spidev = NULL;
+        goto done;
+    }
+
+    pifacedigital_close(hw_addr);
+
+done:
+    return;
+}
+
+uint8_t piface_hw_read_reg(uint8_t const reg, int const hw_addr)
+{
+    uint8_t value;
+
+    if (hw_sim != NULL)
+    {
+        value = hw_sim_read_reg(hw_sim, reg);
+    }
+    else if (spidev != NULL)
+    {
+        value = mcp23s17_spidev_read_reg(spidev, reg);
+    }
+    else
+    {
+        value = pifacedigital_read_reg(reg, hw_addr);
+    }
+
+    return value;
+}
+
+void piface_hw_write_reg(uint8_t const value, uint8_t const reg, int const hw_addr)
+{
+    if (hw_sim != NULL)
+    {
+        hw_sim_write_reg(hw_sim, value, reg);
+    }
+    else if (spidev != NULL)
+    {
+        mcp23s17_spidev_write_reg(spidev, value, reg);
+        if (reg == OUTPUT)
+        {
+            spidev_outputs = value;
+        }
+    }
+    else
+    {
+        pifacedigital_write_reg(value, reg, hw_addr);
+    }
+}
+
+void piface_hw_read_ports(
+    int const hw_addr,
+    uint8_t * const inputs,
+    uint8_t * const outputs)
+{
+    if (spidev != NULL)
+    {
+        /* GPIOA (the outputs) and GPIOB (the inputs) are adjacent. */
+        uint8_t ports[2] = { 0, 0 };
+        mcp23s17_spidev_op_st const op =
+        {
+            .write = false,
+            .first_reg = OUTPUT,
+            .values = ports,
+            .count = sizeof ports
+        };
+
+        mcp23s17_spidev_transfer(spidev, &op, 1);
+        *outputs = ports[0];
+        *inputs = ports[1];
+        goto done;
+    }
+
+    *inputs = piface_hw_read_reg(INPUT, hw_addr);
+    *outputs = piface_hw_read_reg(OUTPUT, hw_addr);
+
+done:
+    return;
+}
+
+void piface_hw_write_outputs(
+    uint8_t const write_mask,
+    uint8_t const values,
+    int const hw_addr)
+{
+    uint8_t states;
+
+    if (spidev != NULL)
+    {
+        states = spidev_outputs;
+    }
+    else
+    {
+        states = piface_hw_read_reg(OUTPUT, hw_addr);
+    }
+
+    /* Leave the pins we don't want to write as they are. */
+    states &= ~write_mask;
+    states |= values & write_mask;
+
+    piface_hw_write_reg(states, OUTPUT, hw_addr);
+}
+
+void piface_hw_write_regs(
+    uint8_t const * const regs,
+    uint8_t const * const values,
+    size_t const count,
+    int const hw_addr)
+{
+    if (spidev != NULL)
+    {
+        for (size_t first = 0; first < count; first += MCP23S17_SPIDEV_MAX_OPS)
+        {
+            uint8_t data[MCP23S17_SPIDEV_MAX_OPS];
+            mcp23s17_spidev_op_st ops[MCP23S17_SPIDEV_MAX_OPS];
+            size_t num_ops = 0;
+
+            for (size_t i = first; i < count && num_ops < MCP23S17_SPIDEV_MAX_OPS; i++)
+            {
+                data[num_ops] = values[i];
+                ops[num_ops].write = true;
+                ops[num_ops].first_reg = regs[i];
+                ops[num_ops].values = &data[num_ops];
+                ops[num_ops].count = 1;
+                if (regs[i] == OUTPUT)
+                {
+                    spidev_outputs = values[i];
+                }
+                num_ops++;
+            }
+            mcp23s17_spidev_transfer(spidev, ops, num_ops);
+        }
+        goto done;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        piface_hw_write_reg(values[i], regs[i], hw_addr);
+    }
+
+done:
+    return;
+}
+
+bool piface_hw_enable_interrupts(void)
+{
+    /* libpifacedigital only sets up the GPIO pin for this, so it is
+     * also used with spidev.
+     */
+    return hw_sim != NULL || pifacedigital_enable_interrupts() == 0;
+}
+
+void piface_hw_disable_interrupts(void)
+{
+    if (hw_sim == NULL)
+    {
+        pifacedigital_disable_interrupts();
+    }
+}
+
+int piface_hw_open_interrupt_fd(void)
+{
+    char gpio_pin_filename[PATH_MAX];
+    int fd;
+
+    if (hw_sim != NULL)
+    {
+        fd = hw_sim_open_interrupt_fd(hw_sim);
+        goto done;
+    }
+
+    /* Calculate the GPIO pin's path. */
+    snprintf(gpio_pin_filename,
+             sizeof(gpio_pin_filename),
+             "/sys/class/gpio/gpio%d/value",
+             GPIO_INTERRUPT_PIN);
+
+    fd = open(gpio_pin_filename, O_RDONLY | O_NONBLOCK);
+
+done:
+    return fd;
+}
@@ -0,0 +1,68 @@
+#ifndef __PIFACE_HW_H__
+#define __PIFACE_HW_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Access to the PiFace registers and its interrupt, through
+ * libpifacedigital, directly through spidev (see mcp23s17_spidev.h), or
+ * through the simulator (see hw_sim.h).
+ * The single register calls mirror those of libpifacedigital.
+ */
+typedef struct piface_hw_options_st
+{
+    /* If not NULL, the simulator at this path is used. */
+    char const * simulator_path;
+    /* If not NULL, this spidev device is used instead of
+     * libpifacedigital.
+     */
+    char const * spi_device;
+    uint32_t spi_speed_hz;
+} piface_hw_options_st;
+
+#define PIFACE_HW_DEFAULT_SPI_SPEED_HZ 10000000
+
+bool piface_hw_open(int const hw_addr, piface_hw_options_st const * const options);
+
+void piface_hw_close(int const hw_addr);
+
+uint8_t piface_hw_read_reg(uint8_t const reg, int const hw_addr);
+
+void piface_hw_write_reg(uint8_t const value, uint8_t const reg, int const hw_addr);
+
+/* Read the input and output ports together. With spidev, this is one
+ * transfer, so the two are coherent.
+ */
+void piface_hw_read_ports(
+    int const hw_addr,
+    uint8_t * const inputs,
+    uint8_t * const outputs);
+
+/* Change the outputs in write_mask, leaving the others as they are.
+ * With spidev the output latch is cached, so this is a single write.
+ */
+void piface_hw_write_outputs(
+    uint8_t const write_mask,
+    uint8_t const values,
+    int const hw_addr);
+
+/* Write a list of registers, in order. With spidev, this is one kernel
+ * call.
+ */
+void piface_hw_write_regs(
+    uint8_t const * const regs,
+    uint8_t const * const values,
+    size_t const count,
+    int const hw_addr);
+
+bool piface_hw_enable_interrupts(void);
+
+void piface_hw_disable_interrupts(void);
+
+/* Return a file descriptor to poll (EPOLLIN | EPOLLPRI | EPOLLET) for
+ * interrupts, or -1. The caller owns it.
+ */
+int piface_hw_open_interrupt_fd(void);
+
+#endif /* __PIFACE_HW_H__ */
@@ -0,0 +1,55 @@
+#ifndef __PIFACE_SOCKET_PROTOCOL_H__
+#define __PIFACE_SOCKET_PROTOCOL_H__
+
+#include <stdint.h>
+
+/* The protocol used on the daemon's local SOCK_SEQPACKET socket. 
+ * Every request, response and event is a single packet containing one 
+ * piface_socket_msg_st in host byte order. 
+ * Each response echoes the type and sequence number of its request. 
+ * Input bits are set when the input is active (closed), as with the 
+ * ubus get method. 
+ */
+
+#define PIFACE_SOCKET_PROTOCOL_VERSION 1
+
+typedef enum piface_socket_msg_type_t
+{
+    /* Request the input and output states. */
+    piface_socket_msg_read = 1,
+    /* Write the outputs in write_mask to the states in values. The 
+     * response contains the resulting output states. 
+     */
+    piface_socket_msg_write = 2,
+    /* Start/stop sending piface_socket_msg_input_change events. */
+    piface_socket_msg_subscribe = 3,
+    piface_socket_msg_unsubscribe = 4,
+    /* Sent by the daemon when the inputs change. */
+    piface_socket_msg_input_change = 5
+} piface_socket_msg_type_t;
+
+typedef enum piface_socket_status_t
+{
+    piface_socket_status_ok = 0,
+    piface_socket_status_bad_request = 1,
+    piface_socket_status_bad_version = 2,
+    /* The write couldn't be queued to the hardware. The outputs in the 
+     * response are unchanged. 
+     */
+    piface_socket_status_write_failed = 3
+} piface_socket_status_t;
+
+typedef struct piface_socket_msg_st
+{
+    uint8_t version;
+    uint8_t type;
+    uint8_t status;
+    uint8_t reserved;
+    uint32_t sequence;
+    uint32_t write_mask;
+    uint32_t values;
+    uint32_t inputs;
+    uint32_t outputs;
+} piface_socket_msg_st;
+
+#endif /* __PIFACE_SOCKET_PROTOCOL_H__ */
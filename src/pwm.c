@@ -0,0 +1,774 @@
+#include "pwm.h"
+#include "loop_profile.h"
+#include "debug.h"
+
+#include <libubox/blobmsg.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#define BIT(x) (1UL << (x))
+
+#define PWM_MAX_CHANNELS 32
+#define PWM_MIN_FREQUENCY_HZ 1
+#define PWM_MAX_FREQUENCY_HZ 1000
+#define PWM_DEFAULT_FREQUENCY_HZ 100
+#define NSECS_PER_SEC 1000000000LL
+/* Edges due within this time of each other are combined into a single
+ * write of the output register, unless that would put a channel's own
+ * set and clear edges in the same write.
+ */
+#define PWM_MERGE_WINDOW_NSECS 100000LL
+
+typedef struct pwm_channel_st
+{
+    bool enabled;
+    uint32_t frequency; /* Hz */
+    uint32_t duty; /* Percent */
+} pwm_channel_st;
+
+typedef struct pwm_edge_st
+{
+    int64_t offset_nsecs; /* From the start of the period. */
+    uint32_t set_mask;
+    uint32_t clear_mask;
+} pwm_edge_st;
+
+/* All of the channels with the same frequency. They all turn on at the
+ * start of the period and turn off according to their duty cycle.
+ */
+typedef struct pwm_group_st
+{
+    int64_t period_nsecs;
+    int64_t period_start_nsecs;
+    size_t num_edges;
+    size_t next_edge;
+    pwm_edge_st edges[PWM_MAX_CHANNELS + 1];
+} pwm_group_st;
+
+typedef struct pwm_jitter_st
+{
+    uint64_t writes;
+    uint64_t total_nsecs;
+    uint64_t max_nsecs;
+} pwm_jitter_st;
+
+/* The duty that a channel actually got, measured from the times that its
+ * edges were written.
+ */
+typedef struct pwm_duty_meter_st
+{
+    int64_t last_set_nsecs;
+    int64_t last_clear_nsecs;
+    uint64_t on_nsecs;
+    uint64_t period_nsecs;
+} pwm_duty_meter_st;
+
+struct pwm_ctx_st
+{
+    struct ubus_object ubus_object;
+    struct ubus_context * ubus_ctx;
+    struct uloop_fd timer_fd;
+    pwm_write_fn write_cb;
+    pwm_claim_fn claim_cb;
+    void * write_ctx;
+
+    size_t num_channels;
+    pwm_channel_st channels[PWM_MAX_CHANNELS];
+    /* The channels that were enabled when the schedule was built. */
+    uint32_t enabled_mask;
+    size_t num_groups;
+    pwm_group_st groups[PWM_MAX_CHANNELS];
+    /* The groups from before the last rebuild. */
+    size_t num_previous_groups;
+    pwm_group_st previous_groups[PWM_MAX_CHANNELS];
+    pwm_jitter_st jitter;
+    pwm_duty_meter_st duty_meters[PWM_MAX_CHANNELS];
+};
+
+static char const pwm_ubus_name[] = "piface.pwm";
+
+enum
+{
+    PWM_SET_INSTANCE,
+    PWM_SET_FREQUENCY,
+    PWM_SET_DUTY,
+    PWM_SET_ENABLED,
+    __PWM_SET_MAX
+};
+
+static struct blobmsg_policy const pwm_set_policy[__PWM_SET_MAX] =
+{
+    [PWM_SET_INSTANCE] = { .name = "instance", .type = BLOBMSG_TYPE_INT32 },
+    [PWM_SET_FREQUENCY] = { .name = "frequency", .type = BLOBMSG_TYPE_INT32 },
+    [PWM_SET_DUTY] = { .name = "duty", .type = BLOBMSG_TYPE_INT32 },
+    [PWM_SET_ENABLED] = { .name = "enabled", .type = BLOBMSG_TYPE_BOOL }
+};
+
+enum
+{
+    PWM_STATS_RESET,
+    __PWM_STATS_MAX
+};
+
+static struct blobmsg_policy const pwm_stats_policy[__PWM_STATS_MAX] =
+{
+    [PWM_STATS_RESET] = { .name = "reset", .type = BLOBMSG_TYPE_BOOL }
+};
+
+static int64_t
+monotonic_nsecs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * NSECS_PER_SEC + now.tv_nsec;
+}
+
+static int64_t
+group_next_edge_time(pwm_group_st const * const group)
+{
+    return group->period_start_nsecs + group->edges[group->next_edge].offset_nsecs;
+}
+
+static void
+arm_timer(pwm_ctx_st * const ctx)
+{
+    struct itimerspec timer_spec;
+    int64_t next_edge_time = INT64_MAX;
+
+    memset(&timer_spec, 0, sizeof timer_spec);
+
+    for (size_t i = 0; i < ctx->num_groups; i++)
+    {
+        int64_t const edge_time = group_next_edge_time(&ctx->groups[i]);
+
+        if (edge_time < next_edge_time)
+        {
+            next_edge_time = edge_time;
+        }
+    }
+
+    /* A zero time disarms the timer when there are no groups. */
+    if (ctx->num_groups > 0)
+    {
+        timer_spec.it_value.tv_sec = next_edge_time / NSECS_PER_SEC;
+        timer_spec.it_value.tv_nsec = next_edge_time % NSECS_PER_SEC;
+    }
+
+    timerfd_settime(ctx->timer_fd.fd, TFD_TIMER_ABSTIME, &timer_spec, NULL);
+}
+
+static void
+reset_duty_meters(pwm_ctx_st * const ctx)
+{
+    memset(ctx->duty_meters, 0, sizeof ctx->duty_meters);
+}
+
+static void
+update_duty_meters(
+    pwm_ctx_st * const ctx,
+    uint32_t const write_mask,
+    uint32_t const values,
+    int64_t const now)
+{
+    for (size_t i = 0; i < ctx->num_channels; i++)
+    {
+        pwm_duty_meter_st * const meter = &ctx->duty_meters[i];
+
+        if ((write_mask & BIT(i)) == 0)
+        {
+            continue;
+        }
+
+        if ((values & BIT(i)) == 0)
+        {
+            meter->last_clear_nsecs = now;
+            continue;
+        }
+
+        /* A set edge completes the period that the previous one started. */
+        if (meter->last_set_nsecs != 0)
+        {
+            meter->period_nsecs += now - meter->last_set_nsecs;
+            if (meter->last_clear_nsecs > meter->last_set_nsecs)
+            {
+                meter->on_nsecs += meter->last_clear_nsecs - meter->last_set_nsecs;
+            }
+        }
+        meter->last_set_nsecs = now;
+    }
+}
+
+static int
+compare_edges(void const * const a, void const * const b)
+{
+    pwm_edge_st const * const edge_a = a;
+    pwm_edge_st const * const edge_b = b;
+
+    return (edge_a->offset_nsecs > edge_b->offset_nsecs)
+           - (edge_a->offset_nsecs < edge_b->offset_nsecs);
+}
+
+static void
+group_add_channel(
+    pwm_group_st * const group,
+    size_t const instance,
+    int64_t const on_nsecs)
+{
+    /* The first edge is always the start of the period. */
+    group->edges[0].set_mask |= BIT(instance);
+
+    for (size_t i = 1; i < group->num_edges; i++)
+    {
+        if (group->edges[i].offset_nsecs == on_nsecs)
+        {
+            group->edges[i].clear_mask |= BIT(instance);
+            goto done;
+        }
+    }
+
+    pwm_edge_st * const edge = &group->edges[group->num_edges];
+
+    edge->offset_nsecs = on_nsecs;
+    edge->set_mask = 0;
+    edge->clear_mask = BIT(instance);
+    group->num_edges++;
+
+done:
+    return;
+}
+
+static bool
+groups_match(pwm_group_st const * const a, pwm_group_st const * const b)
+{
+    bool match = a->period_nsecs == b->period_nsecs && a->num_edges == b->num_edges;
+
+    for (size_t i = 0; match && i < a->num_edges; i++)
+    {
+        match = a->edges[i].offset_nsecs == b->edges[i].offset_nsecs
+                && a->edges[i].set_mask == b->edges[i].set_mask
+                && a->edges[i].clear_mask == b->edges[i].clear_mask;
+    }
+
+    return match;
+}
+
+/* Carry on with the phase of a group that hasn't changed, so that 
+ * changing one channel doesn't glitch the channels at other frequencies. 
+ */
+static void
+keep_group_phase(pwm_ctx_st const * const ctx, pwm_group_st * const group)
+{
+    for (size_t g = 0; g < ctx->num_previous_groups; g++)
+    {
+        pwm_group_st const * const previous = &ctx->previous_groups[g];
+
+        if (groups_match(group, previous))
+        {
+            group->period_start_nsecs = previous->period_start_nsecs;
+            group->next_edge = previous->next_edge;
+            break;
+        }
+    }
+}
+
+/* Work out the edges for every group of channels sharing a frequency.
+ * This is only done when the configuration changes, so the timer
+ * handler only needs to walk the precomputed edges.
+ */
+static void
+pwm_rebuild_schedule(pwm_ctx_st * const ctx)
+{
+    int64_t const now = monotonic_nsecs();
+    uint32_t enabled_mask = 0;
+    uint32_t steady_mask = 0;
+    uint32_t steady_values = 0;
+
+    memcpy(ctx->previous_groups, ctx->groups, ctx->num_groups * sizeof ctx->groups[0]);
+    ctx->num_previous_groups = ctx->num_groups;
+    ctx->num_groups = 0;
+    reset_duty_meters(ctx);
+
+    for (size_t i = 0; i < ctx->num_channels; i++)
+    {
+        pwm_channel_st const * const channel = &ctx->channels[i];
+
+        if (!channel->enabled)
+        {
+            continue;
+        }
+
+        enabled_mask |= BIT(i);
+
+        if (channel->duty == 0 || channel->duty >= 100)
+        {
+            /* No edges required. */
+            steady_mask |= BIT(i);
+            if (channel->duty >= 100)
+            {
+                steady_values |= BIT(i);
+            }
+            continue;
+        }
+
+        int64_t const period_nsecs = NSECS_PER_SEC / channel->frequency;
+        int64_t const on_nsecs = period_nsecs * channel->duty / 100;
+        pwm_group_st * group = NULL;
+
+        for (size_t g = 0; g < ctx->num_groups; g++)
+        {
+            if (ctx->groups[g].period_nsecs == period_nsecs)
+            {
+                group = &ctx->groups[g];
+                break;
+            }
+        }
+
+        if (group == NULL)
+        {
+            group = &ctx->groups[ctx->num_groups];
+            ctx->num_groups++;
+
+            memset(group, 0, sizeof *group);
+            group->period_nsecs = period_nsecs;
+            group->period_start_nsecs = now;
+            group->num_edges = 1;
+        }
+
+        group_add_channel(group, i, on_nsecs);
+    }
+
+    for (size_t g = 0; g < ctx->num_groups; g++)
+    {
+        pwm_group_st * const group = &ctx->groups[g];
+
+        qsort(&group->edges[1], group->num_edges - 1, sizeof group->edges[0], compare_edges);
+        keep_group_phase(ctx, group);
+    }
+
+    /* Turn off any channels that have stopped so that they aren't left 
+     * on part way through a period. 
+     */
+    steady_mask |= ctx->enabled_mask & ~enabled_mask;
+
+    uint32_t const claimed_mask = enabled_mask & ~ctx->enabled_mask;
+
+    ctx->enabled_mask = enabled_mask;
+
+    if (claimed_mask != 0)
+    {
+        ctx->claim_cb(ctx->write_ctx, claimed_mask);
+    }
+
+    if (steady_mask != 0)
+    {
+        ctx->write_cb(ctx->write_ctx, steady_mask, steady_values);
+    }
+
+    arm_timer(ctx);
+}
+
+static void
+pwm_timer_handler(struct uloop_fd * u, unsigned int events)
+{
+    pwm_ctx_st * const ctx = container_of(u, pwm_ctx_st, timer_fd);
+    uint64_t const profile_start = loop_profile_begin();
+    uint64_t expirations;
+    uint32_t write_mask = 0;
+    uint32_t values = 0;
+    int64_t earliest_edge_time = INT64_MAX;
+    (void)events;
+
+    if (read(ctx->timer_fd.fd, &expirations, sizeof expirations) != sizeof expirations)
+    {
+        goto done;
+    }
+
+    int64_t const now = monotonic_nsecs();
+    int64_t const merge_limit = now + PWM_MERGE_WINDOW_NSECS;
+
+    for (size_t g = 0; g < ctx->num_groups; g++)
+    {
+        pwm_group_st * const group = &ctx->groups[g];
+
+        /* If the loop has been held up for more than a whole period,
+         * start again from now rather than replaying the missed edges.
+         */
+        if (now - group_next_edge_time(group) > group->period_nsecs)
+        {
+            group->period_start_nsecs = now;
+            group->next_edge = 0;
+        }
+
+        while (group_next_edge_time(group) <= merge_limit)
+        {
+            pwm_edge_st const * const edge = &group->edges[group->next_edge];
+            int64_t const edge_time = group_next_edge_time(group);
+
+            /* Merging a channel's clear edge with its own set edge would
+             * cancel the pulse, so write what has been gathered so far and
+             * leave this edge for the timer to fire again straight away.
+             */
+            if (((edge->set_mask | edge->clear_mask) & write_mask) != 0)
+            {
+                break;
+            }
+
+            if (edge_time < earliest_edge_time)
+            {
+                earliest_edge_time = edge_time;
+            }
+
+            write_mask |= edge->set_mask | edge->clear_mask;
+            values |= edge->set_mask;
+            values &= ~edge->clear_mask;
+
+            group->next_edge++;
+            if (group->next_edge == group->num_edges)
+            {
+                group->next_edge = 0;
+                group->period_start_nsecs += group->period_nsecs;
+            }
+        }
+    }
+
+    if (write_mask != 0)
+    {
+        /* One write for all the edges that are due. */
+        ctx->write_cb(ctx->write_ctx, write_mask, values);
+        update_duty_meters(ctx, write_mask, values, now);
+
+        if (now > earliest_edge_time)
+        {
+            uint64_t const jitter_nsecs = now - earliest_edge_time;
+
+            ctx->jitter.total_nsecs += jitter_nsecs;
+            if (jitter_nsecs > ctx->jitter.max_nsecs)
+            {
+                ctx->jitter.max_nsecs = jitter_nsecs;
+            }
+        }
+        ctx->jitter.writes++;
+    }
+
+    arm_timer(ctx);
+
+done:
+    loop_profile_end(loop_profile_handler_pwm_timer, profile_start);
+}
+
+uint32_t pwm_get_enabled_mask(pwm_ctx_st const * const ctx)
+{
+    return ctx->enabled_mask;
+}
+
+void pwm_release(
+    pwm_ctx_st * const ctx,
+    uint32_t const channel_mask)
+{
+    if ((ctx->enabled_mask & channel_mask) == 0)
+    {
+        goto done;
+    }
+
+    /* Whoever is taking over the outputs will write them, so they 
+     * aren't turned off here. 
+     */
+    ctx->enabled_mask &= ~channel_mask;
+    pwm_set_enabled(ctx, channel_mask, 0);
+
+done:
+    return;
+}
+
+void pwm_set_enabled(
+    pwm_ctx_st * const ctx,
+    uint32_t const channel_mask,
+    uint32_t const enabled_mask)
+{
+    bool changed = false;
+
+    for (size_t i = 0; i < ctx->num_channels; i++)
+    {
+        if ((channel_mask & BIT(i)) == 0)
+        {
+            continue;
+        }
+
+        bool const enable = (enabled_mask & BIT(i)) != 0;
+
+        if (ctx->channels[i].enabled != enable)
+        {
+            ctx->channels[i].enabled = enable;
+            changed = true;
+        }
+    }
+
+    if (changed)
+    {
+        pwm_rebuild_schedule(ctx);
+    }
+}
+
+static void
+add_channels(struct blob_buf * const buf, pwm_ctx_st const * const ctx)
+{
+    void * const array_cookie = blobmsg_open_array(buf, "channels");
+
+    for (size_t i = 0; i < ctx->num_channels; i++)
+    {
+        pwm_channel_st const * const channel = &ctx->channels[i];
+        void * const table_cookie = blobmsg_open_table(buf, NULL);
+
+        blobmsg_add_u32(buf, pwm_set_policy[PWM_SET_INSTANCE].name, i);
+        blobmsg_add_u32(buf, pwm_set_policy[PWM_SET_FREQUENCY].name, channel->frequency);
+        blobmsg_add_u32(buf, pwm_set_policy[PWM_SET_DUTY].name, channel->duty);
+        blobmsg_add_bool(buf, pwm_set_policy[PWM_SET_ENABLED].name, channel->enabled);
+
+        blobmsg_close_table(buf, table_cookie);
+    }
+
+    blobmsg_close_array(buf, array_cookie);
+}
+
+static int
+pwm_get_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    pwm_ctx_st * const ctx = container_of(obj, pwm_ctx_st, ubus_object);
+    struct blob_buf buf;
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    add_channels(&buf, ctx);
+    ubus_send_reply(ubus_ctx, req, buf.head);
+
+    blob_buf_free(&buf);
+
+    return UBUS_STATUS_OK;
+}
+
+static int
+pwm_set_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    pwm_ctx_st * const ctx = container_of(obj, pwm_ctx_st, ubus_object);
+    struct blob_attr * tb[__PWM_SET_MAX];
+    int result;
+
+    blobmsg_parse(pwm_set_policy, __PWM_SET_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (tb[PWM_SET_INSTANCE] == NULL)
+    {
+        result = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    uint32_t const instance = blobmsg_get_u32(tb[PWM_SET_INSTANCE]);
+
+    if (instance >= ctx->num_channels)
+    {
+        result = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    pwm_channel_st new_channel = ctx->channels[instance];
+
+    if (tb[PWM_SET_FREQUENCY] != NULL)
+    {
+        new_channel.frequency = blobmsg_get_u32(tb[PWM_SET_FREQUENCY]);
+    }
+    if (tb[PWM_SET_DUTY] != NULL)
+    {
+        new_channel.duty = blobmsg_get_u32(tb[PWM_SET_DUTY]);
+    }
+    if (tb[PWM_SET_ENABLED] != NULL)
+    {
+        new_channel.enabled = blobmsg_get_bool(tb[PWM_SET_ENABLED]);
+    }
+
+    if (new_channel.frequency < PWM_MIN_FREQUENCY_HZ
+        || new_channel.frequency > PWM_MAX_FREQUENCY_HZ
+        || new_channel.duty > 100)
+    {
+        result = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    ctx->channels[instance] = new_channel;
+    pwm_rebuild_schedule(ctx);
+
+    result = UBUS_STATUS_OK;
+
+done:
+    return result;
+}
+
+static int
+pwm_stats_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    pwm_ctx_st * const ctx = container_of(obj, pwm_ctx_st, ubus_object);
+    struct blob_attr * tb[__PWM_STATS_MAX];
+    struct blob_buf buf;
+
+    blobmsg_parse(pwm_stats_policy, __PWM_STATS_MAX, tb, blob_data(msg), blob_len(msg));
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    blobmsg_add_u64(&buf, "writes", ctx->jitter.writes);
+    blobmsg_add_u64(&buf, "mean_jitter_ns",
+                    ctx->jitter.writes > 0 ? ctx->jitter.total_nsecs / ctx->jitter.writes : 0);
+    blobmsg_add_u64(&buf, "max_jitter_ns", ctx->jitter.max_nsecs);
+
+    void * const array_cookie = blobmsg_open_array(&buf, "channels");
+
+    for (size_t i = 0; i < ctx->num_channels; i++)
+    {
+        pwm_channel_st const * const channel = &ctx->channels[i];
+        pwm_duty_meter_st const * const meter = &ctx->duty_meters[i];
+
+        if (!channel->enabled)
+        {
+            continue;
+        }
+
+        void * const table_cookie = blobmsg_open_table(&buf, NULL);
+
+        blobmsg_add_u32(&buf, pwm_set_policy[PWM_SET_INSTANCE].name, i);
+        blobmsg_add_u32(&buf, pwm_set_policy[PWM_SET_DUTY].name, channel->duty);
+        /* Channels at 0 or 100% have no edges, so get exactly that. Others
+         * have no figure until a whole period has been written.
+         */
+        if (channel->duty == 0 || channel->duty >= 100)
+        {
+            blobmsg_add_double(&buf, "actual_duty", channel->duty >= 100 ? 100.0 : 0.0);
+        }
+        else if (meter->period_nsecs > 0)
+        {
+            blobmsg_add_double(&buf, "actual_duty",
+                               100.0 * meter->on_nsecs / meter->period_nsecs);
+        }
+        blobmsg_close_table(&buf, table_cookie);
+    }
+    blobmsg_close_array(&buf, array_cookie);
+
+    ubus_send_reply(ubus_ctx, req, buf.head);
+
+    blob_buf_free(&buf);
+
+    if (tb[PWM_STATS_RESET] != NULL && blobmsg_get_bool(tb[PWM_STATS_RESET]))
+    {
+        memset(&ctx->jitter, 0, sizeof ctx->jitter);
+        reset_duty_meters(ctx);
+    }
+
+    return UBUS_STATUS_OK;
+}
+
+static struct ubus_method const pwm_methods[] =
+{
+    UBUS_METHOD_NOARG("get", pwm_get_handler),
+    UBUS_METHOD("set", pwm_set_handler, pwm_set_policy),
+    UBUS_METHOD("stats", pwm_stats_handler, pwm_stats_policy)
+};
+
+static struct ubus_object_type pwm_object_type =
+    UBUS_OBJECT_TYPE(pwm_ubus_name, pwm_methods);
+
+pwm_ctx_st * pwm_initialise(
+    struct ubus_context * const ubus_ctx,
+    size_t const num_channels,
+    pwm_write_fn const write_cb,
+    pwm_claim_fn const claim_cb,
+    void * const write_ctx)
+{
+    pwm_ctx_st * ctx = NULL;
+
+    if (num_channels > PWM_MAX_CHANNELS)
+    {
+        goto done;
+    }
+
+    ctx = calloc(1, sizeof *ctx);
+    if (ctx == NULL)
+    {
+        goto done;
+    }
+
+    ctx->ubus_ctx = ubus_ctx;
+    ctx->num_channels = num_channels;
+    ctx->write_cb = write_cb;
+    ctx->claim_cb = claim_cb;
+    ctx->write_ctx = write_ctx;
+
+    for (size_t i = 0; i < num_channels; i++)
+    {
+        ctx->channels[i].frequency = PWM_DEFAULT_FREQUENCY_HZ;
+        ctx->channels[i].duty = 50;
+    }
+
+    ctx->timer_fd.fd =
+        timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (ctx->timer_fd.fd < 0)
+    {
+        free(ctx);
+        ctx = NULL;
+        goto done;
+    }
+    ctx->timer_fd.cb = pwm_timer_handler;
+    uloop_fd_add(&ctx->timer_fd, ULOOP_READ);
+
+    ctx->ubus_object.name = pwm_ubus_name;
+    ctx->ubus_object.type = &pwm_object_type;
+    ctx->ubus_object.methods = pwm_methods;
+    ctx->ubus_object.n_methods = ARRAY_SIZE(pwm_methods);
+
+    if (ubus_add_object(ubus_ctx, &ctx->ubus_object) != 0)
+    {
+        EPRINTF("Failed to add ubus object: %s\n", pwm_ubus_name);
+        uloop_fd_delete(&ctx->timer_fd);
+        close(ctx->timer_fd.fd);
+        free(ctx);
+        ctx = NULL;
+        goto done;
+    }
+
+done:
+    return ctx;
+}
+
+void pwm_done(pwm_ctx_st * const ctx)
+{
+    if (ctx == NULL)
+    {
+        goto done;
+    }
+
+    ubus_remove_object(ctx->ubus_ctx, &ctx->ubus_object);
+    uloop_fd_delete(&ctx->timer_fd);
+    close(ctx->timer_fd.fd);
+    free(ctx);
+
+done:
+    return;
+}
@@ -0,0 +1,46 @@
+#ifndef __PWM_H__
+#define __PWM_H__
+
+#include <libubus.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*pwm_write_fn)(
+    void * const write_ctx,
+    uint32_t const write_mask,
+    uint32_t const values);
+
+/* Called with the channels that PWM has just started on, so that 
+ * whatever else was driving those outputs can let go of them. 
+ */
+typedef void (*pwm_claim_fn)(
+    void * const write_ctx,
+    uint32_t const channel_mask);
+
+typedef struct pwm_ctx_st pwm_ctx_st;
+
+pwm_ctx_st * pwm_initialise(
+    struct ubus_context * const ubus_ctx,
+    size_t const num_channels,
+    pwm_write_fn const write_cb,
+    pwm_claim_fn const claim_cb,
+    void * const write_ctx);
+
+void pwm_done(pwm_ctx_st * const ctx);
+
+uint32_t pwm_get_enabled_mask(pwm_ctx_st const * const ctx);
+
+/* Start or stop PWM on the channels in channel_mask. */
+void pwm_set_enabled(
+    pwm_ctx_st * const ctx,
+    uint32_t const channel_mask,
+    uint32_t const enabled_mask);
+
+/* Stop PWM on channels that are about to be written by something else. */
+void pwm_release(
+    pwm_ctx_st * const ctx,
+    uint32_t const channel_mask);
+
+#endif /* __PWM_H__ */
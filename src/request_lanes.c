@@ -0,0 +1,571 @@
+#include "request_lanes.h"
+#include "piface_socket_protocol.h"
+#include "loop_profile.h"
+#include "debug.h"
+
+#include <libubox/blobmsg.h>
+#include <libubox/uloop.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define REQUEST_LANES_DEFAULT_LOW_BATCH 4
+#define REQUEST_LANES_MAX_CLIENTS 32
+
+typedef struct request_lane_stats_st
+{
+    uint32_t depth;
+    uint32_t max_depth;
+    uint64_t requests;
+    uint64_t total_wait_usecs;
+    uint64_t max_wait_usecs;
+} request_lane_stats_st;
+
+typedef struct request_lanes_client_st
+{
+    uint32_t uid;
+    request_lane_t lane;
+} request_lanes_client_st;
+
+/* The methods are indexed by piface_socket_msg_type_t. */
+#define REQUEST_LANES_NUM_METHODS (piface_socket_msg_unsubscribe + 1)
+
+struct request_lanes_st
+{
+    struct ubus_object ubus_object;
+    struct ubus_context * ubus_ctx;
+    struct uloop_timeout drain_timer;
+    request_lanes_process_fn process_cb;
+
+    request_lane_t method_lanes[REQUEST_LANES_NUM_METHODS];
+    request_lanes_client_st clients[REQUEST_LANES_MAX_CLIENTS];
+    size_t num_clients;
+    uint32_t low_batch;
+
+    struct list_head queues[__request_lane_max];
+    request_lane_stats_st stats[__request_lane_max];
+};
+
+static char const request_lanes_ubus_name[] = "piface.lanes";
+
+static char const * const lane_names[] =
+{
+    [request_lane_high] = "high",
+    [request_lane_low] = "low"
+};
+
+static char const * const method_names[REQUEST_LANES_NUM_METHODS] =
+{
+    [piface_socket_msg_read] = "read",
+    [piface_socket_msg_write] = "write",
+    [piface_socket_msg_subscribe] = "subscribe",
+    [piface_socket_msg_unsubscribe] = "unsubscribe"
+};
+
+enum
+{
+    LANES_CONFIG_METHODS,
+    LANES_CONFIG_CLIENTS,
+    LANES_CONFIG_LOW_BATCH,
+    __LANES_CONFIG_MAX
+};
+
+static struct blobmsg_policy const lanes_config_policy[__LANES_CONFIG_MAX] =
+{
+    [LANES_CONFIG_METHODS] = { .name = "methods", .type = BLOBMSG_TYPE_TABLE },
+    [LANES_CONFIG_CLIENTS] = { .name = "clients", .type = BLOBMSG_TYPE_ARRAY },
+    [LANES_CONFIG_LOW_BATCH] = { .name = "low_batch", .type = BLOBMSG_TYPE_INT32 }
+};
+
+enum
+{
+    LANES_CLIENT_UID,
+    LANES_CLIENT_LANE,
+    __LANES_CLIENT_MAX
+};
+
+static struct blobmsg_policy const lanes_client_policy[__LANES_CLIENT_MAX] =
+{
+    [LANES_CLIENT_UID] = { .name = "uid", .type = BLOBMSG_TYPE_INT32 },
+    [LANES_CLIENT_LANE] = { .name = "lane", .type = BLOBMSG_TYPE_STRING }
+};
+
+enum
+{
+    LANES_STATS_RESET,
+    __LANES_STATS_MAX
+};
+
+static struct blobmsg_policy const lanes_stats_policy[__LANES_STATS_MAX] =
+{
+    [LANES_STATS_RESET] = { .name = "reset", .type = BLOBMSG_TYPE_BOOL }
+};
+
+static uint64_t
+now_usecs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static bool
+find_lane(char const * const name, request_lane_t * const lane)
+{
+    bool found = false;
+
+    for (size_t i = 0; i < __request_lane_max; i++)
+    {
+        if (strcmp(lane_names[i], name) == 0)
+        {
+            *lane = i;
+            found = true;
+            break;
+        }
+    }
+
+    return found;
+}
+
+static bool
+find_method(char const * const name, size_t * const method)
+{
+    bool found = false;
+
+    for (size_t i = 0; i < REQUEST_LANES_NUM_METHODS; i++)
+    {
+        if (method_names[i] != NULL && strcmp(method_names[i], name) == 0)
+        {
+            *method = i;
+            found = true;
+            break;
+        }
+    }
+
+    return found;
+}
+
+static void
+take_request(
+    request_lanes_st * const lanes,
+    request_lanes_entry_st * const entry)
+{
+    request_lane_stats_st * const stats = &lanes->stats[entry->lane];
+
+    list_del(&entry->list);
+    stats->depth--;
+}
+
+static void
+process_next_request(
+    request_lanes_st * const lanes,
+    request_lane_t const lane)
+{
+    request_lanes_entry_st * const entry =
+        list_first_entry(&lanes->queues[lane], request_lanes_entry_st, list);
+    request_lane_stats_st * const stats = &lanes->stats[lane];
+    uint64_t const wait_usecs = now_usecs() - entry->queued_usecs;
+
+    take_request(lanes, entry);
+    stats->requests++;
+    stats->total_wait_usecs += wait_usecs;
+    if (wait_usecs > stats->max_wait_usecs)
+    {
+        stats->max_wait_usecs = wait_usecs;
+    }
+
+    lanes->process_cb(entry);
+}
+
+static void
+drain_timeout(struct uloop_timeout * const t)
+{
+    request_lanes_st * const lanes = container_of(t, request_lanes_st, drain_timer);
+    uint64_t const profile_start = loop_profile_begin();
+    uint32_t low_processed = 0;
+
+    /* The high lane is always emptied. Only a batch of the low lane is
+     * processed before going back to the loop, and the high lane is
+     * checked again before each of them.
+     */
+    for (;;)
+    {
+        if (!list_empty(&lanes->queues[request_lane_high]))
+        {
+            process_next_request(lanes, request_lane_high);
+        }
+        else if (!list_empty(&lanes->queues[request_lane_low])
+                 && low_processed < lanes->low_batch)
+        {
+            process_next_request(lanes, request_lane_low);
+            low_processed++;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (!list_empty(&lanes->queues[request_lane_low]))
+    {
+        uloop_timeout_set(&lanes->drain_timer, 0);
+    }
+    loop_profile_end(loop_profile_handler_request_lanes, profile_start);
+}
+
+static int
+lanes_get_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    request_lanes_st * const lanes = container_of(obj, request_lanes_st, ubus_object);
+    struct blob_buf buf;
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    void * const methods_cookie =
+        blobmsg_open_table(&buf, lanes_config_policy[LANES_CONFIG_METHODS].name);
+
+    for (size_t i = 0; i < REQUEST_LANES_NUM_METHODS; i++)
+    {
+        if (method_names[i] != NULL)
+        {
+            blobmsg_add_string(&buf, method_names[i], lane_names[lanes->method_lanes[i]]);
+        }
+    }
+    blobmsg_close_table(&buf, methods_cookie);
+
+    void * const clients_cookie =
+        blobmsg_open_array(&buf, lanes_config_policy[LANES_CONFIG_CLIENTS].name);
+
+    for (size_t i = 0; i < lanes->num_clients; i++)
+    {
+        void * const client_cookie = blobmsg_open_table(&buf, NULL);
+
+        blobmsg_add_u32(&buf, lanes_client_policy[LANES_CLIENT_UID].name,
+                        lanes->clients[i].uid);
+        blobmsg_add_string(&buf, lanes_client_policy[LANES_CLIENT_LANE].name,
+                           lane_names[lanes->clients[i].lane]);
+        blobmsg_close_table(&buf, client_cookie);
+    }
+    blobmsg_close_array(&buf, clients_cookie);
+
+    blobmsg_add_u32(&buf, lanes_config_policy[LANES_CONFIG_LOW_BATCH].name,
+                    lanes->low_batch);
+
+    ubus_send_reply(ubus_ctx, req, buf.head);
+    blob_buf_free(&buf);
+
+    return UBUS_STATUS_OK;
+}
+
+static int
+lanes_stats_handler(
+    struct ubus_context * ubus_ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    request_lanes_st * const lanes = container_of(obj, request_lanes_st, ubus_object);
+    struct blob_attr * tb[__LANES_STATS_MAX];
+    struct blob_buf buf;
+
+    blobmsg_parse(lanes_stats_policy, __LANES_STATS_MAX, tb, blob_data(msg), blob_len(msg));
+
+    memset(&buf, 0, sizeof buf);
+    blob_buf_init(&buf, 0);
+
+    for (size_t i = 0; i < __request_lane_max; i++)
+    {
+        request_lane_stats_st * const stats = &lanes->stats[i];
+        void * const lane_cookie = blobmsg_open_table(&buf, lane_names[i]);
+
+        blobmsg_add_u32(&buf, "depth", stats->depth);
+        blobmsg_add_u32(&buf, "max_depth", stats->max_depth);
+        blobmsg_add_u64(&buf, "requests", stats->requests);
+        blobmsg_add_u64(&buf, "mean_wait_us",
+                        stats->requests > 0 ? stats->total_wait_usecs / stats->requests : 0);
+        blobmsg_add_u64(&buf, "max_wait_us", stats->max_wait_usecs);
+        blobmsg_close_table(&buf, lane_cookie);
+    }
+
+    ubus_send_reply(ubus_ctx, req, buf.head);
+    blob_buf_free(&buf);
+
+    if (tb[LANES_STATS_RESET] != NULL && blobmsg_get_bool(tb[LANES_STATS_RESET]))
+    {
+        /* The current depths are still needed to keep track. */
+        for (size_t i = 0; i < __request_lane_max; i++)
+        {
+            request_lane_stats_st * const stats = &lanes->stats[i];
+            uint32_t const depth = stats->depth;
+
+            memset(stats, 0, sizeof *stats);
+            stats->depth = depth;
+            stats->max_depth = depth;
+        }
+    }
+
+    return UBUS_STATUS_OK;
+}
+
+static struct ubus_method const request_lanes_methods[] =
+{
+    UBUS_METHOD_NOARG("get", lanes_get_handler),
+    UBUS_METHOD("stats", lanes_stats_handler, lanes_stats_policy)
+};
+
+static struct ubus_object_type request_lanes_object_type =
+    UBUS_OBJECT_TYPE(request_lanes_ubus_name, request_lanes_methods);
+
+static bool
+parse_methods(
+    request_lanes_st * const lanes,
+    struct blob_attr * const methods)
+{
+    struct blob_attr * cur;
+    int rem;
+    bool parsed;
+
+    blobmsg_for_each_attr(cur, methods, rem)
+    {
+        size_t method;
+        request_lane_t lane;
+
+        if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING
+            || !find_method(blobmsg_name(cur), &method)
+            || !find_lane(blobmsg_get_string(cur), &lane))
+        {
+            EPRINTF("Invalid lane for method: %s\n", blobmsg_name(cur));
+            parsed = false;
+            goto done;
+        }
+        lanes->method_lanes[method] = lane;
+    }
+
+    parsed = true;
+
+done:
+    return parsed;
+}
+
+static bool
+parse_clients(
+    request_lanes_st * const lanes,
+    struct blob_attr * const clients)
+{
+    struct blob_attr * cur;
+    int rem;
+    bool parsed;
+
+    blobmsg_for_each_attr(cur, clients, rem)
+    {
+        struct blob_attr * tb[__LANES_CLIENT_MAX];
+
+        if (lanes->num_clients >= REQUEST_LANES_MAX_CLIENTS
+            || blobmsg_type(cur) != BLOBMSG_TYPE_TABLE)
+        {
+            parsed = false;
+            goto done;
+        }
+
+        request_lanes_client_st * const client = &lanes->clients[lanes->num_clients];
+
+        blobmsg_parse(lanes_client_policy, __LANES_CLIENT_MAX, tb,
+                      blobmsg_data(cur), blobmsg_data_len(cur));
+
+        if (tb[LANES_CLIENT_UID] == NULL
+            || tb[LANES_CLIENT_LANE] == NULL
+            || !find_lane(blobmsg_get_string(tb[LANES_CLIENT_LANE]), &client->lane))
+        {
+            parsed = false;
+            goto done;
+        }
+        client->uid = blobmsg_get_u32(tb[LANES_CLIENT_UID]);
+        lanes->num_clients++;
+    }
+
+    parsed = true;
+
+done:
+    return parsed;
+}
+
+static bool
+parse_lanes_config(
+    request_lanes_st * const lanes,
+    struct blob_attr * const config_section)
+{
+    struct blob_attr * tb[__LANES_CONFIG_MAX];
+    bool parsed;
+
+    for (size_t i = 0; i < REQUEST_LANES_NUM_METHODS; i++)
+    {
+        lanes->method_lanes[i] = request_lane_low;
+    }
+    lanes->method_lanes[piface_socket_msg_write] = request_lane_high;
+    lanes->low_batch = REQUEST_LANES_DEFAULT_LOW_BATCH;
+
+    if (config_section == NULL)
+    {
+        parsed = true;
+        goto done;
+    }
+
+    blobmsg_parse(lanes_config_policy, __LANES_CONFIG_MAX, tb,
+                  blobmsg_data(config_section), blobmsg_data_len(config_section));
+
+    if (tb[LANES_CONFIG_METHODS] != NULL
+        && !parse_methods(lanes, tb[LANES_CONFIG_METHODS]))
+    {
+        parsed = false;
+        goto done;
+    }
+    if (tb[LANES_CONFIG_CLIENTS] != NULL
+        && !parse_clients(lanes, tb[LANES_CONFIG_CLIENTS]))
+    {
+        parsed = false;
+        goto done;
+    }
+    if (tb[LANES_CONFIG_LOW_BATCH] != NULL)
+    {
+        lanes->low_batch = blobmsg_get_u32(tb[LANES_CONFIG_LOW_BATCH]);
+    }
+    if (lanes->low_batch == 0)
+    {
+        parsed = false;
+        goto done;
+    }
+
+    parsed = true;
+
+done:
+    return parsed;
+}
+
+request_lanes_st * request_lanes_create(
+    struct ubus_context * const ubus_ctx,
+    struct blob_attr * const config_section,
+    request_lanes_process_fn const process_cb)
+{
+    request_lanes_st * lanes = calloc(1, sizeof *lanes);
+
+    if (lanes == NULL)
+    {
+        goto done;
+    }
+
+    lanes->ubus_ctx = ubus_ctx;
+    lanes->process_cb = process_cb;
+    lanes->drain_timer.cb = drain_timeout;
+    for (size_t i = 0; i < __request_lane_max; i++)
+    {
+        INIT_LIST_HEAD(&lanes->queues[i]);
+    }
+
+    if (!parse_lanes_config(lanes, config_section))
+    {
+        EPRINTF("Invalid lanes configuration\n");
+        free(lanes);
+        lanes = NULL;
+        goto done;
+    }
+
+    lanes->ubus_object.name = request_lanes_ubus_name;
+    lanes->ubus_object.type = &request_lanes_object_type;
+    lanes->ubus_object.methods = request_lanes_methods;
+    lanes->ubus_object.n_methods = ARRAY_SIZE(request_lanes_methods);
+
+    if (ubus_add_object(ubus_ctx, &lanes->ubus_object) != 0)
+    {
+        EPRINTF("Failed to add ubus object: %s\n", request_lanes_ubus_name);
+        free(lanes);
+        lanes = NULL;
+        goto done;
+    }
+
+done:
+    return lanes;
+}
+
+void request_lanes_done(request_lanes_st * const lanes)
+{
+    if (lanes == NULL)
+    {
+        goto done;
+    }
+
+    uloop_timeout_cancel(&lanes->drain_timer);
+    ubus_remove_object(lanes->ubus_ctx, &lanes->ubus_object);
+    free(lanes);
+
+done:
+    return;
+}
+
+request_lane_t request_lanes_classify(
+    request_lanes_st const * const lanes,
+    uint8_t const msg_type,
+    uint32_t const uid)
+{
+    request_lane_t lane = request_lane_low;
+
+    for (size_t i = 0; i < lanes->num_clients; i++)
+    {
+        if (lanes->clients[i].uid == uid)
+        {
+            lane = lanes->clients[i].lane;
+            goto done;
+        }
+    }
+
+    if (msg_type < REQUEST_LANES_NUM_METHODS && method_names[msg_type] != NULL)
+    {
+        lane = lanes->method_lanes[msg_type];
+    }
+
+done:
+    return lane;
+}
+
+void request_lanes_queue(
+    request_lanes_st * const lanes,
+    request_lanes_entry_st * const entry,
+    request_lane_t const lane)
+{
+    request_lane_stats_st * const stats = &lanes->stats[lane];
+
+    entry->lane = lane;
+    entry->queued_usecs = now_usecs();
+    list_add_tail(&entry->list, &lanes->queues[lane]);
+
+    stats->depth++;
+    if (stats->depth > stats->max_depth)
+    {
+        stats->max_depth = stats->depth;
+    }
+
+    /* Requests are processed once the loop has dealt with whatever else
+     * is ready, rather than in the middle of reading them.
+     */
+    if (!lanes->drain_timer.pending)
+    {
+        uloop_timeout_set(&lanes->drain_timer, 0);
+    }
+}
+
+void request_lanes_remove(
+    request_lanes_st * const lanes,
+    request_lanes_entry_st * const entry)
+{
+    take_request(lanes, entry);
+}
@@ -0,0 +1,67 @@
+#ifndef __REQUEST_LANES_H__
+#define __REQUEST_LANES_H__
+
+#include <libubus.h>
+#include <libubox/list.h>
+
+#include <stdint.h>
+
+/* Priority lanes for the requests made on the local socket. Requests are
+ * queued as they arrive and processed from the loop, high lane first.
+ * The low lane is worked through a batch at a time, going back to the
+ * loop in between, so that writes, interrupts and ubus calls that arrive
+ * meanwhile don't wait behind a burst of reads.
+ * Configured by a section of the form:
+ *   {"methods":{"read":"low","write":"high"},
+ *    "clients":[{"uid":1000,"lane":"low"}],"low_batch":4}
+ * where a client, matched on the uid of the peer, takes precedence over
+ * the method. By default writes use the high lane and everything else the
+ * low lane. piface.lanes get reports the lanes in use, and stats the
+ * depth of each lane and how long its requests waited.
+ */
+typedef enum request_lane_t
+{
+    request_lane_high,
+    request_lane_low,
+    __request_lane_max
+} request_lane_t;
+
+typedef struct request_lanes_st request_lanes_st;
+
+/* Embedded in each queued request. */
+typedef struct request_lanes_entry_st
+{
+    struct list_head list;
+    request_lane_t lane;
+    uint64_t queued_usecs;
+} request_lanes_entry_st;
+
+/* Called for each request as it is taken from its lane. */
+typedef void (*request_lanes_process_fn)(request_lanes_entry_st * const entry);
+
+/* config_section may be NULL. Returns NULL if it is invalid. */
+request_lanes_st * request_lanes_create(
+    struct ubus_context * const ubus_ctx,
+    struct blob_attr * const config_section,
+    request_lanes_process_fn const process_cb);
+
+/* Any requests still queued must have been removed first. */
+void request_lanes_done(request_lanes_st * const lanes);
+
+/* The lane for a request of the given piface_socket_msg_type_t. */
+request_lane_t request_lanes_classify(
+    request_lanes_st const * const lanes,
+    uint8_t const msg_type,
+    uint32_t const uid);
+
+void request_lanes_queue(
+    request_lanes_st * const lanes,
+    request_lanes_entry_st * const entry,
+    request_lane_t const lane);
+
+/* Removes a request that is no longer wanted without processing it. */
+void request_lanes_remove(
+    request_lanes_st * const lanes,
+    request_lanes_entry_st * const entry);
+
+#endif /* __REQUEST_LANES_H__ */
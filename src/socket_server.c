@@ -0,0 +1,397 @@
+#include "socket_server.h"
+#include "piface_socket_protocol.h"
+#include "request_lanes.h"
+#include "loop_profile.h"
+#include "debug.h"
+
+#include <libubox/uloop.h>
+#include <libubox/list.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* The uid of a client whose credentials couldn't be read. */
+#define SOCKET_CLIENT_UNKNOWN_UID UINT32_MAX
+
+typedef struct socket_client_st
+{
+    struct list_head entry;
+    struct uloop_fd fd;
+    socket_server_st * server;
+    uint32_t uid;
+    bool subscribed;
+    /* Requests read from the client that are still in a lane. */
+    struct list_head queued;
+} socket_client_st;
+
+typedef struct queued_request_st
+{
+    request_lanes_entry_st lane_entry;
+    struct list_head client_entry;
+    socket_client_st * client;
+    piface_socket_msg_st request;
+} queued_request_st;
+
+struct socket_server_st
+{
+    struct uloop_fd listen_fd;
+    char * socket_path;
+    struct list_head clients;
+    request_lanes_st * lanes;
+    socket_server_handlers_st const * handlers;
+    void * callback_ctx;
+};
+
+static void
+socket_client_free(socket_client_st * const client)
+{
+    queued_request_st * queued;
+    queued_request_st * tmp;
+
+    list_for_each_entry_safe(queued, tmp, &client->queued, client_entry)
+    {
+        request_lanes_remove(client->server->lanes, &queued->lane_entry);
+        list_del(&queued->client_entry);
+        free(queued);
+    }
+
+    uloop_fd_delete(&client->fd);
+    close(client->fd.fd);
+    list_del(&client->entry);
+    free(client);
+}
+
+static void
+socket_client_send(
+    socket_client_st * const client,
+    piface_socket_msg_st const * const msg)
+{
+    /* Never block the loop on a slow client. The message is simply
+     * dropped if the client isn't keeping up.
+     */
+    if (send(client->fd.fd, msg, sizeof *msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0
+        && errno != EAGAIN)
+    {
+        DPRINTF("Failed to send to socket client: %s\n", strerror(errno));
+    }
+}
+
+static void
+process_request(
+    socket_client_st * const client,
+    piface_socket_msg_st const * const request)
+{
+    socket_server_st * const server = client->server;
+    piface_socket_msg_st response =
+    {
+        .version = PIFACE_SOCKET_PROTOCOL_VERSION,
+        .type = request->type,
+        .status = piface_socket_status_ok,
+        .sequence = request->sequence
+    };
+
+    if (request->version != PIFACE_SOCKET_PROTOCOL_VERSION)
+    {
+        response.status = piface_socket_status_bad_version;
+        goto done;
+    }
+
+    switch (request->type)
+    {
+        case piface_socket_msg_read:
+            server->handlers->read_callback(
+                server->callback_ctx, &response.inputs, &response.outputs);
+            break;
+        case piface_socket_msg_write:
+            response.write_mask = request->write_mask;
+            response.values = request->values;
+            if (!server->handlers->write_callback(
+                    server->callback_ctx,
+                    request->write_mask,
+                    request->values,
+                    &response.outputs))
+            {
+                response.status = piface_socket_status_write_failed;
+            }
+            break;
+        case piface_socket_msg_subscribe:
+            client->subscribed = true;
+            break;
+        case piface_socket_msg_unsubscribe:
+            client->subscribed = false;
+            break;
+        default:
+            response.status = piface_socket_status_bad_request;
+            break;
+    }
+
+done:
+    socket_client_send(client, &response);
+}
+
+static void
+process_queued_request(request_lanes_entry_st * const entry)
+{
+    queued_request_st * const queued =
+        container_of(entry, queued_request_st, lane_entry);
+
+    list_del(&queued->client_entry);
+    process_request(queued->client, &queued->request);
+    free(queued);
+}
+
+static void
+queue_request(
+    socket_client_st * const client,
+    piface_socket_msg_st const * const request)
+{
+    request_lanes_st * const lanes = client->server->lanes;
+    queued_request_st * const queued = malloc(sizeof *queued);
+
+    if (queued == NULL)
+    {
+        process_request(client, request);
+        goto done;
+    }
+
+    queued->client = client;
+    queued->request = *request;
+    list_add_tail(&queued->client_entry, &client->queued);
+    request_lanes_queue(
+        lanes,
+        &queued->lane_entry,
+        request_lanes_classify(lanes, request->type, client->uid));
+
+done:
+    return;
+}
+
+static uint32_t
+peer_uid(int const fd)
+{
+    struct ucred credentials;
+    socklen_t length = sizeof credentials;
+
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0
+        ? credentials.uid
+        : SOCKET_CLIENT_UNKNOWN_UID;
+}
+
+static void
+socket_client_handler(struct uloop_fd * u, unsigned int events)
+{
+    socket_client_st * const client = container_of(u, socket_client_st, fd);
+    uint64_t const profile_start = loop_profile_begin();
+    (void)events;
+
+    for (;;)
+    {
+        piface_socket_msg_st request;
+        /* With MSG_TRUNC the whole length of the packet is returned, so a 
+         * packet that is too long is rejected rather than cut short. 
+         */
+        ssize_t const received =
+            recv(client->fd.fd, &request, sizeof request, MSG_DONTWAIT | MSG_TRUNC);
+
+        if (received == 0
+            || (received < 0 && errno != EAGAIN && errno != EINTR))
+        {
+            socket_client_free(client);
+            break;
+        }
+        if (received < 0)
+        {
+            if (errno == EAGAIN)
+            {
+                break;
+            }
+            continue;
+        }
+
+        if (received != sizeof request)
+        {
+            piface_socket_msg_st const response =
+            {
+                .version = PIFACE_SOCKET_PROTOCOL_VERSION,
+                .status = piface_socket_status_bad_request
+            };
+
+            socket_client_send(client, &response);
+            continue;
+        }
+
+        queue_request(client, &request);
+    }
+    loop_profile_end(loop_profile_handler_socket_client, profile_start);
+}
+
+static void
+socket_accept_handler(struct uloop_fd * u, unsigned int events)
+{
+    socket_server_st * const server =
+        container_of(u, socket_server_st, listen_fd);
+    uint64_t const profile_start = loop_profile_begin();
+    (void)events;
+
+    for (;;)
+    {
+        int const fd =
+            accept4(server->listen_fd.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0)
+        {
+            break;
+        }
+
+        socket_client_st * const client = calloc(1, sizeof *client);
+
+        if (client == NULL)
+        {
+            close(fd);
+            continue;
+        }
+
+        client->server = server;
+        client->uid = peer_uid(fd);
+        INIT_LIST_HEAD(&client->queued);
+        client->fd.fd = fd;
+        client->fd.cb = socket_client_handler;
+        list_add_tail(&client->entry, &server->clients);
+        uloop_fd_add(&client->fd, ULOOP_READ);
+    }
+    loop_profile_end(loop_profile_handler_socket_accept, profile_start);
+}
+
+void socket_server_notify_inputs(
+    socket_server_st * const server,
+    uint32_t const inputs)
+{
+    socket_client_st * client;
+    piface_socket_msg_st const event =
+    {
+        .version = PIFACE_SOCKET_PROTOCOL_VERSION,
+        .type = piface_socket_msg_input_change,
+        .status = piface_socket_status_ok,
+        .inputs = inputs
+    };
+
+    if (server == NULL)
+    {
+        goto done;
+    }
+
+    list_for_each_entry(client, &server->clients, entry)
+    {
+        if (client->subscribed)
+        {
+            socket_client_send(client, &event);
+        }
+    }
+
+done:
+    return;
+}
+
+socket_server_st * socket_server_create(
+    struct ubus_context * const ubus_ctx,
+    char const * const socket_path,
+    struct blob_attr * const lanes_config,
+    socket_server_handlers_st const * const handlers,
+    void * const callback_ctx)
+{
+    socket_server_st * server = calloc(1, sizeof *server);
+    struct sockaddr_un addr =
+    {
+        .sun_family = AF_UNIX
+    };
+
+    if (server == NULL)
+    {
+        goto done;
+    }
+
+    INIT_LIST_HEAD(&server->clients);
+    server->handlers = handlers;
+    server->callback_ctx = callback_ctx;
+    server->listen_fd.fd = -1;
+
+    server->lanes = request_lanes_create(ubus_ctx, lanes_config, process_queued_request);
+    if (server->lanes == NULL)
+    {
+        goto error;
+    }
+
+    if (strlen(socket_path) >= sizeof addr.sun_path)
+    {
+        EPRINTF("Socket path too long: %s\n", socket_path);
+        goto error;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    server->listen_fd.fd =
+        socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listen_fd.fd < 0)
+    {
+        goto error;
+    }
+
+    /* Remove any socket left behind by a previous instance. */
+    unlink(socket_path);
+
+    if (bind(server->listen_fd.fd, (struct sockaddr *)&addr, sizeof addr) != 0
+        || listen(server->listen_fd.fd, SOMAXCONN) != 0)
+    {
+        EPRINTF("Failed to listen on socket: %s\n", socket_path);
+        goto error;
+    }
+
+    server->socket_path = strdup(socket_path);
+    server->listen_fd.cb = socket_accept_handler;
+    uloop_fd_add(&server->listen_fd, ULOOP_READ);
+
+    goto done;
+
+error:
+    socket_server_done(server);
+    server = NULL;
+
+done:
+    return server;
+}
+
+void socket_server_done(socket_server_st * const server)
+{
+    socket_client_st * client;
+    socket_client_st * tmp;
+
+    if (server == NULL)
+    {
+        goto done;
+    }
+
+    list_for_each_entry_safe(client, tmp, &server->clients, entry)
+    {
+        socket_client_free(client);
+    }
+
+    if (server->listen_fd.fd >= 0)
+    {
+        uloop_fd_delete(&server->listen_fd);
+        close(server->listen_fd.fd);
+    }
+    if (server->socket_path != NULL)
+    {
+        unlink(server->socket_path);
+        free(server->socket_path);
+    }
+    request_lanes_done(server->lanes);
+    free(server);
+
+done:
+    return;
+}
@@ -0,0 +1,42 @@
+#ifndef __SOCKET_SERVER_H__
+#define __SOCKET_SERVER_H__
+
+#include <libubus.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct socket_server_st socket_server_st;
+
+typedef struct socket_server_handlers_st
+{
+    void (*read_callback)(
+        void * const callback_ctx,
+        uint32_t * const inputs,
+        uint32_t * const outputs);
+    /* Returns false if the write couldn't be made. */
+    bool (*write_callback)(
+        void * const callback_ctx,
+        uint32_t const write_mask,
+        uint32_t const values,
+        uint32_t * const outputs);
+} socket_server_handlers_st;
+
+/* Requests are processed through priority lanes, configured by
+ * lanes_config (which may be NULL). See request_lanes.h.
+ */
+socket_server_st * socket_server_create(
+    struct ubus_context * const ubus_ctx,
+    char const * const socket_path,
+    struct blob_attr * const lanes_config,
+    socket_server_handlers_st const * const handlers,
+    void * const callback_ctx);
+
+void socket_server_done(socket_server_st * const server);
+
+/* Send an input change event to all subscribed clients. */
+void socket_server_notify_inputs(
+    socket_server_st * const server,
+    uint32_t const inputs);
+
+#endif /* __SOCKET_SERVER_H__ */
@@ -0,0 +1,131 @@
+#include "spsc_ring.h"
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE_SIZE 64
+
+struct spsc_ring_st
+{
+    /* Only written by the consumer. */
+    alignas(CACHE_LINE_SIZE) atomic_size_t head;
+    /* Only written by the producer. */
+    alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+    alignas(CACHE_LINE_SIZE) size_t mask;
+    size_t element_size;
+    uint8_t * elements;
+};
+
+static size_t round_up_to_power_of_two(size_t value)
+{
+    size_t result = 1;
+
+    while (result < value)
+    {
+        result <<= 1;
+    }
+
+    return result;
+}
+
+spsc_ring_st * spsc_ring_create(
+    size_t const capacity,
+    size_t const element_size)
+{
+    spsc_ring_st * ring = aligned_alloc(CACHE_LINE_SIZE, sizeof *ring);
+    size_t const actual_capacity = round_up_to_power_of_two(capacity);
+
+    if (ring == NULL)
+    {
+        goto done;
+    }
+
+    memset(ring, 0, sizeof *ring);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->mask = actual_capacity - 1;
+    ring->element_size = element_size;
+    ring->elements = calloc(actual_capacity, element_size);
+    if (ring->elements == NULL)
+    {
+        free(ring);
+        ring = NULL;
+        goto done;
+    }
+
+done:
+    return ring;
+}
+
+void spsc_ring_free(spsc_ring_st * const ring)
+{
+    if (ring == NULL)
+    {
+        goto done;
+    }
+
+    free(ring->elements);
+    free(ring);
+
+done:
+    return;
+}
+
+bool spsc_ring_push(
+    spsc_ring_st * const ring,
+    void const * const element)
+{
+    bool pushed;
+    size_t const tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t const head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (tail - head > ring->mask)
+    {
+        pushed = false;
+        goto done;
+    }
+
+    memcpy(&ring->elements[(tail & ring->mask) * ring->element_size],
+           element,
+           ring->element_size);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    pushed = true;
+
+done:
+    return pushed;
+}
+
+bool spsc_ring_pop(
+    spsc_ring_st * const ring,
+    void * const element)
+{
+    bool popped;
+    size_t const head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t const tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head == tail)
+    {
+        popped = false;
+        goto done;
+    }
+
+    memcpy(element,
+           &ring->elements[(head & ring->mask) * ring->element_size],
+           ring->element_size);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    popped = true;
+
+done:
+    return popped;
+}
+
+size_t spsc_ring_count(spsc_ring_st * const ring)
+{
+    size_t const tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t const head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    return tail - head;
+}
@@ -0,0 +1,28 @@
+#ifndef __SPSC_RING_H__
+#define __SPSC_RING_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A lock-free ring buffer of fixed size elements with a single producer 
+ * thread and a single consumer thread. 
+ */
+typedef struct spsc_ring_st spsc_ring_st;
+
+spsc_ring_st * spsc_ring_create(
+    size_t const capacity,
+    size_t const element_size);
+
+void spsc_ring_free(spsc_ring_st * const ring);
+
+bool spsc_ring_push(
+    spsc_ring_st * const ring,
+    void const * const element);
+
+bool spsc_ring_pop(
+    spsc_ring_st * const ring,
+    void * const element);
+
+size_t spsc_ring_count(spsc_ring_st * const ring);
+
+#endif /* __SPSC_RING_H__ */
@@ -1,4 +1,5 @@
 #include "ubus.h"
+#include "loop_profile.h"
 #include "debug.h"
 
 #include <libubox/blobmsg.h>
@@ -6,13 +7,47 @@
 #include <string.h>
 #include <stdio.h>
 
+/* Reconnection is attempted immediately after the connection is lost, 
+ * then with an exponentially increasing delay up to the maximum. 
+ */
+#define RECONNECT_INITIAL_DELAY_MSECS 50
+#define RECONNECT_MAX_DELAY_MSECS 5000
 
 struct ubus_context * ubus_ctx;
 static const char * ubus_path;
+static bool ubus_connected;
+static int reconnect_delay_msecs;
+static ubus_reconnected_fn reconnected_cb;
+static void * reconnected_ctx;
+static uloop_fd_handler ubus_data_handler;
+
+static void ubus_reconnect_timer(struct uloop_timeout * timeout);
+
+static struct uloop_timeout reconnect_timeout =
+{
+    .cb = ubus_reconnect_timer,
+};
+
+static void
+ubus_handle_fd(struct uloop_fd * u, unsigned int events)
+{
+    uint64_t const profile_start = loop_profile_begin();
+
+    ubus_data_handler(u, events);
+    loop_profile_end(loop_profile_handler_ubus, profile_start);
+}
 
 static void
 ubus_add_fd(void)
 {
+    /* Route the socket's callback through here so that the time spent
+     * handling ubus requests is profiled.
+     */
+    if (ubus_ctx->sock.cb != ubus_handle_fd)
+    {
+        ubus_data_handler = ubus_ctx->sock.cb;
+        ubus_ctx->sock.cb = ubus_handle_fd;
+    }
     ubus_add_uloop(ubus_ctx);
 }
 
@@ -20,28 +55,69 @@ ubus_add_fd(void)
 static void
 ubus_reconnect_timer(struct uloop_timeout * timeout)
 {
-    static struct uloop_timeout retry =
-    {
-        .cb = ubus_reconnect_timer,
-    };
-    int const t = 2;
-    int const timeout_millisecs = t * 1000;
+    uint64_t const profile_start = loop_profile_begin();
 
     if (ubus_reconnect(ubus_ctx, ubus_path) != 0)
     {
-        DPRINTF("Failed to reconnect, trying again in %d seconds\n", t);
-        uloop_timeout_set(&retry, timeout_millisecs);
-        return;
+        if (reconnect_delay_msecs == 0)
+        {
+            reconnect_delay_msecs = RECONNECT_INITIAL_DELAY_MSECS;
+        }
+        else if (reconnect_delay_msecs < RECONNECT_MAX_DELAY_MSECS)
+        {
+            reconnect_delay_msecs *= 2;
+            if (reconnect_delay_msecs > RECONNECT_MAX_DELAY_MSECS)
+            {
+                reconnect_delay_msecs = RECONNECT_MAX_DELAY_MSECS;
+            }
+        }
+        WPRINTF("Failed to reconnect, trying again in %d milliseconds\n", 
+                reconnect_delay_msecs);
+        uloop_timeout_set(&reconnect_timeout, reconnect_delay_msecs);
+        goto done;
     }
 
-    DPRINTF("Reconnected to ubus, new id: %08x\n", ubus_ctx->local_id);
+    IPRINTF("Reconnected to ubus, new id: %08x\n", ubus_ctx->local_id);
+    reconnect_delay_msecs = 0;
+    ubus_connected = true;
     ubus_add_fd();
+
+    /* ubus_reconnect() has re-registered the objects by now, so it is 
+     * safe for the callback to send notifications. 
+     */
+    if (reconnected_cb != NULL)
+    {
+        reconnected_cb(reconnected_ctx);
+    }
+
+done:
+    loop_profile_end(loop_profile_handler_ubus_reconnect, profile_start);
 }
 
 static void
 ubus_connection_lost(struct ubus_context * ctx)
 {
-    ubus_reconnect_timer(NULL);
+    ubus_connected = false;
+    /* This is called from within the ubus fd handler, so the first 
+     * attempt is left to the timer rather than made here. Otherwise its 
+     * time would be profiled as both ubus and ubus_reconnect. 
+     */
+    uloop_timeout_set(&reconnect_timeout, 0);
+}
+
+bool
+ubus_is_connected(void)
+{
+    return ubus_connected;
+}
+
+void
+ubus_set_reconnected_callback(
+    ubus_reconnected_fn const callback,
+    void * const callback_ctx)
+{
+    reconnected_cb = callback;
+    reconnected_ctx = callback_ctx;
 }
 
 struct ubus_context *
@@ -52,11 +128,12 @@ ubus_initialise(char const * const path)
 
     if (ubus_ctx == NULL) 
     {
-        DPRINTF("Failed to connect to ubus on path: %s\n", path);
+        EPRINTF("Failed to connect to ubus on path: %s\n", path);
         goto done;
     }
 
     ubus_ctx->connection_lost = ubus_connection_lost;
+    ubus_connected = true;
 
     ubus_add_fd();
 
@@ -70,6 +147,9 @@ ubus_done(void)
     uloop_fd_delete(&ubus_ctx->sock);
 
     ubus_free(ubus_ctx);
+    uloop_timeout_cancel(&reconnect_timeout);
     ubus_ctx = NULL;
+    ubus_connected = false;
+    reconnected_cb = NULL;
 }
 
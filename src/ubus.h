@@ -3,11 +3,23 @@
 
 #include <libubus.h>
 
+#include <stdbool.h>
+
+typedef void (*ubus_reconnected_fn)(void * const callback_ctx);
+
 struct ubus_context *
 ubus_initialise(char const * const path);
 
 void
 ubus_done(void);
 
+bool
+ubus_is_connected(void);
+
+void
+ubus_set_reconnected_callback(
+    ubus_reconnected_fn const callback,
+    void * const callback_ctx);
+
 
 #endif /* __UBUS_H__ */
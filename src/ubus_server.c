@@ -1,8 +1,25 @@
+#include "ubus_server.h"
+#include "interrupt_config.h"
+#include "output_state_file.h"
+#include "notify_buffer.h"
+#include "hw_thread.h"
+#include "socket_server.h"
+#include "output_sequence.h"
+#include "pwm.h"
 #include "io_states.h"
+#include "piface_hw.h"
+#include "event_journal.h"
+#include "io_groups.h"
+#include "output_cas.h"
+#include "input_wait.h"
+#include "input_gestures.h"
+#include "io_meters.h"
+#include "loop_profile.h"
 #include "debug.h"
 #include "ubus.h"
 
 #include <pifacedigital.h>
+#include <mcp23s17.h>
 #include <libubusgpio/ubus_gpio_server.h>
 
 #include <stdbool.h>
@@ -14,9 +31,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
-#include <limits.h>
 
-#define GPIO_INTERRUPT_PIN 25
+#define NOTIFY_BUFFER_CAPACITY 64
 #define BIT(x) (1UL << (x))
 
 typedef struct ubus_server_ctx_st
@@ -24,6 +40,32 @@ typedef struct ubus_server_ctx_st
     struct uloop_fd gpio_interrupt_fd;
     struct ubus_context * ubus_ctx;
     ubus_gpio_server_ctx_st * ubus_gpio_server_ctx;
+    /* libubusgpio's piface.gpio object, if it could be found. */
+    struct ubus_object const * gpio_ubus_object;
+    interrupt_config_ctx_st * interrupt_config_ctx;
+    output_state_file_st * output_state_file;
+    notify_buffer_st * notify_buffer;
+    /* When not NULL, all hardware access is done by this thread. */
+    hw_thread_st * hw_thread;
+    socket_server_st * socket_server;
+    output_sequence_ctx_st * output_sequence_ctx;
+    pwm_ctx_st * pwm_ctx;
+    event_journal_st * event_journal;
+    io_groups_ctx_st * io_groups_ctx;
+    output_cas_ctx_st * output_cas_ctx;
+    input_wait_ctx_st * input_wait_ctx;
+    input_gestures_st * input_gestures;
+    io_meters_st * io_meters;
+    loop_profile_st * loop_profile;
+    /* The output states as last written by the daemon. */
+    uint32_t output_states;
+    /* The output states as last recorded in the journal and meters. 
+     * With the hardware thread, these trail output_states until the 
+     * thread has made the writes. 
+     */
+    uint32_t recorded_output_states;
+    /* The raw input states as last notified. */
+    uint32_t input_states;
     int hw_addr;
     int gpio_pin_fd;
     int epoll_fd;
@@ -31,6 +73,7 @@ typedef struct ubus_server_ctx_st
 
 static char const binary_input_str[] = "binary-input";
 static char const binary_output_str[] = "binary-output"; 
+static char const pwm_output_str[] = "pwm-output";
 static char const piface_ubus_name[] = "piface.gpio";
 
 static size_t piface_num_inputs(void)
@@ -43,59 +86,266 @@ static size_t piface_num_outputs(void)
     return 8;
 }
 
+static uint32_t
+pwm_outputs_mask(ubus_server_ctx_st const * const server_ctx)
+{
+    return server_ctx->pwm_ctx != NULL ? pwm_get_enabled_mask(server_ctx->pwm_ctx) : 0;
+}
+
+/* Record the outputs in record_mask that have changed since they were 
+ * last recorded. 
+ * Outputs driven by PWM are left out, so that every edge doesn't become 
+ * a journal record and a meter transition. An output that PWM lets go 
+ * of is recorded against its state from before PWM took it. 
+ */
+static void
+record_output_states(
+    ubus_server_ctx_st * const server_ctx,
+    uint32_t const states,
+    uint32_t const record_mask)
+{
+    uint32_t const previous_states = server_ctx->recorded_output_states;
+    uint32_t const recorded_states =
+        (previous_states & ~record_mask) | (states & record_mask);
+    uint32_t const changed = recorded_states ^ previous_states;
+
+    if (changed == 0)
+    {
+        goto done;
+    }
+
+    event_journal_record(server_ctx->event_journal,
+                         event_journal_record_outputs,
+                         changed,
+                         recorded_states);
+    io_meters_update(server_ctx->io_meters, io_meters_outputs, changed, recorded_states);
+    server_ctx->recorded_output_states = recorded_states;
+
+done:
+    return;
+}
+
+/* Called once the hardware thread has made an output write. By then, 
+ * any outputs that the write took from PWM have been released. 
+ */
 static void
+output_write_complete(
+    void * const callback_ctx,
+    uint32_t const inputs,
+    uint32_t const outputs)
+{
+    ubus_server_ctx_st * const server_ctx = callback_ctx;
+    (void)inputs;
+
+    record_output_states(server_ctx, outputs, ~pwm_outputs_mask(server_ctx));
+}
+
+/* Returns false if the write couldn't be queued to the hardware thread, 
+ * in which case nothing is changed. 
+ * Unless from_pwm is set, the write is recorded in the journal and 
+ * meters, and queued writes are only recorded once the thread has made 
+ * them. 
+ */
+static bool
 write_gpio_outputs( 
+    ubus_server_ctx_st * const server_ctx,
     uint32_t const gpio_to_write_bitmask,
     uint32_t const gpio_values,
-    int const hw_addr)
+    bool const from_pwm)
 {
+    bool written;
 
-    uint8_t states = pifacedigital_read_reg(OUTPUT, hw_addr);
-    /* Leave the pins we don't want to write as they are but clear 
-     * the ones we do want to write. 
-     */
-    states &= ~gpio_to_write_bitmask;
-    /* Set the bit for any pins we want to turn on. */
-    states |= gpio_values;
+    if (server_ctx->hw_thread != NULL)
+    {
+        if (!hw_thread_write_outputs(server_ctx->hw_thread, 
+                                     gpio_to_write_bitmask, 
+                                     gpio_values, 
+                                     from_pwm ? NULL : output_write_complete, 
+                                     server_ctx))
+        {
+            EPRINTF("Failed to queue output write\n");
+            written = false;
+            goto done;
+        }
+    }
+    else
+    {
+        piface_hw_write_outputs(gpio_to_write_bitmask, gpio_values, server_ctx->hw_addr);
+    }
+
+    server_ctx->output_states &= ~gpio_to_write_bitmask;
+    server_ctx->output_states |= gpio_values & gpio_to_write_bitmask;
+
+    if (server_ctx->hw_thread == NULL && !from_pwm)
+    {
+        /* The written outputs are recorded even if PWM is about to be 
+         * released from them. 
+         */
+        record_output_states(server_ctx,
+                             server_ctx->output_states,
+                             gpio_to_write_bitmask | ~pwm_outputs_mask(server_ctx));
+    }
+
+    written = true;
+
+done:
+    return written;
+}
+
+static void
+write_register(
+    ubus_server_ctx_st * const server_ctx,
+    uint8_t const reg,
+    uint8_t const value)
+{
+    if (server_ctx->hw_thread != NULL)
+    {
+        if (!hw_thread_write_register(server_ctx->hw_thread, reg, value))
+        {
+            EPRINTF("Failed to queue register write\n");
+        }
+        goto done;
+    }
+
+    piface_hw_write_reg(value, reg, server_ctx->hw_addr);
+
+done:
+    return;
+}
+
+static void
+write_registers(
+    ubus_server_ctx_st * const server_ctx,
+    uint8_t const * const regs,
+    uint8_t const * const values,
+    size_t const count)
+{
+    if (server_ctx->hw_thread != NULL)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            write_register(server_ctx, regs[i], values[i]);
+        }
+        goto done;
+    }
+
+    piface_hw_write_regs(regs, values, count, server_ctx->hw_addr);
 
-    pifacedigital_write_reg(states, OUTPUT, hw_addr);
+done:
+    return;
 }
 
 static uint32_t
-read_gpio_inputs(
-    uint32_t const interesting_pins_bitmask,
-    int const hw_addr)
+read_register(
+    ubus_server_ctx_st * const server_ctx,
+    uint8_t const reg)
 {
+    uint32_t inputs;
+    uint32_t outputs;
+    uint32_t value;
+
+    if (server_ctx->hw_thread == NULL)
+    {
+        value = piface_hw_read_reg(reg, server_ctx->hw_addr);
+        goto done;
+    }
+
+    /* Never wait for the hardware thread. Its snapshot is kept up to 
+     * date by interrupts or polling. Output writes may still be queued, 
+     * so report the states that they will leave the outputs in. 
+     */
+    hw_thread_get_snapshot(server_ctx->hw_thread, &inputs, &outputs);
+    value = reg == INPUT ? inputs : server_ctx->output_states;
+
+done:
+    return value;
+}
+
+static void
+read_gpio_states(
+    ubus_server_ctx_st * const server_ctx,
+    uint32_t * const input_states,
+    uint32_t * const output_states)
+{
+    uint8_t inputs;
+    uint8_t outputs;
+
     /* The state will read true if the input is open, and I want 
      * the input to read as active/ON when the input is low (i.e. 
      * switch ON/closed). 
      * Therefore, the state should be reversed. 
      */
-    uint32_t const all_states = 
-        ~pifacedigital_read_reg(INPUT, hw_addr);
-    uint32_t const interesting_states = 
-        all_states & interesting_pins_bitmask;
 
-    return interesting_states;
+    if (server_ctx->hw_thread != NULL)
+    {
+        *input_states = ~read_register(server_ctx, INPUT);
+        *output_states = read_register(server_ctx, OUTPUT);
+        goto done;
+    }
+
+    piface_hw_read_ports(server_ctx->hw_addr, &inputs, &outputs);
+    *input_states = ~(uint32_t)inputs;
+    *output_states = outputs;
+
+done:
+    return;
 }
 
 static uint32_t
 read_gpio_outputs(
-    uint32_t const interesting_pins_bitmask,
-    int const hw_addr)
+    ubus_server_ctx_st * const server_ctx,
+    uint32_t const interesting_pins_bitmask)
 {
     uint32_t const all_states = 
-        pifacedigital_read_reg(OUTPUT, hw_addr);
+        read_register(server_ctx, OUTPUT);
     uint32_t const interesting_states = 
         all_states & interesting_pins_bitmask;
 
     return interesting_states;
 }
 
+/* Outputs that a client has written are taken away from PWM and from 
+ * any sequence that is playing, and their states are remembered so 
+ * that they can be restored on restart. 
+ */
+static void
+claim_client_outputs(
+    ubus_server_ctx_st * const server_ctx,
+    uint32_t const gpio_mask,
+    uint32_t const gpio_values)
+{
+    pwm_release(server_ctx->pwm_ctx, gpio_mask);
+    output_sequence_release(server_ctx->output_sequence_ctx, gpio_mask);
+    output_state_file_update(server_ctx->output_state_file, gpio_mask, gpio_values);
+}
+
+/* Write outputs on behalf of a client. */
+static bool
+apply_client_output_write(
+    ubus_server_ctx_st * const server_ctx,
+    uint32_t const gpio_to_write_mask,
+    uint32_t const gpio_values)
+{
+    bool written;
+
+    if (!write_gpio_outputs(server_ctx, gpio_to_write_mask, gpio_values, false))
+    {
+        written = false;
+        goto done;
+    }
+
+    claim_client_outputs(server_ctx, gpio_to_write_mask, gpio_values);
+    written = true;
+
+done:
+    return written;
+}
+
 typedef struct
 {
     uint32_t input_states;
     uint32_t output_states;
+    uint32_t pwm_states;
 } get_callback_ctx_st;
 
 static void * get_start_callback(void * const callback_ctx)
@@ -108,8 +358,8 @@ static void * get_start_callback(void * const callback_ctx)
         goto done;
     }
 
-    ctx->input_states = read_gpio_inputs(0xffffffff, server_ctx->hw_addr);
-    ctx->output_states = read_gpio_outputs(0xffffffff, server_ctx->hw_addr);
+    read_gpio_states(server_ctx, &ctx->input_states, &ctx->output_states);
+    ctx->pwm_states = pwm_get_enabled_mask(server_ctx->pwm_ctx);
 
 done:
     return ctx;
@@ -146,6 +396,14 @@ static bool read_state_from_ctx(
         *state = (ctx->output_states & bitmask) != 0;
         read_state = true;
     }
+    else if (strcmp(io_type, pwm_output_str) == 0 
+             && instance < piface_num_outputs())
+    {
+        uint32_t const bitmask = BIT(instance);
+
+        *state = (ctx->pwm_states & bitmask) != 0;
+        read_state = true;
+    }
     else
     {
         read_state = false;
@@ -182,6 +440,7 @@ typedef struct set_context_st
 {
     ubus_server_ctx_st * server_ctx;
     io_states_st * io_states;
+    io_states_st * pwm_states;
 } set_context_st;
 
 static void * set_start_callback(void * const callback_ctx)
@@ -190,6 +449,7 @@ static void * set_start_callback(void * const callback_ctx)
 
     set_ctx->server_ctx = callback_ctx;
     set_ctx->io_states = io_states_create();
+    set_ctx->pwm_states = io_states_create();
 
     return set_ctx;
 }
@@ -199,19 +459,66 @@ static void set_end_callback(void * const callback_ctx)
     set_context_st * const set_ctx = callback_ctx;
     ubus_server_ctx_st * const server_ctx = set_ctx->server_ctx;
     io_states_st * const io_states = set_ctx->io_states;
+    io_states_st * const pwm_states = set_ctx->pwm_states;
+    io_states_st * const current = io_states_create();
+    io_states_st * const changes = io_states_create();
+    unsigned int const num_outputs = piface_num_outputs();
+    uint32_t const all_outputs_mask = BIT(num_outputs) - 1;
 
-    if (io_states == NULL)
+    if (io_states == NULL || pwm_states == NULL || current == NULL || changes == NULL)
     {
         goto done;
     }
 
-    uint32_t const gpio_to_write_mask = io_states_get_interesting_states_mask(io_states);
-    uint32_t const gpio_values = io_states_get_states_mask(io_states);
+    uint32_t requested_mask;
+    uint32_t requested_values;
+    uint32_t changed_mask;
+    uint32_t changed_values;
+
+    io_states_get_slice(io_states, 0, num_outputs, &requested_mask, &requested_values);
 
-    write_gpio_outputs(gpio_to_write_mask, gpio_values, server_ctx->hw_addr);
+    /* Only the outputs that the request changes are written, and a 
+     * request that changes none doesn't touch the hardware. Every output 
+     * in it is still claimed from PWM and sequences. 
+     */
+    bool written = true;
+
+    io_states_set_slice(current, 0, num_outputs, all_outputs_mask, server_ctx->output_states);
+    if (io_states_diff(current, io_states, changes))
+    {
+        io_states_get_slice(changes, 0, num_outputs, &changed_mask, &changed_values);
+
+        /* libubusgpio gives the end callback no way to fail the request, 
+         * so a write that can't be queued is only logged. The outputs 
+         * aren't recorded as changed, so a get still shows the true 
+         * states. 
+         */
+        written = write_gpio_outputs(server_ctx, changed_mask, changed_values, false);
+        if (written)
+        {
+            io_states_merge(current, changes);
+        }
+    }
+    if (written && requested_mask != 0)
+    {
+        claim_client_outputs(server_ctx, requested_mask, requested_values);
+        DPRINTF("Set %zu outputs, %zu changed, %zu now on\n",
+                io_states_count_modified(io_states),
+                io_states_count_modified(changes),
+                io_states_count_active(current));
+    }
+
+    uint32_t pwm_mask;
+    uint32_t pwm_values;
+
+    io_states_get_slice(pwm_states, 0, num_outputs, &pwm_mask, &pwm_values);
+    pwm_set_enabled(server_ctx->pwm_ctx, pwm_mask, pwm_values);
 
 done:
+    io_states_free(changes);
+    io_states_free(current);
     io_states_free(io_states);
+    io_states_free(pwm_states);
     free(set_ctx);
 
     return;
@@ -224,13 +531,24 @@ static bool set_callback(
     ubus_gpio_data_type_st const * const value)
 {
     set_context_st * const set_ctx = callback_ctx;
-    io_states_st * const io_states = set_ctx->io_states;
+    io_states_st * io_states;
     bool wrote_io;
-    bool const io_instance_is_writeable =
-        strcmp(io_type, binary_output_str) == 0
-        && instance < piface_num_outputs();
 
-    if (!io_instance_is_writeable)
+    if (instance >= piface_num_outputs())
+    {
+        wrote_io = false;
+        goto done;
+    }
+
+    if (strcmp(io_type, binary_output_str) == 0)
+    {
+        io_states = set_ctx->io_states;
+    }
+    else if (strcmp(io_type, pwm_output_str) == 0)
+    {
+        io_states = set_ctx->pwm_states;
+    }
+    else
     {
         wrote_io = false;
         goto done;
@@ -267,6 +585,7 @@ static void count_callback(
 
     append_callback(append_ctx, binary_input_str, piface_num_inputs());
     append_callback(append_ctx, binary_output_str, piface_num_outputs());
+    append_callback(append_ctx, pwm_output_str, piface_num_outputs());
 }
 
 static ubus_gpio_server_handlers_st const ubus_gpio_server_handlers =
@@ -286,11 +605,43 @@ static ubus_gpio_server_handlers_st const ubus_gpio_server_handlers =
     }
 };
 
-void
-notify_input_state_change(
+/* libubusgpio doesn't hand out its ubus object, but the object is 
+ * registered on the context like any other, so it can be found by name. 
+ */
+static struct ubus_object const *
+find_ubus_object(
+    struct ubus_context * const ubus_ctx,
+    char const * const name)
+{
+    struct ubus_object * obj;
+    struct ubus_object const * found = NULL;
+
+    avl_for_each_element(&ubus_ctx->objects, obj, avl)
+    {
+        if (obj->name != NULL && strcmp(obj->name, name) == 0)
+        {
+            found = obj;
+            break;
+        }
+    }
+
+    return found;
+}
+
+static void
+send_input_state_notification(
     ubus_server_ctx_st * const server_ctx,
     uint8_t const states)
 {
+    /* Building the message costs a value and an append per input, which 
+     * is wasted when nobody is subscribed. 
+     */
+    if (server_ctx->gpio_ubus_object != NULL 
+        && !server_ctx->gpio_ubus_object->has_subscribers)
+    {
+        goto done;
+    }
+
     ubus_gpio_notify_message_ctx_st * const ctx = 
         ubus_notify_message_create();
 
@@ -303,12 +654,211 @@ notify_input_state_change(
     }
 
     ubus_notify_message_send(ctx, server_ctx->ubus_gpio_server_ctx);
+
+done:
+    return;
+}
+
+static void
+socket_read_callback(
+    void * const callback_ctx,
+    uint32_t * const inputs,
+    uint32_t * const outputs)
+{
+    ubus_server_ctx_st * const server_ctx = callback_ctx;
+
+    read_gpio_states(server_ctx, inputs, outputs);
+    *inputs &= BIT(piface_num_inputs()) - 1;
+    *outputs &= BIT(piface_num_outputs()) - 1;
+}
+
+static bool
+socket_write_callback(
+    void * const callback_ctx,
+    uint32_t const write_mask,
+    uint32_t const values,
+    uint32_t * const outputs)
+{
+    ubus_server_ctx_st * const server_ctx = callback_ctx;
+    uint32_t const valid_mask = BIT(piface_num_outputs()) - 1;
+    bool const written = 
+        apply_client_output_write(server_ctx, write_mask & valid_mask, values & valid_mask);
+
+    *outputs = read_gpio_outputs(server_ctx, valid_mask);
+
+    return written;
+}
+
+static void
+sequence_write_callback(
+    void * const write_ctx,
+    uint32_t const write_mask,
+    uint32_t const values)
+{
+    ubus_server_ctx_st * const server_ctx = write_ctx;
+
+    /* A sequence step takes its outputs away from PWM, as a client 
+     * write does. 
+     */
+    pwm_release(server_ctx->pwm_ctx, write_mask);
+    write_gpio_outputs(server_ctx, write_mask, values, false);
+}
+
+static void
+pwm_claim_callback(
+    void * const write_ctx,
+    uint32_t const channel_mask)
+{
+    ubus_server_ctx_st * const server_ctx = write_ctx;
+
+    output_sequence_release(server_ctx->output_sequence_ctx, channel_mask);
+}
+
+static void
+pwm_write_callback(
+    void * const write_ctx,
+    uint32_t const write_mask,
+    uint32_t const values)
+{
+    ubus_server_ctx_st * const server_ctx = write_ctx;
+
+    write_gpio_outputs(server_ctx, write_mask, values, true);
+}
+
+static bool
+group_write_callback(
+    void * const callback_ctx,
+    uint32_t const write_mask,
+    uint32_t const values)
+{
+    ubus_server_ctx_st * const server_ctx = callback_ctx;
+
+    return apply_client_output_write(server_ctx, write_mask, values);
+}
+
+static uint32_t
+group_read_callback(void * const callback_ctx)
+{
+    ubus_server_ctx_st * const server_ctx = callback_ctx;
+
+    return read_gpio_outputs(server_ctx, BIT(piface_num_outputs()) - 1);
+}
+
+static bool
+cas_write_callback(
+    void * const callback_ctx,
+    uint32_t const write_mask,
+    uint32_t const values)
+{
+    ubus_server_ctx_st * const server_ctx = callback_ctx;
+
+    return apply_client_output_write(server_ctx, write_mask, values);
+}
+
+static uint32_t
+cas_read_callback(void * const callback_ctx)
+{
+    ubus_server_ctx_st const * const server_ctx = callback_ctx;
+
+    return server_ctx->output_states;
+}
+
+static uint32_t
+input_wait_read_callback(void * const callback_ctx)
+{
+    ubus_server_ctx_st * const server_ctx = callback_ctx;
+    uint32_t inputs;
+    uint32_t outputs;
+
+    read_gpio_states(server_ctx, &inputs, &outputs);
+
+    return inputs;
+}
+
+static socket_server_handlers_st const socket_server_handlers =
+{
+    .read_callback = socket_read_callback,
+    .write_callback = socket_write_callback
+};
+
+void
+notify_input_state_change(
+    ubus_server_ctx_st * const server_ctx,
+    uint8_t const states)
+{
+    uint32_t const changed = states ^ server_ctx->input_states;
+
+    server_ctx->input_states = states;
+    if (changed != 0)
+    {
+        /* The journal uses the same input sense as the get method. */
+        event_journal_record(server_ctx->event_journal,
+                             event_journal_record_inputs,
+                             changed,
+                             ~states);
+        input_wait_inputs_changed(server_ctx->input_wait_ctx, changed, ~states);
+        input_gestures_inputs_changed(server_ctx->input_gestures, changed, ~states);
+        io_meters_update(server_ctx->io_meters, io_meters_inputs, changed, ~states);
+    }
+
+    /* Socket clients use the same input sense as the get method. */
+    socket_server_notify_inputs(
+        server_ctx->socket_server, 
+        ~states & (BIT(piface_num_inputs()) - 1));
+
+    /* Hold on to the changes while ubus is unavailable, and send them 
+     * once it has reconnected. 
+     */
+    if (!ubus_is_connected())
+    {
+        notify_buffer_add(server_ctx->notify_buffer, states);
+        goto done;
+    }
+
+    send_input_state_notification(server_ctx, states);
+
+done:
+    return;
+}
+
+static void
+flush_buffered_notifications(void * const callback_ctx)
+{
+    ubus_server_ctx_st * const server_ctx = callback_ctx;
+    uint32_t states;
+
+    while (notify_buffer_remove(server_ctx->notify_buffer, &states))
+    {
+        send_input_state_notification(server_ctx, states);
+    }
+}
+
+/* Nothing is notified, as no client can have subscribed to piface.gpio 
+ * yet. Clients that track the outputs should get them when they 
+ * (re)start, rather than wait for a notification. 
+ */
+static void
+restore_output_states(ubus_server_ctx_st * const server_ctx)
+{
+    uint32_t commanded_mask;
+    uint32_t states;
+
+    if (!output_state_file_get(server_ctx->output_state_file, &commanded_mask, &states))
+    {
+        goto done;
+    }
+
+    write_gpio_outputs(server_ctx, commanded_mask, states, false);
+
+done:
+    return;
 }
 
 static void handle_input_state_change(struct uloop_fd * u, unsigned int events)
 {
     ubus_server_ctx_st * const server_ctx =
         container_of(u, ubus_server_ctx_st, gpio_interrupt_fd);
+    uint64_t const profile_start = loop_profile_begin();
     (void)events;
 
     /* This handler is called when the epoll_fd file handle is ready to read, 
@@ -320,15 +870,28 @@ static void handle_input_state_change(struct uloop_fd * u, unsigned int events)
      */
 
     /* Read the input register, thus clearing the interrupt. */
-    uint8_t const states = pifacedigital_read_reg(INPUT, server_ctx->hw_addr);
+    uint8_t const states = piface_hw_read_reg(INPUT, server_ctx->hw_addr);
 
     notify_input_state_change(server_ctx, states);
 
     /* Now call epoll_wait, which will stop this handler getting called until 
-     * the inputs change state again. 
+     * the inputs change state again. The event that got us here is still 
+     * pending, so there's no need to wait, and waiting would stall the 
+     * loop if it has already gone. 
      */
     struct epoll_event mcp23s17_epoll_events;
-    epoll_wait(server_ctx->epoll_fd, &mcp23s17_epoll_events, 1, -1);
+    epoll_wait(server_ctx->epoll_fd, &mcp23s17_epoll_events, 1, 0);
+    loop_profile_end(loop_profile_handler_gpio_interrupt, profile_start);
+}
+
+static void
+hw_thread_input_change(
+    void * const callback_ctx,
+    uint32_t const inputs)
+{
+    ubus_server_ctx_st * const server_ctx = callback_ctx;
+
+    notify_input_state_change(server_ctx, inputs);
 }
 
 static bool setup_input_state_change_handler(
@@ -338,21 +901,27 @@ static bool setup_input_state_change_handler(
     bool result;
     int epoll_fd;
     int gpio_pin_fd;
-    char gpio_pin_filename[PATH_MAX];
 
-    /* Calculate the GPIO pin's path. */
-    snprintf(gpio_pin_filename,
-             sizeof(gpio_pin_filename),
-             "/sys/class/gpio/gpio%d/value",
-             GPIO_INTERRUPT_PIN);
-
-    gpio_pin_fd = open(gpio_pin_filename, O_RDONLY | O_NONBLOCK);
+    gpio_pin_fd = piface_hw_open_interrupt_fd();
     if (gpio_pin_fd <= 0)
     {
         result = false;
         goto done;
     }
 
+    if (server_ctx->hw_thread != NULL)
+    {
+        /* The hardware thread services the interrupt and passes the 
+         * input states back to hw_thread_input_change(). 
+         */
+        result = hw_thread_watch_interrupt(server_ctx->hw_thread, gpio_pin_fd);
+        if (!result)
+        {
+            close(gpio_pin_fd);
+        }
+        goto done;
+    }
+
     // if we haven't already, create the epoll and the GPIO pin fd's
     epoll_fd = epoll_create(1);
     if (epoll_fd <= 0)
@@ -390,15 +959,38 @@ done:
     return result;
 }
 
+static void
+write_interrupt_enables(
+    void * const apply_ctx,
+    uint8_t const enabled_mask)
+{
+    ubus_server_ctx_st * const server_ctx = apply_ctx;
+
+    /* INTCON survives a restart of the daemon, so clear it to be sure 
+     * that the port interrupts on change, with the interrupts off so 
+     * that the old compare mode can't raise one. 
+     */
+    uint8_t const regs[] = { GPINTENB, INTCONB, GPINTENB };
+    uint8_t const values[] = { 0, 0, enabled_mask };
+
+    write_registers(server_ctx, regs, values, sizeof regs);
+}
+
 static void listen_for_gpio_interrupts(
     ubus_server_ctx_st * const server_ctx)
 {
-    pifacedigital_enable_interrupts();
+    piface_hw_enable_interrupts();
+    /* Only the inputs that have been configured to do so should 
+     * generate interrupts. 
+     */
+    write_interrupt_enables(
+        server_ctx,
+        interrupt_config_get_enabled_mask(server_ctx->interrupt_config_ctx));
     if (!setup_input_state_change_handler(
             server_ctx,
             handle_input_state_change))
     {
-        pifacedigital_disable_interrupts();
+        piface_hw_disable_interrupts();
     }
 }
 
@@ -412,13 +1004,30 @@ static void ubus_server_context_free(ubus_server_ctx_st * const server_ctx)
     {
         close(server_ctx->gpio_pin_fd);
     }
+    interrupt_config_done(server_ctx->interrupt_config_ctx);
     ubus_gpio_server_done(server_ctx->ubus_gpio_server_ctx);
+    output_sequence_done(server_ctx->output_sequence_ctx);
+    pwm_done(server_ctx->pwm_ctx);
+    io_groups_done(server_ctx->io_groups_ctx);
+    output_cas_done(server_ctx->output_cas_ctx);
+    input_wait_done(server_ctx->input_wait_ctx);
+    input_gestures_done(server_ctx->input_gestures);
+    io_meters_done(server_ctx->io_meters);
+    socket_server_done(server_ctx->socket_server);
+    hw_thread_destroy(server_ctx->hw_thread);
+    output_state_file_close(server_ctx->output_state_file);
+    event_journal_done(server_ctx->event_journal);
+    notify_buffer_free(server_ctx->notify_buffer);
+    loop_profile_done(server_ctx->loop_profile);
     free(server_ctx);
 }
 
 static ubus_server_ctx_st * ubus_server_context_alloc(
     struct ubus_context * const ubus_ctx,
-    int hw_addr)
+    int hw_addr,
+    bool const use_hw_thread,
+    bool const listen_for_inputs,
+    config_st * const config)
 {
     ubus_server_ctx_st * server_ctx = calloc(1, sizeof *server_ctx);
 
@@ -431,6 +1040,95 @@ static ubus_server_ctx_st * ubus_server_context_alloc(
     server_ctx->hw_addr = hw_addr;
     server_ctx->epoll_fd = -1;
     server_ctx->gpio_pin_fd = -1;
+    server_ctx->notify_buffer = notify_buffer_create(NOTIFY_BUFFER_CAPACITY);
+    if (server_ctx->notify_buffer == NULL)
+    {
+        ubus_server_context_free(server_ctx);
+        server_ctx = NULL;
+        goto done;
+    }
+
+    /* Profiling starts first so that it covers every callback. */
+    struct blob_attr * const profile_config = config_get_section(config, "profile");
+
+    if (profile_config != NULL)
+    {
+        server_ctx->loop_profile = loop_profile_create(ubus_ctx, profile_config);
+        if (server_ctx->loop_profile == NULL)
+        {
+            EPRINTF("\r\nfailed to initialise loop profile\n");
+            ubus_server_context_free(server_ctx);
+            server_ctx = NULL;
+            goto done;
+        }
+    }
+
+    server_ctx->output_states = piface_hw_read_reg(OUTPUT, hw_addr);
+    server_ctx->recorded_output_states = server_ctx->output_states;
+    server_ctx->input_states = piface_hw_read_reg(INPUT, hw_addr);
+
+    struct blob_attr * const journal_config = config_get_section(config, "journal");
+
+    if (journal_config != NULL)
+    {
+        server_ctx->event_journal = event_journal_create(journal_config);
+        if (server_ctx->event_journal == NULL)
+        {
+            EPRINTF("\r\nfailed to initialise event journal\n");
+            ubus_server_context_free(server_ctx);
+            server_ctx = NULL;
+            goto done;
+        }
+    }
+
+    /* Metering starts before the saved output states are restored, so
+     * that restoring them is counted.
+     */
+    server_ctx->io_meters =
+        io_meters_initialise(
+            ubus_ctx,
+            config,
+            piface_num_inputs(),
+            ~server_ctx->input_states,
+            listen_for_inputs,
+            piface_num_outputs(),
+            server_ctx->output_states);
+    if (server_ctx->io_meters == NULL)
+    {
+        EPRINTF("\r\nfailed to initialise IO meters\n");
+        ubus_server_context_free(server_ctx);
+        server_ctx = NULL;
+        goto done;
+    }
+
+    if (use_hw_thread)
+    {
+        server_ctx->hw_thread = 
+            hw_thread_create(hw_addr, hw_thread_input_change, server_ctx);
+        if (server_ctx->hw_thread == NULL)
+        {
+            EPRINTF("\r\nfailed to start hardware thread\n");
+            ubus_server_context_free(server_ctx);
+            server_ctx = NULL;
+            goto done;
+        }
+    }
+
+    char const * const output_state_filename = 
+        config_get_string(config, "output_state_file");
+
+    if (output_state_filename != NULL)
+    {
+        server_ctx->output_state_file = 
+            output_state_file_open(output_state_filename);
+    }
+
+    /* Put the outputs back the way the clients last left them before 
+     * accepting any requests, so that they don't all need to re-send 
+     * their writes. 
+     */
+    restore_output_states(server_ctx);
+
     server_ctx->ubus_gpio_server_ctx = 
         ubus_gpio_server_initialise(
             ubus_ctx,
@@ -439,7 +1137,148 @@ static ubus_server_ctx_st * ubus_server_context_alloc(
             server_ctx);
     if (server_ctx->ubus_gpio_server_ctx == NULL)
     {
-        DPRINTF("\r\nfailed to initialise UBUS server\n");
+        EPRINTF("\r\nfailed to initialise UBUS server\n");
+        ubus_server_context_free(server_ctx);
+        server_ctx = NULL;
+        goto done;
+    }
+
+    server_ctx->gpio_ubus_object = find_ubus_object(ubus_ctx, piface_ubus_name);
+    if (server_ctx->gpio_ubus_object == NULL)
+    {
+        WPRINTF("Can't find ubus object %s, so notifications are always built\n", piface_ubus_name);
+    }
+
+    server_ctx->output_sequence_ctx =
+        output_sequence_initialise(
+            ubus_ctx,
+            BIT(piface_num_outputs()) - 1,
+            sequence_write_callback,
+            server_ctx);
+    if (server_ctx->output_sequence_ctx == NULL)
+    {
+        EPRINTF("\r\nfailed to initialise output sequencer\n");
+        ubus_server_context_free(server_ctx);
+        server_ctx = NULL;
+        goto done;
+    }
+
+    server_ctx->pwm_ctx =
+        pwm_initialise(
+            ubus_ctx,
+            piface_num_outputs(),
+            pwm_write_callback,
+            pwm_claim_callback,
+            server_ctx);
+    if (server_ctx->pwm_ctx == NULL)
+    {
+        EPRINTF("\r\nfailed to initialise PWM\n");
+        ubus_server_context_free(server_ctx);
+        server_ctx = NULL;
+        goto done;
+    }
+
+    server_ctx->io_groups_ctx =
+        io_groups_initialise(
+            ubus_ctx,
+            config,
+            piface_num_outputs(),
+            group_write_callback,
+            group_read_callback,
+            server_ctx);
+    if (server_ctx->io_groups_ctx == NULL)
+    {
+        EPRINTF("\r\nfailed to initialise output groups\n");
+        ubus_server_context_free(server_ctx);
+        server_ctx = NULL;
+        goto done;
+    }
+
+    server_ctx->output_cas_ctx =
+        output_cas_initialise(
+            ubus_ctx,
+            piface_num_outputs(),
+            cas_write_callback,
+            cas_read_callback,
+            server_ctx);
+    if (server_ctx->output_cas_ctx == NULL)
+    {
+        EPRINTF("\r\nfailed to initialise output compare-and-set\n");
+        ubus_server_context_free(server_ctx);
+        server_ctx = NULL;
+        goto done;
+    }
+
+    server_ctx->input_wait_ctx =
+        input_wait_initialise(
+            ubus_ctx,
+            piface_num_inputs(),
+            listen_for_inputs,
+            input_wait_read_callback,
+            server_ctx);
+    if (server_ctx->input_wait_ctx == NULL)
+    {
+        EPRINTF("\r\nfailed to initialise input waits\n");
+        ubus_server_context_free(server_ctx);
+        server_ctx = NULL;
+        goto done;
+    }
+
+    struct blob_attr * const gestures_config = config_get_section(config, "gestures");
+
+    if (gestures_config != NULL && !listen_for_inputs)
+    {
+        EPRINTF("\r\ninput gestures need state change notifications (-n)\n");
+        ubus_server_context_free(server_ctx);
+        server_ctx = NULL;
+        goto done;
+    }
+
+    if (gestures_config != NULL)
+    {
+        server_ctx->input_gestures =
+            input_gestures_create(ubus_ctx,
+                                  gestures_config,
+                                  piface_num_inputs(),
+                                  ~server_ctx->input_states);
+        if (server_ctx->input_gestures == NULL)
+        {
+            EPRINTF("\r\nfailed to initialise input gestures\n");
+            ubus_server_context_free(server_ctx);
+            server_ctx = NULL;
+            goto done;
+        }
+    }
+
+    char const * const socket_path = config_get_string(config, "socket_path");
+
+    if (socket_path != NULL)
+    {
+        server_ctx->socket_server = 
+            socket_server_create(
+                ubus_ctx,
+                socket_path,
+                config_get_section(config, "lanes"),
+                &socket_server_handlers,
+                server_ctx);
+        if (server_ctx->socket_server == NULL)
+        {
+            EPRINTF("\r\nfailed to initialise socket server\n");
+            ubus_server_context_free(server_ctx);
+            server_ctx = NULL;
+            goto done;
+        }
+    }
+
+    server_ctx->interrupt_config_ctx =
+        interrupt_config_initialise(
+            ubus_ctx,
+            config,
+            write_interrupt_enables,
+            server_ctx);
+    if (server_ctx->interrupt_config_ctx == NULL)
+    {
+        EPRINTF("\r\nfailed to initialise interrupt configuration\n");
         ubus_server_context_free(server_ctx);
         server_ctx = NULL;
         goto done;
@@ -451,14 +1290,16 @@ done:
 
 int run_ubus_server(int const piface_hw_address,
                     char const * const ubus_socket_name,
-                    bool const send_state_change_notifications)
+                    bool const send_state_change_notifications,
+                    bool const use_hw_thread,
+                    config_st * const config)
 {
     int result;
     struct ubus_context * const ubus_ctx = ubus_initialise(ubus_socket_name);
 
     if (ubus_ctx == NULL)
     {
-        DPRINTF("\r\nfailed to initialise UBUS\n");
+        EPRINTF("\r\nfailed to initialise UBUS\n");
         result = -1;
         goto done;
     }
@@ -466,7 +1307,10 @@ int run_ubus_server(int const piface_hw_address,
     ubus_server_ctx_st * const server_ctx =
         ubus_server_context_alloc(
             ubus_ctx, 
-            piface_hw_address);
+            piface_hw_address,
+            use_hw_thread,
+            send_state_change_notifications,
+            config);
     if (server_ctx == NULL)
     {
         goto done;
@@ -474,6 +1318,7 @@ int run_ubus_server(int const piface_hw_address,
 
     if (send_state_change_notifications)
     {
+        ubus_set_reconnected_callback(flush_buffered_notifications, server_ctx);
         listen_for_gpio_interrupts(server_ctx);
     }
 
@@ -1,10 +1,14 @@
 #ifndef __UBUS_SERVER_H__
 #define __UBUS_SERVER_H__
 
+#include "config.h"
+
 #include <stdbool.h>
 
 int run_ubus_server(int const piface_hw_address,
                     char const * const ubus_socket_name,
-                    bool const send_state_change_notifications);
+                    bool const send_state_change_notifications,
+                    bool const use_hw_thread,
+                    config_st * const config);
 
 #endif /* __UBUS_SERVER_H__ */
@@ -0,0 +1,165 @@
+#include "journal_reader.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define RECORDS_PER_READ 1024
+
+static bool
+read_segment(
+    char const * const path,
+    journal_reader_segment_fn const segment_cb,
+    journal_reader_record_fn const record_cb,
+    void * const callback_ctx)
+{
+    FILE * const fp = fopen(path, "rb");
+    event_journal_header_st header;
+    event_journal_record_st records[RECORDS_PER_READ];
+    uint64_t time_us;
+    bool read_ok;
+    size_t num_read;
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Failed to open %s\n", path);
+        read_ok = false;
+        goto done;
+    }
+
+    if (fread(&header, sizeof header, 1, fp) != 1
+        || header.magic != EVENT_JOURNAL_MAGIC
+        || header.version != EVENT_JOURNAL_VERSION
+        || header.record_size != sizeof(event_journal_record_st))
+    {
+        fprintf(stderr, "%s is not a journal segment\n", path);
+        read_ok = false;
+        goto done;
+    }
+
+    if (segment_cb != NULL)
+    {
+        segment_cb(callback_ctx, header.start_time_us);
+    }
+
+    time_us = header.start_time_us;
+    while ((num_read = fread(records, sizeof records[0], RECORDS_PER_READ, fp)) > 0)
+    {
+        for (size_t i = 0; i < num_read; i++)
+        {
+            time_us += records[i].time_delta_us;
+            record_cb(callback_ctx, &records[i], time_us);
+        }
+    }
+
+    read_ok = true;
+
+done:
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+
+    return read_ok;
+}
+
+static int
+compare_names(void const * const a, void const * const b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static bool
+read_directory(
+    char const * const directory,
+    journal_reader_segment_fn const segment_cb,
+    journal_reader_record_fn const record_cb,
+    void * const callback_ctx)
+{
+    DIR * const dir = opendir(directory);
+    struct dirent * entry;
+    char * * names = NULL;
+    size_t num_names = 0;
+    bool read_ok = true;
+
+    if (dir == NULL)
+    {
+        fprintf(stderr, "Failed to open %s\n", directory);
+        read_ok = false;
+        goto done;
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        size_t const length = strlen(entry->d_name);
+        size_t const suffix_length = strlen(EVENT_JOURNAL_FILE_SUFFIX);
+
+        if (strncmp(entry->d_name, EVENT_JOURNAL_FILE_PREFIX, strlen(EVENT_JOURNAL_FILE_PREFIX)) != 0
+            || length < suffix_length
+            || strcmp(entry->d_name + length - suffix_length, EVENT_JOURNAL_FILE_SUFFIX) != 0)
+        {
+            continue;
+        }
+
+        char * * const new_names = realloc(names, (num_names + 1) * sizeof *names);
+
+        if (new_names == NULL)
+        {
+            read_ok = false;
+            goto done;
+        }
+        names = new_names;
+        names[num_names++] = strdup(entry->d_name);
+    }
+
+    /* The segment numbers are zero padded, so name order is age order. */
+    qsort(names, num_names, sizeof *names, compare_names);
+
+    for (size_t i = 0; i < num_names; i++)
+    {
+        char path[PATH_MAX];
+
+        snprintf(path, sizeof path, "%s/%s", directory, names[i]);
+        if (!read_segment(path, segment_cb, record_cb, callback_ctx))
+        {
+            read_ok = false;
+        }
+    }
+
+done:
+    for (size_t i = 0; i < num_names; i++)
+    {
+        free(names[i]);
+    }
+    free(names);
+    if (dir != NULL)
+    {
+        closedir(dir);
+    }
+
+    return read_ok;
+}
+
+bool journal_reader_read(
+    char const * const path,
+    journal_reader_segment_fn const segment_cb,
+    journal_reader_record_fn const record_cb,
+    void * const callback_ctx)
+{
+    struct stat st;
+    bool read_ok;
+
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        read_ok = read_directory(path, segment_cb, record_cb, callback_ctx);
+    }
+    else
+    {
+        read_ok = read_segment(path, segment_cb, record_cb, callback_ctx);
+    }
+
+    return read_ok;
+}
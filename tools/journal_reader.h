@@ -0,0 +1,37 @@
+#ifndef __JOURNAL_READER_H__
+#define __JOURNAL_READER_H__
+
+#include "event_journal_format.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Called for each record in order, with its absolute time in
+ * microseconds since the epoch.
+ */
+typedef void (*journal_reader_record_fn)(
+    void * const callback_ctx,
+    event_journal_record_st const * const record,
+    uint64_t const time_us);
+
+/* Called at the start of each segment, before its records, with the
+ * segment's start time. Consecutive segments can be from different runs
+ * of the daemon, with any amount of time, forwards or back, between
+ * them.
+ */
+typedef void (*journal_reader_segment_fn)(
+    void * const callback_ctx,
+    uint64_t const start_time_us);
+
+/* Read a journal segment, or every segment in a journal directory oldest
+ * first. Returns false if any of it couldn't be read, although the
+ * records that could be are still passed to the callback.
+ * segment_cb may be NULL.
+ */
+bool journal_reader_read(
+    char const * const path,
+    journal_reader_segment_fn const segment_cb,
+    journal_reader_record_fn const record_cb,
+    void * const callback_ctx);
+
+#endif /* __JOURNAL_READER_H__ */
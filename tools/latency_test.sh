@@ -0,0 +1,53 @@
+#!/bin/sh
+# Measure the latency from an input edge to ubus subscribers receiving
+# the notification, using a private ubusd and the daemon running against
+# the PiFace simulator.
+#
+# usage: latency_test.sh [piface_latency options]
+# e.g.   latency_test.sh -N 8 -r 2000 -n 20000
+#        latency_test.sh -R /var/log/piface -x 10
+# The second replays the input changes captured by a daemon's event
+# journal at ten times their original speed.
+# Extra daemon options (e.g. -t) can be given in PIFACE_ARGS.
+
+BIN_DIR=${BIN_DIR:-$(dirname "$0")/../bin}
+UBUSD=${UBUSD:-ubusd}
+UBUS=${UBUS:-ubus}
+
+WORK_DIR=$(mktemp -d)
+UBUS_SOCKET=$WORK_DIR/ubus.sock
+SIMULATOR=$WORK_DIR/piface.sim
+UBUSD_PID=
+PIFACE_PID=
+
+cleanup()
+{
+    [ -n "$PIFACE_PID" ] && kill "$PIFACE_PID" 2>/dev/null && wait "$PIFACE_PID"
+    [ -n "$UBUSD_PID" ] && kill "$UBUSD_PID" 2>/dev/null && wait "$UBUSD_PID"
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT INT TERM
+
+"$UBUSD" -s "$UBUS_SOCKET" &
+UBUSD_PID=$!
+
+tries=0
+while [ ! -S "$UBUS_SOCKET" ]; do
+    tries=$((tries + 1))
+    if [ $tries -gt 50 ]; then
+        echo "ubusd failed to start" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+# shellcheck disable=SC2086
+"$BIN_DIR/piface" -s "$UBUS_SOCKET" -n -S "$SIMULATOR" -l warning $PIFACE_ARGS &
+PIFACE_PID=$!
+
+if ! "$UBUS" -s "$UBUS_SOCKET" -t 5 wait_for piface.gpio; then
+    echo "piface failed to start" >&2
+    exit 1
+fi
+
+"$BIN_DIR/piface_latency" -s "$UBUS_SOCKET" -S "$SIMULATOR" "$@"
@@ -0,0 +1,239 @@
+/* Decodes and summarises the daemon's event journal (see
+ * src/event_journal_format.h).
+ * Either segment files or journal directories can be given. The
+ * segments in a directory are read oldest first.
+ */
+#include "journal_reader.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BIT(x) (1UL << (x))
+#define NUM_IOS 8
+
+typedef struct io_summary_st
+{
+    uint64_t transitions;
+    uint64_t activations;
+    uint64_t active_time_us;
+    bool active;
+} io_summary_st;
+
+typedef struct summary_st
+{
+    uint64_t num_records;
+    uint64_t first_time_us;
+    uint64_t last_time_us;
+    /* The time that the active times have been added up to. */
+    uint64_t accumulated_time_us;
+    /* Whether the states of each type are known yet. */
+    bool states_known[3];
+    io_summary_st ios[3][NUM_IOS];
+    bool print_records;
+} summary_st;
+
+static char const * const type_names[] =
+{
+    [event_journal_record_gap] = "gap",
+    [event_journal_record_inputs] = "inputs",
+    [event_journal_record_outputs] = "outputs"
+};
+
+static void
+format_time(uint64_t const time_us, char * const buf, size_t const buf_size)
+{
+    time_t const secs = time_us / 1000000;
+    struct tm tm;
+    char date[32];
+
+    localtime_r(&secs, &tm);
+    strftime(date, sizeof date, "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(buf, buf_size, "%s.%06u", date, (unsigned int)(time_us % 1000000));
+}
+
+static void
+accumulate_active_time(summary_st * const summary, uint64_t const time_us)
+{
+    /* Wall clock time can go back if the clock is stepped. */
+    uint64_t const elapsed =
+        time_us > summary->accumulated_time_us ? time_us - summary->accumulated_time_us : 0;
+
+    summary->accumulated_time_us = time_us;
+
+    for (size_t type = 0; type < 3; type++)
+    {
+        for (size_t i = 0; i < NUM_IOS; i++)
+        {
+            if (summary->ios[type][i].active)
+            {
+                summary->ios[type][i].active_time_us += elapsed;
+            }
+        }
+    }
+}
+
+/* Nothing is known about the time between segments, which may be when
+ * the daemon was down, so the active times carry on from the start of
+ * the new segment.
+ */
+static void
+process_segment(void * const callback_ctx, uint64_t const start_time_us)
+{
+    summary_st * const summary = callback_ctx;
+
+    summary->accumulated_time_us = start_time_us;
+}
+
+static void
+process_record(
+    void * const callback_ctx,
+    event_journal_record_st const * const record,
+    uint64_t const time_us)
+{
+    summary_st * const summary = callback_ctx;
+    char time_str[48];
+
+    if (summary->num_records == 0)
+    {
+        summary->first_time_us = time_us;
+    }
+    accumulate_active_time(summary, time_us);
+    summary->last_time_us = time_us;
+    summary->num_records++;
+
+    if (record->type != event_journal_record_inputs
+        && record->type != event_journal_record_outputs)
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < NUM_IOS; i++)
+    {
+        io_summary_st * const io = &summary->ios[record->type][i];
+        bool const active = (record->states & BIT(i)) != 0;
+
+        /* The first record for a type gives the starting states, but
+         * only the IOs in its changed mask actually changed.
+         */
+        if ((record->changed & BIT(i)) != 0)
+        {
+            io->transitions++;
+            if (active)
+            {
+                io->activations++;
+            }
+        }
+        io->active = active;
+    }
+    summary->states_known[record->type] = true;
+
+    if (summary->print_records)
+    {
+        format_time(time_us, time_str, sizeof time_str);
+        printf("%s %-7s changed 0x%02x states 0x%02x\n",
+               time_str,
+               type_names[record->type],
+               record->changed,
+               record->states);
+    }
+
+done:
+    return;
+}
+
+static void
+print_summary(summary_st const * const summary)
+{
+    char first[48];
+    char last[48];
+
+    if (summary->num_records == 0)
+    {
+        printf("No records\n");
+        goto done;
+    }
+
+    format_time(summary->first_time_us, first, sizeof first);
+    format_time(summary->last_time_us, last, sizeof last);
+    printf("%llu records from %s to %s\n",
+           (unsigned long long)summary->num_records, first, last);
+
+    for (size_t type = event_journal_record_inputs; type <= event_journal_record_outputs; type++)
+    {
+        if (!summary->states_known[type])
+        {
+            continue;
+        }
+        printf("%s:\n", type_names[type]);
+        for (size_t i = 0; i < NUM_IOS; i++)
+        {
+            io_summary_st const * const io = &summary->ios[type][i];
+
+            printf("  %zu: transitions %llu, activations %llu, active for %.3fs\n",
+                   i,
+                   (unsigned long long)io->transitions,
+                   (unsigned long long)io->activations,
+                   io->active_time_us / 1000000.0);
+        }
+    }
+
+done:
+    return;
+}
+
+static void usage(char const * const program_name)
+{
+    fprintf(stdout, "%s [options] <journal directory or segment>...\n", program_name);
+    fprintf(stdout, "Options:\n");
+    fprintf(stdout, "  -s %-21s %s\n", "", "Only print the summary");
+}
+
+int main(int argc, char * * argv)
+{
+    summary_st summary;
+    bool print_records = true;
+    int exit_code = EXIT_SUCCESS;
+    int option;
+
+    while ((option = getopt(argc, argv, "s?")) != -1)
+    {
+        switch (option)
+        {
+            case 's':
+                print_records = false;
+                break;
+            default:
+                usage(basename(argv[0]));
+                exit_code = EXIT_FAILURE;
+                goto done;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        usage(basename(argv[0]));
+        exit_code = EXIT_FAILURE;
+        goto done;
+    }
+
+    memset(&summary, 0, sizeof summary);
+    summary.print_records = print_records;
+
+    for (int i = optind; i < argc; i++)
+    {
+        if (!journal_reader_read(argv[i], process_segment, process_record, &summary))
+        {
+            exit_code = EXIT_FAILURE;
+        }
+    }
+
+    print_summary(&summary);
+
+done:
+    exit(exit_code);
+}
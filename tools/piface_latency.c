@@ -0,0 +1,689 @@
+/* Measures the time from an input edge to subscribers receiving the
+ * ubus notification for it.
+ * Edges are injected into a daemon running against the simulator (-S).
+ * By default each edge leaves the inputs in a different state from the
+ * one before, so that subscribers can tell which edge a notification is
+ * for. Alternatively the input changes recorded in an event journal (-R)
+ * are replayed with their original timing, sped up by -x. Notifications
+ * are then matched to the next edge that left the inputs in the notified
+ * state. Edges with no notification are counted as dropped.
+ */
+#include "hw_sim.h"
+#include "log.h"
+#include "journal_reader.h"
+
+#include <libubus.h>
+#include <libubox/uloop.h>
+#include <libubox/blobmsg.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define BIT(x) (1UL << (x))
+#define NSECS_PER_SEC 1000000000ULL
+#define NUM_INPUTS 8
+#define SUBSCRIBER_READY_TIMEOUT_MSECS 5000
+
+static char const binary_input_str[] = "binary-input";
+static char const piface_ubus_name[] = "piface.gpio";
+
+/* Shared by the injecting parent and the subscriber processes. */
+typedef struct shared_st
+{
+    atomic_uint subscribers_ready;
+    atomic_uint_least32_t edges_injected;
+    uint32_t num_edges;
+    size_t num_subscribers;
+    /* Indexed by edge. Edge 0 is the initial state. */
+    uint64_t * inject_times;
+    uint8_t * edge_inputs;
+    /* num_subscribers rows of latencies indexed by edge. 0 if none. */
+    uint64_t * latencies;
+    atomic_uint_least32_t * unexpected;
+} shared_st;
+
+typedef struct subscriber_st
+{
+    struct ubus_subscriber subscriber;
+    shared_st * shared;
+    uint64_t * latencies;
+    atomic_uint_least32_t * unexpected;
+    uint32_t last_edge;
+} subscriber_st;
+
+static uint64_t
+now_nsecs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * NSECS_PER_SEC + now.tv_nsec;
+}
+
+/* The input changes to replay, in raw input sense. */
+typedef struct trace_st
+{
+    size_t num_edges;
+    size_t capacity;
+    /* When to replay each edge. These only move forward. */
+    uint64_t * times_us;
+    uint8_t * inputs;
+    uint8_t initial_inputs;
+    /* The longest time between records that is replayed. */
+    uint64_t max_gap_us;
+    /* The journal time of the last record, and where it falls in the
+     * replay.
+     */
+    uint64_t last_record_time_us;
+    uint64_t replay_time_us;
+    bool have_records;
+} trace_st;
+
+static uint8_t
+synthetic_edge_inputs(uint32_t const edge)
+{
+    /* Edge 0 is all inputs open. */
+    return ~edge & 0xff;
+}
+
+static void
+trace_add_record(
+    void * const callback_ctx,
+    event_journal_record_st const * const record,
+    uint64_t const time_us)
+{
+    trace_st * const trace = callback_ctx;
+
+    /* Journal times are wall clock times, so can go back if the clock is
+     * stepped between daemon runs, and skip forward over the time that the
+     * daemon was down. Replay the time between records instead, without
+     * going back and without the long gaps.
+     */
+    if (trace->have_records && time_us > trace->last_record_time_us)
+    {
+        uint64_t const gap_us = time_us - trace->last_record_time_us;
+
+        trace->replay_time_us += gap_us < trace->max_gap_us ? gap_us : trace->max_gap_us;
+    }
+    trace->last_record_time_us = time_us;
+    trace->have_records = true;
+
+    if (record->type != event_journal_record_inputs)
+    {
+        goto done;
+    }
+
+    if (trace->num_edges == trace->capacity)
+    {
+        size_t const capacity = trace->capacity > 0 ? trace->capacity * 2 : 1024;
+        uint64_t * const times_us = realloc(trace->times_us, capacity * sizeof *times_us);
+
+        if (times_us == NULL)
+        {
+            goto done;
+        }
+        trace->times_us = times_us;
+
+        uint8_t * const inputs = realloc(trace->inputs, capacity * sizeof *inputs);
+
+        if (inputs == NULL)
+        {
+            goto done;
+        }
+        trace->inputs = inputs;
+        trace->capacity = capacity;
+    }
+
+    /* The journal records inputs as active when closed, which is the
+     * opposite of the level on the pin.
+     */
+    if (trace->num_edges == 0)
+    {
+        trace->initial_inputs = ~(record->states ^ record->changed);
+    }
+    trace->times_us[trace->num_edges] = trace->replay_time_us;
+    trace->inputs[trace->num_edges] = ~record->states;
+    trace->num_edges++;
+
+done:
+    return;
+}
+
+/* The message layout is libubusgpio's business, but the input values
+ * appear in it in the order they were appended, which is instance order.
+ */
+static void
+collect_input_states(
+    void * const data,
+    size_t const len,
+    bool * const is_input_message,
+    size_t * const num_values,
+    uint32_t * const states)
+{
+    struct blob_attr * pos;
+    size_t rem = len;
+
+    __blob_for_each_attr(pos, data, rem)
+    {
+        char const * const name = blobmsg_name(pos);
+
+        if (name != NULL && strcmp(name, binary_input_str) == 0)
+        {
+            *is_input_message = true;
+        }
+
+        switch (blobmsg_type(pos))
+        {
+            case BLOBMSG_TYPE_TABLE:
+            case BLOBMSG_TYPE_ARRAY:
+                collect_input_states(blobmsg_data(pos),
+                                     blobmsg_data_len(pos),
+                                     is_input_message,
+                                     num_values,
+                                     states);
+                break;
+            case BLOBMSG_TYPE_STRING:
+                if (strcmp(blobmsg_get_string(pos), binary_input_str) == 0)
+                {
+                    *is_input_message = true;
+                }
+                break;
+            case BLOBMSG_TYPE_BOOL:
+                if (blobmsg_get_bool(pos))
+                {
+                    *states |= BIT(*num_values);
+                }
+                (*num_values)++;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static int
+notification_handler(
+    struct ubus_context * ctx,
+    struct ubus_object * obj,
+    struct ubus_request_data * req,
+    char const * method,
+    struct blob_attr * msg)
+{
+    uint64_t const received = now_nsecs();
+    struct ubus_subscriber * const ubus_subscriber =
+        container_of(obj, struct ubus_subscriber, obj);
+    subscriber_st * const subscriber =
+        container_of(ubus_subscriber, subscriber_st, subscriber);
+    shared_st * const shared = subscriber->shared;
+    bool is_input_message = false;
+    size_t num_values = 0;
+    uint32_t states = 0;
+
+    collect_input_states(blob_data(msg), blob_len(msg), &is_input_message, &num_values, &states);
+    if (!is_input_message || num_values != NUM_INPUTS)
+    {
+        goto done;
+    }
+
+    /* The next edge after the last one seen that leaves the inputs in
+     * this state. Any edges skipped over were dropped.
+     */
+    uint32_t const edges_injected =
+        atomic_load_explicit(&shared->edges_injected, memory_order_acquire);
+    uint32_t edge = subscriber->last_edge + 1;
+
+    while (edge <= edges_injected && shared->edge_inputs[edge] != states)
+    {
+        edge++;
+    }
+
+    if (edge > edges_injected)
+    {
+        atomic_fetch_add(subscriber->unexpected, 1);
+        goto done;
+    }
+
+    uint64_t const latency = received - shared->inject_times[edge];
+
+    subscriber->latencies[edge] = latency > 0 ? latency : 1;
+    subscriber->last_edge = edge;
+
+done:
+    return 0;
+}
+
+static void
+subscriber_main(
+    shared_st * const shared,
+    size_t const index,
+    char const * const ubus_socket)
+{
+    subscriber_st subscriber =
+    {
+        .subscriber.cb = notification_handler,
+        .shared = shared,
+        .latencies = &shared->latencies[index * (shared->num_edges + 1)],
+        .unexpected = &shared->unexpected[index]
+    };
+    struct ubus_context * ctx;
+    uint32_t id;
+    int exit_code;
+
+    uloop_init();
+
+    ctx = ubus_connect(ubus_socket);
+    if (ctx == NULL)
+    {
+        fprintf(stderr, "subscriber %zu: failed to connect to ubus\n", index);
+        exit_code = EXIT_FAILURE;
+        goto done;
+    }
+    ubus_add_uloop(ctx);
+
+    if (ubus_register_subscriber(ctx, &subscriber.subscriber) != 0
+        || ubus_lookup_id(ctx, piface_ubus_name, &id) != 0
+        || ubus_subscribe(ctx, &subscriber.subscriber, id) != 0)
+    {
+        fprintf(stderr, "subscriber %zu: failed to subscribe to %s\n", index, piface_ubus_name);
+        exit_code = EXIT_FAILURE;
+        goto done;
+    }
+
+    atomic_fetch_add(&shared->subscribers_ready, 1);
+
+    /* Runs until SIGTERM. */
+    uloop_run();
+
+    exit_code = EXIT_SUCCESS;
+
+done:
+    if (ctx != NULL)
+    {
+        ubus_free(ctx);
+    }
+    uloop_done();
+    _exit(exit_code);
+}
+
+static shared_st *
+shared_create(size_t const num_subscribers, uint32_t const num_edges)
+{
+    size_t const num_times = num_edges + 1;
+    size_t const size =
+        sizeof(shared_st)
+        + num_times * sizeof(uint64_t) * (1 + num_subscribers)
+        + num_subscribers * sizeof(atomic_uint_least32_t)
+        + num_times * sizeof(uint8_t);
+    shared_st * shared =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (shared == MAP_FAILED)
+    {
+        shared = NULL;
+        goto done;
+    }
+
+    /* Anonymous mappings are zero filled. */
+    shared->num_edges = num_edges;
+    shared->num_subscribers = num_subscribers;
+    shared->inject_times = (uint64_t *)(shared + 1);
+    shared->latencies = shared->inject_times + num_times;
+    shared->unexpected =
+        (atomic_uint_least32_t *)(shared->latencies + num_times * num_subscribers);
+    shared->edge_inputs = (uint8_t *)(shared->unexpected + num_subscribers);
+
+done:
+    return shared;
+}
+
+static bool
+wait_for_subscribers(shared_st * const shared)
+{
+    struct timespec const interval =
+    {
+        .tv_sec = 0,
+        .tv_nsec = 10000000
+    };
+    bool all_ready = false;
+
+    for (int waited = 0; waited < SUBSCRIBER_READY_TIMEOUT_MSECS; waited += 10)
+    {
+        if (atomic_load(&shared->subscribers_ready) == shared->num_subscribers)
+        {
+            all_ready = true;
+            break;
+        }
+        nanosleep(&interval, NULL);
+    }
+
+    return all_ready;
+}
+
+static void
+sleep_until(uint64_t const deadline)
+{
+    struct timespec const ts =
+    {
+        .tv_sec = deadline / NSECS_PER_SEC,
+        .tv_nsec = deadline % NSECS_PER_SEC
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+    }
+}
+
+static int
+compare_u64(void const * const a, void const * const b)
+{
+    uint64_t const x = *(uint64_t const *)a;
+    uint64_t const y = *(uint64_t const *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double
+percentile_usecs(uint64_t const * const sorted, size_t const count, double const percentile)
+{
+    size_t index = (size_t)(percentile / 100.0 * count);
+
+    if (index >= count)
+    {
+        index = count - 1;
+    }
+
+    return sorted[index] / 1000.0;
+}
+
+static void
+report(
+    shared_st const * const shared,
+    uint64_t const start,
+    double const elapsed_secs,
+    uint32_t const interrupts_raised)
+{
+    size_t const num_edges = shared->num_edges;
+    uint64_t * const all = malloc(num_edges * shared->num_subscribers * sizeof *all);
+    size_t count = 0;
+    uint64_t total = 0;
+    uint32_t total_unexpected = 0;
+    uint64_t last_received = start;
+
+    printf("edges injected:     %zu in %.3fs (%.0f/s)\n",
+           num_edges, elapsed_secs, num_edges / elapsed_secs);
+    printf("interrupts raised:  %u (%zu coalesced)\n",
+           interrupts_raised, num_edges - interrupts_raised);
+
+    for (size_t i = 0; i < shared->num_subscribers; i++)
+    {
+        uint64_t const * const latencies = &shared->latencies[i * (num_edges + 1)];
+        size_t received = 0;
+
+        for (size_t edge = 1; edge <= num_edges; edge++)
+        {
+            if (latencies[edge] == 0)
+            {
+                continue;
+            }
+            received++;
+            total += latencies[edge];
+            if (shared->inject_times[edge] + latencies[edge] > last_received)
+            {
+                last_received = shared->inject_times[edge] + latencies[edge];
+            }
+            if (all != NULL)
+            {
+                all[count] = latencies[edge];
+            }
+            count++;
+        }
+        total_unexpected += atomic_load(&shared->unexpected[i]);
+        printf("subscriber %-3zu      received %zu, dropped %zu, unexpected %u\n",
+               i, received, num_edges - received, atomic_load(&shared->unexpected[i]));
+    }
+
+    size_t const expected = num_edges * shared->num_subscribers;
+
+    printf("notifications:      received %zu of %zu, dropped %zu (%.2f%%), unexpected %u\n",
+           count,
+           expected,
+           expected - count,
+           expected > 0 ? 100.0 * (expected - count) / expected : 0.0,
+           total_unexpected);
+
+    if (last_received > start)
+    {
+        printf("throughput:         %.0f notifications/s\n",
+               count / ((last_received - start) / (double)NSECS_PER_SEC));
+    }
+
+    if (count > 0 && all != NULL)
+    {
+        qsort(all, count, sizeof *all, compare_u64);
+        printf("latency (us):       min %.1f  mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+               all[0] / 1000.0,
+               (double)total / count / 1000.0,
+               percentile_usecs(all, count, 50.0),
+               percentile_usecs(all, count, 90.0),
+               percentile_usecs(all, count, 99.0),
+               percentile_usecs(all, count, 99.9),
+               all[count - 1] / 1000.0);
+    }
+
+    free(all);
+}
+
+static void usage(char const * const program_name)
+{
+    fprintf(stdout, "%s\n", program_name);
+    fprintf(stdout, "Options:\n");
+    fprintf(stdout, "  -S %-21s %s\n", "register file", "Simulator register file used by the daemon");
+    fprintf(stdout, "  -s %-21s %s\n", "ubus socket", "Ubus socket path");
+    fprintf(stdout, "  -N %-21s %s\n", "subscribers", "Number of subscriber processes (default 1)");
+    fprintf(stdout, "  -r %-21s %s\n", "rate", "Edges per second, 0 for flat out (default 1000)");
+    fprintf(stdout, "  -n %-21s %s\n", "edges", "Number of edges to inject (default 10000)");
+    fprintf(stdout, "  -w %-21s %s\n", "msecs", "Time to wait for the last notifications (default 1000)");
+    fprintf(stdout, "  -R %-21s %s\n", "journal", "Replay the input changes in a journal directory or segment");
+    fprintf(stdout, "  -x %-21s %s\n", "speed", "Replay speed, 0 for flat out (default 1)");
+    fprintf(stdout, "  -g %-21s %s\n", "msecs", "Longest gap between journal records to replay (default 1000)");
+}
+
+int main(int argc, char * * argv)
+{
+    char const * simulator_path = NULL;
+    char const * ubus_socket = NULL;
+    size_t num_subscribers = 1;
+    double rate = 1000;
+    uint32_t num_edges = 10000;
+    unsigned int drain_msecs = 1000;
+    char const * trace_path = NULL;
+    double speed = 1;
+    unsigned long max_gap_msecs = 1000;
+    trace_st trace;
+    hw_sim_st * sim = NULL;
+    shared_st * shared = NULL;
+    pid_t * pids = NULL;
+    size_t num_started = 0;
+    uint32_t interrupts_raised = 0;
+    int exit_code;
+    int option;
+
+    memset(&trace, 0, sizeof trace);
+
+    while ((option = getopt(argc, argv, "S:s:N:r:n:w:R:x:g:?")) != -1)
+    {
+        switch (option)
+        {
+            case 'S':
+                simulator_path = optarg;
+                break;
+            case 's':
+                ubus_socket = optarg;
+                break;
+            case 'N':
+                num_subscribers = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                rate = strtod(optarg, NULL);
+                break;
+            case 'n':
+                num_edges = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                drain_msecs = strtoul(optarg, NULL, 0);
+                break;
+            case 'R':
+                trace_path = optarg;
+                break;
+            case 'x':
+                speed = strtod(optarg, NULL);
+                break;
+            case 'g':
+                max_gap_msecs = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(basename(argv[0]));
+                exit_code = EXIT_FAILURE;
+                goto done;
+        }
+    }
+
+    if (simulator_path == NULL || num_subscribers == 0 || num_edges == 0 || rate < 0 || speed < 0)
+    {
+        usage(basename(argv[0]));
+        exit_code = EXIT_FAILURE;
+        goto done;
+    }
+
+    if (trace_path != NULL)
+    {
+        trace.max_gap_us = (uint64_t)max_gap_msecs * 1000;
+        if (!journal_reader_read(trace_path, NULL, trace_add_record, &trace) || trace.num_edges == 0)
+        {
+            fprintf(stderr, "No input changes to replay in %s\n", trace_path);
+            exit_code = EXIT_FAILURE;
+            goto done;
+        }
+        num_edges = trace.num_edges;
+    }
+
+    log_init(basename(argv[0]), NULL, false);
+
+    sim = hw_sim_open(simulator_path);
+    shared = shared_create(num_subscribers, num_edges);
+    pids = calloc(num_subscribers, sizeof *pids);
+    if (sim == NULL || shared == NULL || pids == NULL)
+    {
+        fprintf(stderr, "Failed to set up\n");
+        exit_code = EXIT_FAILURE;
+        goto done;
+    }
+
+    for (uint32_t edge = 0; edge <= num_edges; edge++)
+    {
+        if (trace_path == NULL)
+        {
+            shared->edge_inputs[edge] = synthetic_edge_inputs(edge);
+        }
+        else
+        {
+            shared->edge_inputs[edge] =
+                edge == 0 ? trace.initial_inputs : trace.inputs[edge - 1];
+        }
+    }
+
+    /* Start from a known state, and let the daemon settle before any
+     * subscriber is listening.
+     */
+    hw_sim_set_inputs(sim, shared->edge_inputs[0]);
+    usleep(100000);
+
+    for (; num_started < num_subscribers; num_started++)
+    {
+        pid_t const pid = fork();
+
+        if (pid < 0)
+        {
+            fprintf(stderr, "Failed to start subscriber\n");
+            exit_code = EXIT_FAILURE;
+            goto done;
+        }
+        if (pid == 0)
+        {
+            subscriber_main(shared, num_started, ubus_socket);
+        }
+        pids[num_started] = pid;
+    }
+
+    if (!wait_for_subscribers(shared))
+    {
+        fprintf(stderr, "Subscribers failed to start\n");
+        exit_code = EXIT_FAILURE;
+        goto done;
+    }
+
+    uint64_t const period = rate > 0 ? (uint64_t)(NSECS_PER_SEC / rate) : 0;
+    uint64_t const start = now_nsecs();
+    uint64_t deadline = start;
+
+    for (uint32_t edge = 1; edge <= num_edges; edge++)
+    {
+        if (trace_path != NULL && speed > 0)
+        {
+            uint64_t const offset_us = trace.times_us[edge - 1] - trace.times_us[0];
+
+            sleep_until(start + (uint64_t)(offset_us * 1000 / speed));
+        }
+        else if (trace_path == NULL && period > 0)
+        {
+            deadline += period;
+            sleep_until(deadline);
+        }
+        shared->inject_times[edge] = now_nsecs();
+        atomic_store_explicit(&shared->edges_injected, edge, memory_order_release);
+        if (hw_sim_set_inputs(sim, shared->edge_inputs[edge]))
+        {
+            interrupts_raised++;
+        }
+    }
+
+    double const elapsed_secs = (now_nsecs() - start) / (double)NSECS_PER_SEC;
+
+    usleep(drain_msecs * 1000);
+
+    if (trace_path != NULL)
+    {
+        printf("trace:              %zu input changes over %.3fs, replayed at %gx\n",
+               trace.num_edges,
+               (trace.times_us[trace.num_edges - 1] - trace.times_us[0]) / 1000000.0,
+               speed);
+    }
+    report(shared, start, elapsed_secs, interrupts_raised);
+
+    exit_code = EXIT_SUCCESS;
+
+done:
+    for (size_t i = 0; i < num_started; i++)
+    {
+        kill(pids[i], SIGTERM);
+        waitpid(pids[i], NULL, 0);
+    }
+    free(pids);
+    free(trace.times_us);
+    free(trace.inputs);
+    hw_sim_close(sim);
+    log_done();
+
+    exit(exit_code);
+}